@@ -0,0 +1,73 @@
+#include "Alerts.h"
+#include "CgmTrend.h"
+#include "data.h"
+#include "TimerWheel.h"
+
+#define ALERT_LEVEL_NAME(id, name) name,
+static const char* alertLevelNames[ALERT_LEVEL_COUNT] = { ALERT_LEVELS(ALERT_LEVEL_NAME) };
+#undef ALERT_LEVEL_NAME
+
+// A reading right at an urgent threshold and heading past it is due now, so that
+// LOW_SOON or HIGH_SOON holds until the URGENT level takes over
+static_assert(CgmTrend::minutesBelow(CGM_URGENT_LOW, CGM_URGENT_LOW, -1) == 0, "Falling at the urgent low must be low soon");
+static_assert(CgmTrend::minutesAbove(CGM_URGENT_HIGH, CGM_URGENT_HIGH, 1) == 0, "At the urgent high and rising must be high soon");
+
+namespace Alerts {
+  alertLevel_enum level(float mgPerDl, float rate, alertLevel_enum current, uint8_t* minutes) {
+    *minutes = 0xFF;
+    if (isnan(mgPerDl)) {
+      return ALERT_NONE;
+    }
+
+    // Thresholds of the current level are widened, so that noise around them does not raise alert after alert
+    float urgentLow = CGM_URGENT_LOW + (current == ALERT_URGENT_LOW ? ALERT_HYSTERESIS : 0);
+    float urgentHigh = CGM_URGENT_HIGH - (current == ALERT_URGENT_HIGH ? ALERT_HYSTERESIS : 0);
+    if (mgPerDl < urgentLow) {
+      return ALERT_URGENT_LOW;
+    } else if (mgPerDl > urgentHigh) {
+      return ALERT_URGENT_HIGH;
+    }
+
+    float projected = CgmTrend::minutesBelow(CGM_URGENT_LOW, mgPerDl, rate);
+    if (projected <= CGM_ALERT_MINUTES + (current == ALERT_LOW_SOON ? ALERT_HYSTERESIS : 0)) {
+      *minutes = projected;
+      return ALERT_LOW_SOON;
+    }
+
+    projected = CgmTrend::minutesAbove(CGM_URGENT_HIGH, mgPerDl, rate);
+    if (projected <= CGM_ALERT_MINUTES + (current == ALERT_HIGH_SOON ? ALERT_HYSTERESIS : 0)) {
+      *minutes = projected;
+      return ALERT_HIGH_SOON;
+    }
+
+    return ALERT_NONE;
+  }
+
+  bool evaluate(struct data_struct* data) {
+    struct alert_struct alert = data->alert.read();
+    float mgPerDl = data->value(CHANNEL_MG_PER_DL);
+    uint8_t minutes;
+    alertLevel_enum level = Alerts::level(mgPerDl, data->value(CHANNEL_CGM_RATE), alert.level, &minutes);
+    if (level == alert.level) {
+      return false;
+    }
+
+    // A random first ID keeps receivers from mistaking the first alert after a reboot for one they already have
+    alert.alertId = (alert.alertId == 0 ? random(1, 0x10000) : alert.alertId + 1);
+    if (alert.alertId == 0) {
+      alert.alertId = 1;
+    }
+    alert.level = level;
+    alert.minutes = minutes;
+    alert.mgPerDl = mgPerDl;
+    alert.raisedAt = Clock::nowMillis();
+    data->alert.write(alert);
+    data->changes.publish(DATA_BIT(DATA_ALERT));
+
+    return true;
+  }
+
+  const char* name(alertLevel_enum level) {
+    return (level < ALERT_LEVEL_COUNT ? alertLevelNames[level] : "unknown");
+  }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <Arduino.h>
+#include "lora-cgm-sender.ino.globals.h"
+
+// Urgent glucose events. The collector raises an alert whenever the level
+// changes (back to ALERT_NONE included) and sends it ahead of all other
+// traffic until every display acknowledged it. Receivers redraw the reading
+// before anything else.
+#define ALERT_LEVELS(X) \
+  X(ALERT_NONE, "none") \
+  X(ALERT_LOW_SOON, "low_soon") /* Projected below CGM_URGENT_LOW within CGM_ALERT_MINUTES */ \
+  X(ALERT_URGENT_LOW, "urgent_low") \
+  X(ALERT_HIGH_SOON, "high_soon") \
+  X(ALERT_URGENT_HIGH, "urgent_high")
+
+#define ALERT_LEVEL_ENUM(id, name) id,
+enum alertLevel_enum : uint8_t { ALERT_LEVELS(ALERT_LEVEL_ENUM) ALERT_LEVEL_COUNT };
+#undef ALERT_LEVEL_ENUM
+
+#define ALERT_HYSTERESIS 3  // mg/dL, and minutes for the projected levels, before a level is left
+#define ALERT_LATENCY_BUDGET 5000  // Milliseconds from raising an alert to drawing it on any display
+
+struct data_struct;
+
+struct alert_struct {
+  uint16_t alertId;  // Changes with every alert, 0 before the first
+  alertLevel_enum level;
+  uint8_t minutes;  // Until the projected crossing, for the _SOON levels
+  float mgPerDl;
+  uint64_t raisedAt;  // Clock::nowMillis() on the collector, or the arrival here minus the time it took
+};
+
+namespace Alerts {
+  // The level for a reading and its rate, staying at current until the reading moved ALERT_HYSTERESIS past the threshold
+  alertLevel_enum level(float mgPerDl, float rate, alertLevel_enum current, uint8_t* minutes);
+  const char* name(alertLevel_enum level);
+
+  // Raises a new alert on the collector when the level of the latest CGM reading changed. Returns true if it did.
+  bool evaluate(struct data_struct* data);
+};
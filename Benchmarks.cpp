@@ -0,0 +1,249 @@
+#include "Benchmarks.h"
+
+#if defined(ENABLE_BENCHMARKS)
+#include <ArduinoJson.h>
+#include "recordedPayloads.h"
+#include "data.h"
+#include "semver.h"
+#if defined(ENABLE_SYNC)
+#include <LoRaCrypto.h>
+#include <LoRaCryptoCreds.h>
+#endif
+#if defined(ENABLE_DISPLAY)
+#include "Display.h"
+#endif
+
+#define BENCHMARK_ITERATIONS 1000
+#define BENCHMARK_DISPLAY_ITERATIONS 20
+
+extern struct semver_struct version;
+#if defined(ENABLE_DISPLAY)
+extern Display* display;
+#endif
+
+static volatile uint32_t benchmarkSink;
+
+static void report(Print* out, const char* name, uint32_t iterations, uint64_t elapsedNanos) {
+  out->printf("{\"benchmark\":\"%s\",\"iterations\":%u,\"ns_per_op\":%llu,\"version\":\"%d.%d.%d\",\"build\":\"%s %s\"}\n",
+              name,
+              iterations,
+              (unsigned long long) (iterations > 0 ? elapsedNanos / iterations : 0),
+              version.major,
+              version.minor,
+              version.patch,
+              __DATE__,
+              __TIME__);
+}
+
+static uint64_t cyclesToNanos(uint64_t cycles) {
+  return (cycles * 1000) / ESP.getCpuFreqMHz();
+}
+
+template <typename Fn>
+static void runBenchmark(Print* out, const char* name, uint32_t iterations, Fn fn) {
+  fn();  // Warm the caches
+
+  int64_t startMicros = esp_timer_get_time();
+  for (uint32_t i = 0; i < iterations; i++) {
+    fn();
+  }
+  report(out, name, iterations, (uint64_t) (esp_timer_get_time() - startMicros) * 1000);
+}
+
+#if defined(ENABLE_SYNC)
+static void benchmarkLoRaCrypto(Print* out) {
+  LoRaCrypto crypto(&encryptionCredentials);
+  byte message[sizeof(uint16_t) + sizeof(time_t)] = { 112, 0 };
+  byte encryptedMessage[255];
+  uint encryptedMessageLength;
+  byte decryptedMessage[255];
+  MessageMetadata messageMetadata;
+  uint64_t encryptCycles = 0;
+  uint64_t decryptCycles = 0;
+
+  // Each message is decrypted right after it is encrypted so that the counters stay in order
+  for (uint32_t i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    uint32_t startCycles = ESP.getCycleCount();
+    crypto.encrypt(encryptedMessage, &encryptedMessageLength, 0xFFFF, 29, message, sizeof(message));
+    uint32_t encryptedCycles = ESP.getCycleCount();
+    benchmarkSink = crypto.decrypt(decryptedMessage, encryptedMessage, encryptedMessageLength, &messageMetadata);
+    uint32_t decryptedCycles = ESP.getCycleCount();
+
+    encryptCycles += encryptedCycles - startCycles;
+    decryptCycles += decryptedCycles - encryptedCycles;
+  }
+
+  report(out, "lora_crypto_encrypt", BENCHMARK_ITERATIONS, cyclesToNanos(encryptCycles));
+  report(out, "lora_crypto_decrypt", BENCHMARK_ITERATIONS, cyclesToNanos(decryptCycles));
+}
+#endif
+
+static void benchmarkJson(Print* out) {
+  runBenchmark(out, "json_llu_connections", BENCHMARK_ITERATIONS, []() {
+    JsonDocument doc;
+    deserializeJson(doc, RECORDED_LLU_CONNECTIONS);
+    benchmarkSink = (uint32_t) doc["data"][0]["glucoseMeasurement"]["ValueInMgPerDl"];
+  });
+
+  runBenchmark(out, "json_otodata", BENCHMARK_ITERATIONS, []() {
+    JsonDocument doc;
+    deserializeJson(doc, RECORDED_OTODATA_DEVICES);
+    benchmarkSink = (uint32_t) doc[0]["Level"];
+  });
+
+  runBenchmark(out, "json_open_weather_map", BENCHMARK_ITERATIONS, []() {
+    JsonDocument doc;
+    deserializeJson(doc, RECORDED_OPEN_WEATHER_MAP);
+    benchmarkSink = (uint32_t) doc["main"]["humidity"];
+  });
+}
+
+static void benchmarkTimezoneInfo(Print* out) {
+  // Fed the recorded payload in one write, as writeToStream() hands over each buffer it reads
+  runBenchmark(out, "timezone_info_parse", BENCHMARK_ITERATIONS, []() {
+    struct timezoneInfo_struct timezoneInfo = { 0, 0, 0, 0 };
+    TimezoneParser parser("America/Los_Angeles", &timezoneInfo);
+    parser.write((const uint8_t*) RECORDED_TIMEZONE_INFO, strlen(RECORDED_TIMEZONE_INFO));
+    parser.finish();
+    benchmarkSink = timezoneInfo.daylightTimezoneOffset;
+  });
+
+  static struct timezoneInfo_struct timezoneInfo = { 0, 0, 0, 0 };
+  TimezoneParser parser("America/Los_Angeles", &timezoneInfo);
+  parser.write((const uint8_t*) RECORDED_TIMEZONE_INFO, strlen(RECORDED_TIMEZONE_INFO));
+  parser.finish();
+  runBenchmark(out, "timezone_table_build", BENCHMARK_ITERATIONS, []() {
+    struct timezoneTable_struct table;
+    Timezone::build(&timezoneInfo, &table);
+    benchmarkSink = table.count;
+  });
+
+  // A minute at a time across the table, as the clock asks
+  static struct timezoneTable_struct table;
+  Timezone::build(&timezoneInfo, &table);
+  runBenchmark(out, "timezone_offset", BENCHMARK_ITERATIONS, []() {
+    static time_t utc = timezoneInfo.dstBegin;
+    static int hint = -1;
+    benchmarkSink = Timezone::offset(&table, utc, &hint);
+    utc += 60;
+  });
+}
+
+// Scrubs, encodes and decodes one value of every channel
+static void benchmarkChannels(Print* out) {
+  runBenchmark(out, "channel_codec_all", BENCHMARK_ITERATIONS, []() {
+    byte encoded[CHANNEL_MAX_ENCODED_SIZE];
+    uint32_t i = benchmarkSink;
+    uint32_t sum = 0;
+    for (uint channel = 0; channel < CHANNEL_COUNT; channel++) {
+      float value = Channels::scrub((channel_enum) channel, (float) (i % 512) - 100.0);
+      Channels::encode((channel_enum) channel, value, encoded);
+      value = Channels::decode((channel_enum) channel, encoded);
+      sum += (isnan(value) ? 0 : (uint32_t) value);
+    }
+    benchmarkSink = sum;
+  });
+}
+
+#if defined(ENABLE_DISPLAY) && defined(DISPLAY_TYPE_TFT)
+static void benchmarkDisplay(Print* out) {
+  // Render into an off-screen sprite so that only the drawing code is measured.
+  // Every TFT_eSPI drives the panel's pins and bus, so the display task is kept off them meanwhile.
+  display->lock();
+  TFT_eSPI parent;
+  TFT_eSprite sprite(&parent);
+  sprite.setColorDepth(16);
+  if (!sprite.createSprite(max(TFT_WIDTH, TFT_HEIGHT), min(TFT_WIDTH, TFT_HEIGHT))) {
+    sprite.setColorDepth(8);
+    if (!sprite.createSprite(max(TFT_WIDTH, TFT_HEIGHT), min(TFT_WIDTH, TFT_HEIGHT))) {
+      out->println("{\"benchmark\":\"display\",\"skipped\":\"sprite could not be allocated\"}");
+      display->unlock();
+      return;
+    }
+  }
+
+  struct data_struct benchmarkData;
+  benchmarkData.update(CHANNEL_MG_PER_DL, 112);
+  benchmarkData.update(CHANNEL_PROPANE_LEVEL, 64);
+  benchmarkData.update(CHANNEL_INDOOR_TEMPERATURE, 70.0);
+  benchmarkData.update(CHANNEL_INDOOR_HUMIDITY, 40);
+  benchmarkData.update(CHANNEL_OUTDOOR_TEMPERATURE, 52.5);
+  benchmarkData.update(CHANNEL_OUTDOOR_HUMIDITY, 86);
+
+  Display offscreen(&benchmarkData, &sprite);
+
+  runBenchmark(out, "display_full_redraw", BENCHMARK_DISPLAY_ITERATIONS, [&]() {
+    offscreen.resetDisplay();
+    do {
+      offscreen.loop();  // The frame budget spreads a full redraw over several
+    } while (offscreen.nextDeadline() != ULONG_MAX);
+  });
+
+  runBenchmark(out, "display_cgm_update", BENCHMARK_DISPLAY_ITERATIONS, [&]() {
+    benchmarkData.update(CHANNEL_MG_PER_DL, (benchmarkData.value(CHANNEL_MG_PER_DL) == 112 ? 113 : 112));
+    offscreen.loop();
+  });
+
+  runBenchmark(out, "display_clock_update", BENCHMARK_DISPLAY_ITERATIONS, [&]() {
+    benchmarkData.changes.publish(DATA_BIT(DATA_CLOCK));
+    offscreen.loop();
+  });
+
+  runBenchmark(out, "display_idle_loop", BENCHMARK_ITERATIONS, [&]() {
+    offscreen.loop();
+  });
+
+  sprite.deleteSprite();
+  display->unlock();
+}
+
+// Time the caller is held pushing a CGM-sized widget to the panel, blocking and
+// through the DMA pipeline. Waiting for the pipeline to drain is not counted,
+// since the display task sleeps through it. The display task is kept off the
+// panel meanwhile and redraws it afterwards.
+static void benchmarkDisplayBlocking(Print* out) {
+  display->lock();
+  TFT_eSPI* panel = display->panel();
+  int32_t w = LAYOUT.cgm.w;
+  int32_t h = LAYOUT.cgm.h;
+
+  for (uint dma = 0; dma < 2; dma++) {
+    Renderer renderer(panel);
+    if (renderer.setDma(dma) != dma) {
+      out->println("{\"benchmark\":\"display_blocking_dma\",\"skipped\":\"no DMA for this panel\"}");
+      continue;
+    }
+
+    uint64_t blockedMicros = 0;
+    for (uint i = 0; i < BENCHMARK_DISPLAY_ITERATIONS; i++) {
+      int64_t startMicros = esp_timer_get_time();
+      TFT_eSPI* target = renderer.begin(0, 0, w, h);
+      target->setTextColor((i & 1 ? TFT_GREEN : TFT_YELLOW), TFT_BLACK);
+      target->drawString("123", 0, 0, 7);
+      renderer.end();
+      blockedMicros += esp_timer_get_time() - startMicros;
+      renderer.flush();
+    }
+    report(out, (dma ? "display_blocking_dma" : "display_blocking_sync"), BENCHMARK_DISPLAY_ITERATIONS, blockedMicros * 1000);
+  }
+
+  display->resetDisplay();
+  display->unlock();
+}
+#endif
+
+namespace Benchmarks {
+  void run(Print* out) {
+#if defined(ENABLE_SYNC)
+    benchmarkLoRaCrypto(out);
+#endif
+    benchmarkJson(out);
+    benchmarkTimezoneInfo(out);
+    benchmarkChannels(out);
+#if defined(ENABLE_DISPLAY) && defined(DISPLAY_TYPE_TFT)
+    benchmarkDisplay(out);
+    benchmarkDisplayBlocking(out);
+#endif
+  }
+}
+#endif
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <Arduino.h>
+#include "lora-cgm-sender.ino.globals.h"
+
+#if defined(ENABLE_BENCHMARKS)
+namespace Benchmarks {
+  // Runs every benchmark and prints one JSON object per line
+  void run(Print* out);
+};
+#endif
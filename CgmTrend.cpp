@@ -0,0 +1,112 @@
+#include "CgmTrend.h"
+
+#define TREND_REBASE_AFTER 86400  // Keeps the squared times far from overflowing
+
+CgmTrend::CgmTrend() {
+  _first = 0;
+  _count = 0;
+  _base = 0;
+  _sumTime = 0;
+  _sumValue = 0;
+  _sumTimeTime = 0;
+  _sumTimeValue = 0;
+}
+
+void CgmTrend::_remove() {
+  struct trendPoint_struct* point = &_points[_first];
+  _sumTime -= point->time;
+  _sumValue -= point->mgPerDl;
+  _sumTimeTime -= (int64_t) point->time * point->time;
+  _sumTimeValue -= (int64_t) point->time * point->mgPerDl;
+  _first = (_first + 1) % TREND_WINDOW_POINTS;
+  _count--;
+}
+
+// Bounded by TREND_WINDOW_POINTS, and only once a day
+void CgmTrend::_rebase(time_t base) {
+  int32_t shift = base - _base;
+  _base = base;
+  _sumTime = 0;
+  _sumValue = 0;
+  _sumTimeTime = 0;
+  _sumTimeValue = 0;
+  for (uint i = 0; i < _count; i++) {
+    struct trendPoint_struct* point = &_points[(_first + i) % TREND_WINDOW_POINTS];
+    point->time -= shift;
+    _sumTime += point->time;
+    _sumValue += point->mgPerDl;
+    _sumTimeTime += (int64_t) point->time * point->time;
+    _sumTimeValue += (int64_t) point->time * point->mgPerDl;
+  }
+}
+
+bool CgmTrend::add(time_t time, float mgPerDl) {
+  if (isnan(mgPerDl)) {
+    return false;
+  }
+
+  if (_count == 0) {
+    _rebase(time);
+  } else {
+    time_t last = _base + _points[(_first + _count - 1) % TREND_WINDOW_POINTS].time;
+    if (time <= last) {
+      return false;  // The API returned the same reading again
+    }
+    if ((time - _base) > TREND_REBASE_AFTER) {
+      _rebase(time - TREND_WINDOW);
+    }
+  }
+
+  int32_t offset = time - _base;
+  while ((_count > 0) &&
+         ((_count == TREND_WINDOW_POINTS) ||
+          ((offset - _points[_first].time) > TREND_WINDOW))) {
+    _remove();
+  }
+
+  struct trendPoint_struct* point = &_points[(_first + _count) % TREND_WINDOW_POINTS];
+  point->time = offset;
+  point->mgPerDl = lroundf(mgPerDl);
+  _count++;
+  _sumTime += point->time;
+  _sumValue += point->mgPerDl;
+  _sumTimeTime += (int64_t) point->time * point->time;
+  _sumTimeValue += (int64_t) point->time * point->mgPerDl;
+
+  return true;
+}
+
+float CgmTrend::rate() {
+  if ((_count < TREND_MIN_POINTS) ||
+      ((_points[(_first + _count - 1) % TREND_WINDOW_POINTS].time - _points[_first].time) < TREND_MIN_SPAN)) {
+    return NAN;
+  }
+
+  int64_t denominator = (_count * _sumTimeTime) - (_sumTime * _sumTime);
+  if (denominator == 0) {
+    return NAN;
+  }
+
+  // Slope in mg/dL per second
+  return (float) ((_count * _sumTimeValue) - (_sumTime * _sumValue)) / (float) denominator * 60.0;
+}
+
+trendArrow_enum CgmTrend::arrow(float rate) {
+  if (isnan(rate)) {
+    return TREND_ARROW_UNKNOWN;
+  } else if (rate < -3) {
+    return TREND_ARROW_DOUBLE_DOWN;
+  } else if (rate < -2) {
+    return TREND_ARROW_DOWN;
+  } else if (rate < -1) {
+    return TREND_ARROW_DOWN_SLIGHTLY;
+  } else if (rate <= 1) {
+    return TREND_ARROW_FLAT;
+  } else if (rate <= 2) {
+    return TREND_ARROW_UP_SLIGHTLY;
+  } else if (rate <= 3) {
+    return TREND_ARROW_UP;
+  }
+
+  return TREND_ARROW_DOUBLE_UP;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <Arduino.h>
+#include "lora-cgm-sender.ino.globals.h"
+
+// Rate of change from a least-squares line through the readings of the last
+// TREND_WINDOW seconds. The sums are kept as exact integers and updated as
+// readings enter and leave the window, so a new reading costs the same however
+// long the sensor has been running.
+#define TREND_WINDOW 900
+#define TREND_WINDOW_POINTS 16  // Readings come once a minute
+#define TREND_MIN_POINTS 3
+#define TREND_MIN_SPAN 240  // Seconds between the oldest and newest reading before there is a trend
+#define TREND_PROJECTION_LIMIT 60  // Minutes, further projections are not shown
+
+enum trendArrow_enum : uint8_t {
+  TREND_ARROW_UNKNOWN,
+  TREND_ARROW_DOUBLE_DOWN,  // Below -3 mg/dL per minute
+  TREND_ARROW_DOWN,  // -3 to -2
+  TREND_ARROW_DOWN_SLIGHTLY,  // -2 to -1
+  TREND_ARROW_FLAT,
+  TREND_ARROW_UP_SLIGHTLY,
+  TREND_ARROW_UP,
+  TREND_ARROW_DOUBLE_UP
+};
+
+class CgmTrend {
+  private:
+    struct trendPoint_struct {
+      int32_t time;  // Seconds since _base
+      int32_t mgPerDl;
+    };
+
+    struct trendPoint_struct _points[TREND_WINDOW_POINTS];
+    uint _first;
+    uint _count;
+    time_t _base;
+    int64_t _sumTime;
+    int64_t _sumValue;
+    int64_t _sumTimeTime;
+    int64_t _sumTimeValue;
+
+    void _remove();
+    void _rebase(time_t base);
+
+    // Minutes until distance (signed, threshold minus reading) is covered at rate.
+    // A reading right at the threshold has reached it, whichever way it moves.
+    static constexpr float _minutesToCover(float distance, float rate) {
+      return (isnan(distance) || isnan(rate)) ? NAN :
+             (distance == 0) ? 0 :
+             ((rate == 0) || ((distance < 0) != (rate < 0))) ? NAN :  // Moving away
+             ((distance / rate) <= TREND_PROJECTION_LIMIT) ? (distance / rate) : NAN;
+    }
+
+  public:
+    CgmTrend();
+
+    // Adds a reading taken at time (UTC seconds). Readings that are not newer than the last one are ignored.
+    bool add(time_t time, float mgPerDl);
+    // mg/dL per minute, NAN until the window holds enough readings
+    float rate();
+
+    static trendArrow_enum arrow(float rate);
+    // Minutes until mgPerDl falls below or rises above threshold at rate, 0 if it already
+    // has, NAN if it is unknown, moving away or further out than TREND_PROJECTION_LIMIT
+    static constexpr float minutesBelow(float threshold, float mgPerDl, float rate) {
+      return (mgPerDl < threshold) ? 0 : _minutesToCover(threshold - mgPerDl, rate);
+    }
+    static constexpr float minutesAbove(float threshold, float mgPerDl, float rate) {
+      return (mgPerDl > threshold) ? 0 : _minutesToCover(threshold - mgPerDl, rate);
+    }
+};
@@ -0,0 +1,111 @@
+#include "Channels.h"
+
+#define CHANNEL_INFO(id, wireId, name, encoding, minimum, maximum, deadband, heartbeat, maxAge, display) \
+  { wireId, name, encoding, minimum, maximum, deadband, heartbeat, maxAge, display },
+const struct channelInfo_struct channelInfo[CHANNEL_COUNT] = { CHANNELS(CHANNEL_INFO) };
+#undef CHANNEL_INFO
+
+#define CHANNEL_UNKNOWN_WIRE_ID 0xFF
+
+// Wire ID to channel, so that decoding a message does not search the table
+struct channelLookup_struct {
+  uint8_t channels[256];
+
+  channelLookup_struct() {
+    memset(channels, CHANNEL_UNKNOWN_WIRE_ID, sizeof(channels));
+    for (uint i = 0; i < CHANNEL_COUNT; i++) {
+      channels[channelInfo[i].wireId] = i;
+    }
+  };
+};
+
+static const struct channelLookup_struct channelLookup;
+
+namespace Channels {
+  float scrub(channel_enum channel, float value) {
+    if (isnan(value) ||
+        (value < channelInfo[channel].minimum) ||
+        (value > channelInfo[channel].maximum)) {
+      return NAN;
+    }
+
+    return value;
+  }
+
+  uint encodedSize(channel_enum channel) {
+    switch (channelInfo[channel].encoding) {
+      case CHANNEL_ENCODING_UINT8:
+        return 1;
+
+      default:
+        return 2;
+    }
+  }
+
+  uint encode(channel_enum channel, float value, byte* buffer) {
+    switch (channelInfo[channel].encoding) {
+      case CHANNEL_ENCODING_UINT8:
+        buffer[0] = (isnan(value) ? 0xFF : (uint8_t) lroundf(value));
+        return 1;
+
+      case CHANNEL_ENCODING_UINT16:
+        {
+          uint16_t encoded = (isnan(value) ? 0xFFFF : (uint16_t) lroundf(value));
+          memcpy(buffer, &encoded, sizeof(encoded));
+        }
+        return 2;
+
+      case CHANNEL_ENCODING_TENTHS:
+        {
+          int16_t encoded = (isnan(value) ? INT16_MIN : (int16_t) lroundf(value * 10));
+          memcpy(buffer, &encoded, sizeof(encoded));
+        }
+        return 2;
+    }
+
+    return 0;
+  }
+
+  float decode(channel_enum channel, const byte* buffer) {
+    float value = NAN;
+
+    switch (channelInfo[channel].encoding) {
+      case CHANNEL_ENCODING_UINT8:
+        if (buffer[0] != 0xFF) {
+          value = buffer[0];
+        }
+        break;
+
+      case CHANNEL_ENCODING_UINT16:
+        {
+          uint16_t encoded;
+          memcpy(&encoded, buffer, sizeof(encoded));
+          if (encoded != 0xFFFF) {
+            value = encoded;
+          }
+        }
+        break;
+
+      case CHANNEL_ENCODING_TENTHS:
+        {
+          int16_t encoded;
+          memcpy(&encoded, buffer, sizeof(encoded));
+          if (encoded != INT16_MIN) {
+            value = encoded / 10.0;
+          }
+        }
+        break;
+    }
+
+    return scrub(channel, value);
+  }
+
+  bool find(uint8_t wireId, channel_enum* channel) {
+    if (channelLookup.channels[wireId] == CHANNEL_UNKNOWN_WIRE_ID) {
+      return false;
+    }
+
+    *channel = (channel_enum) channelLookup.channels[wireId];
+    return true;
+  }
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Every value the nodes share is a channel. A channel declares how it goes
+// over the air, which values are valid, how often it is repeated while it does
+// not change and where it is drawn. Adding a tank, room or CGM is one line in
+// this table: storage, change tracking, the LoRa sender and receiver and the
+// display all iterate over it.
+//
+// On the node every value is a float, NAN when unknown. Values outside
+// [minimum, maximum] are stored as unknown. A heartbeat of 0 keeps the channel
+// local, and wire IDs must never be reused once nodes are deployed.
+//
+// A value older than maxAge seconds (counted from when its source sampled it,
+// not from when it arrived here) is stale: it is drawn dimmed and no longer
+// sent to the other nodes.
+//
+// X(id, wireId, name, encoding, minimum, maximum, deadband, heartbeat, maxAge, display)
+#define CHANNELS(X) \
+  X(CHANNEL_MG_PER_DL, 1, "mg_per_dl", CHANNEL_ENCODING_UINT16, 0, 400, 0, 600000, 900, DISPLAY_BINDING_CGM) \
+  X(CHANNEL_PROPANE_LEVEL, 2, "propane_level", CHANNEL_ENCODING_UINT8, 0, 100, 0, 3600000, 43200, DISPLAY_BINDING_PROPANE) \
+  X(CHANNEL_INDOOR_TEMPERATURE, 3, "indoor_temperature", CHANNEL_ENCODING_TENTHS, -99.9, 199, 0.5, 300000, 3600, DISPLAY_BINDING_NONE) \
+  X(CHANNEL_INDOOR_HUMIDITY, 4, "indoor_humidity", CHANNEL_ENCODING_UINT8, 0, 100, 2, 300000, 3600, DISPLAY_BINDING_NONE) \
+  X(CHANNEL_OUTDOOR_TEMPERATURE, 5, "outdoor_temperature", CHANNEL_ENCODING_TENTHS, -99.9, 199, 0.5, 300000, 3600, DISPLAY_BINDING_TEMPERATURE) \
+  X(CHANNEL_OUTDOOR_HUMIDITY, 6, "outdoor_humidity", CHANNEL_ENCODING_UINT8, 0, 100, 2, 300000, 3600, DISPLAY_BINDING_NONE) \
+  X(CHANNEL_CGM_RATE, 7, "cgm_rate", CHANNEL_ENCODING_TENTHS, -20, 20, 0.2, 600000, 900, DISPLAY_BINDING_CGM_TREND)
+
+// The all-ones value of each encoding means unknown
+enum channelEncoding_enum : uint8_t {
+  CHANNEL_ENCODING_UINT8,  // 1 byte, whole numbers
+  CHANNEL_ENCODING_UINT16,  // 2 bytes, whole numbers
+  CHANNEL_ENCODING_TENTHS  // 2 bytes, signed tenths (INT16_MIN is unknown)
+};
+
+// Display widgets a channel can be drawn in. Each binding is used by at most one channel.
+enum displayBinding_enum : uint8_t {
+  DISPLAY_BINDING_NONE,
+  DISPLAY_BINDING_CGM,
+  DISPLAY_BINDING_PROPANE,
+  DISPLAY_BINDING_TEMPERATURE,
+  DISPLAY_BINDING_CGM_TREND
+};
+
+#define CHANNEL_ENUM(id, wireId, name, encoding, minimum, maximum, deadband, heartbeat, maxAge, display) id,
+enum channel_enum : uint8_t { CHANNELS(CHANNEL_ENUM) CHANNEL_COUNT };
+#undef CHANNEL_ENUM
+
+#define CHANNEL_BIT(channel) ((uint32_t) 1 << (channel))
+
+#define CHANNEL_ALL_BIT(id, wireId, name, encoding, minimum, maximum, deadband, heartbeat, maxAge, display) | CHANNEL_BIT(id)
+#define CHANNEL_DISPLAYED_BIT(id, wireId, name, encoding, minimum, maximum, deadband, heartbeat, maxAge, display) \
+  | ((display) != DISPLAY_BINDING_NONE ? CHANNEL_BIT(id) : 0)
+#define CHANNEL_TRANSMITTED_BIT(id, wireId, name, encoding, minimum, maximum, deadband, heartbeat, maxAge, display) \
+  | ((heartbeat) != 0 ? CHANNEL_BIT(id) : 0)
+#define CHANNELS_ALL ((uint32_t) (0 CHANNELS(CHANNEL_ALL_BIT)))
+#define CHANNELS_DISPLAYED ((uint32_t) (0 CHANNELS(CHANNEL_DISPLAYED_BIT)))
+#define CHANNELS_TRANSMITTED ((uint32_t) (0 CHANNELS(CHANNEL_TRANSMITTED_BIT)))
+
+#define CHANNEL_MAX_ENCODED_SIZE 2
+#define CHANNEL_AGE_SATURATED 0xFFFF  // Ages go over the air as 16-bit seconds
+
+#define CHANNEL_MAX_AGE_CHECK(id, wireId, name, encoding, minimum, maximum, deadband, heartbeat, maxAge, display) \
+  static_assert((maxAge) < CHANNEL_AGE_SATURATED, "The max age of " name " does not fit the wire format");
+CHANNELS(CHANNEL_MAX_AGE_CHECK)
+#undef CHANNEL_MAX_AGE_CHECK
+
+struct channelInfo_struct {
+  uint8_t wireId;
+  const char* name;
+  channelEncoding_enum encoding;
+  float minimum;
+  float maximum;
+  float deadband;  // A new value is only published once it moved at least this far
+  uint32_t heartbeat;  // Milliseconds between transmissions of an unchanged value, 0 if never sent
+  uint32_t maxAge;  // Seconds after which the value is stale
+  displayBinding_enum display;
+};
+
+extern const struct channelInfo_struct channelInfo[CHANNEL_COUNT];
+
+namespace Channels {
+  // NAN if the value is unknown or outside the channel's range
+  float scrub(channel_enum channel, float value);
+
+  uint encodedSize(channel_enum channel);
+  // Returns the number of bytes written
+  uint encode(channel_enum channel, float value, byte* buffer);
+  float decode(channel_enum channel, const byte* buffer);
+
+  // Returns false if no channel has the wire ID
+  bool find(uint8_t wireId, channel_enum* channel);
+};
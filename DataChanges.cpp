@@ -0,0 +1,60 @@
+#include "DataChanges.h"
+#include "Events.h"
+
+#define DATA_SUBSCRIBER_FIELDS(id, fields) (uint32_t) (fields),
+static const uint32_t subscriberFields[] = { DATA_SUBSCRIBERS(DATA_SUBSCRIBER_FIELDS) };
+#undef DATA_SUBSCRIBER_FIELDS
+
+DataChanges::DataChanges() {
+  for (uint i = 0; i < DATA_SUBSCRIBER_COUNT; i++) {
+    _dirty[i].store(0);
+  }
+  for (uint i = 0; i < CHANNEL_COUNT; i++) {
+    _published[i] = NAN;
+  }
+}
+
+void DataChanges::publish(uint32_t fields) {
+  for (uint i = 0; i < DATA_SUBSCRIBER_COUNT; i++) {
+    if (subscriberFields[i] & fields) {
+      _dirty[i].fetch_or(subscriberFields[i] & fields);
+    }
+  }
+
+  Events::notify(EVENT_DATA_CHANGED);
+}
+
+bool DataChanges::publish(channel_enum channel, float value) {
+  portENTER_CRITICAL(&_publishedMux);
+  float published = _published[channel];
+  bool changed = ((isnan(value) != isnan(published)) ||
+                  (!isnan(value) &&
+                   (value != published) &&
+                   (fabsf(value - published) >= channelInfo[channel].deadband)));
+  if (changed) {
+    _published[channel] = value;
+  }
+  portEXIT_CRITICAL(&_publishedMux);
+
+  if (changed) {
+    publish(DATA_CHANNEL_BITS(CHANNEL_BIT(channel)));
+  }
+
+  return changed;
+}
+
+uint32_t DataChanges::consume(dataSubscriber_enum subscriber) {
+  return _dirty[subscriber].exchange(0);
+}
+
+uint32_t DataChanges::pending(dataSubscriber_enum subscriber) {
+  return _dirty[subscriber].load();
+}
+
+float DataChanges::published(channel_enum channel) {
+  portENTER_CRITICAL(&_publishedMux);
+  float value = _published[channel];
+  portEXIT_CRITICAL(&_publishedMux);
+
+  return value;
+}
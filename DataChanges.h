@@ -0,0 +1,60 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include "Channels.h"
+
+// Change notification for the shared data. Writers publish the fields they
+// changed, and every subscriber has its own dirty mask that it consumes in one
+// atomic exchange, so nothing has to be compared on every pass and no update
+// is missed between two passes.
+//
+// Every channel has a bit after the fixed fields below. Channel values go
+// through the channel's deadband: a new value is only published when it moves
+// at least that far from the last published one, so sensor noise does not
+// trigger redraws or retransmissions.
+#define DATA_FIELDS(X) \
+  X(DATA_CLOCK) /* Local time or timezone changed */ \
+  X(DATA_NETWORK_TIME) /* Time should be broadcast to the other nodes */ \
+  X(DATA_ALERT) /* A new alert was raised or received */
+
+#define DATA_FIELD_ENUM(id) id,
+enum dataField_enum : uint8_t { DATA_FIELDS(DATA_FIELD_ENUM) DATA_FIRST_CHANNEL };
+#undef DATA_FIELD_ENUM
+
+static_assert(DATA_FIRST_CHANNEL + CHANNEL_COUNT <= 32, "The dirty masks have one bit per field and channel");
+
+#define DATA_BIT(field) ((uint32_t) 1 << (field))
+#define DATA_CHANNEL_BITS(channels) ((uint32_t) (channels) << DATA_FIRST_CHANNEL)
+#define DATA_CHANNELS(fields) (((uint32_t) (fields) >> DATA_FIRST_CHANNEL) & CHANNELS_ALL)
+
+#define DATA_SUBSCRIBERS(X) \
+  X(DATA_SUBSCRIBER_DISPLAY, DATA_BIT(DATA_CLOCK) | DATA_BIT(DATA_ALERT) | DATA_CHANNEL_BITS(CHANNELS_DISPLAYED)) \
+  X(DATA_SUBSCRIBER_LORA, DATA_BIT(DATA_NETWORK_TIME) | DATA_BIT(DATA_ALERT) | DATA_CHANNEL_BITS(CHANNELS_TRANSMITTED)) \
+  X(DATA_SUBSCRIBER_LOG, DATA_BIT(DATA_ALERT) | DATA_CHANNEL_BITS(CHANNELS_ALL))
+
+#define DATA_SUBSCRIBER_ENUM(id, fields) id,
+enum dataSubscriber_enum : uint8_t { DATA_SUBSCRIBERS(DATA_SUBSCRIBER_ENUM) DATA_SUBSCRIBER_COUNT };
+#undef DATA_SUBSCRIBER_ENUM
+
+class DataChanges {
+  private:
+    std::atomic<uint32_t> _dirty[DATA_SUBSCRIBER_COUNT];
+    float _published[CHANNEL_COUNT];
+    portMUX_TYPE _publishedMux = portMUX_INITIALIZER_UNLOCKED;
+
+  public:
+    DataChanges();
+
+    // Marks the fields dirty for every subscriber interested in them and wakes the waiting tasks
+    void publish(uint32_t fields);
+    // Applies the channel's deadband first. Returns true if the value was published.
+    bool publish(channel_enum channel, float value);
+
+    // Returns the fields that changed since the last call and clears them
+    uint32_t consume(dataSubscriber_enum subscriber);
+    uint32_t pending(dataSubscriber_enum subscriber);
+
+    // The last value that passed the deadband, NAN if there was none or it is unknown
+    float published(channel_enum channel);
+};
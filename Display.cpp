@@ -4,67 +4,173 @@
 #include <SPI.h>
 #include "credentials.h"
 #include "Display.h"
+#include "Log.h"
+#include "Metrics.h"
+#include "Profiler.h"
+#include "LatencyTrace.h"
+#include "Events.h"
+#include <sys/time.h>
 #include "propane-tank.h"
 #include "thermometer.h"
+#include "CgmTrend.h"
+#include "TimeSeries.h"
 
 #if defined(DISPLAY_TYPE_LCD_042)
 #define SDA_PIN 5
 #define SCL_PIN 6
+#define LCD_CGM_FONT u8g2_font_logisoso22_tn
+#define LCD_CLOCK_FONT u8g2_font_6x12_tn
 
 #elif defined(DISPLAY_TYPE_TFT)
-#define FONT_NUMBER 7
 #define FONT_NUMBER_2 2
-#if defined(DISPLAY_TYPE_ST7735_128_160)
-#define FONT_SIZE 1
-#define FONT_SIZE_CLOCK 1
-#elif defined(DISPLAY_TYPE_ILI9488_480_320)
-#define FONT_SIZE 3
-#define FONT_SIZE_CLOCK 3
+#if defined(DISPLAY_TYPE_ILI9488_480_320)
+#define GRAPH_HEIGHT LAYOUT.graph.h
+#define GRAPH_HOURS 6  // 3 to 12
+#define GRAPH_COLUMN_SECONDS (GRAPH_HOURS * 3600 / GRAPH_WIDTH)
+#define GRAPH_GAP 6  // Blank columns ahead of the newest reading
+#define GRAPH_MIN_MG 40
+#define GRAPH_MAX_MG 300
+#define GRAPH_NO_POINT 0xFF
+#define GRAPH_EMPTY INT32_MIN
+#define GRAPH_HIGH_BAND 0x3180  // Dark yellow
+#define GRAPH_TARGET_BAND 0x0180  // Dark green
+#define GRAPH_LOW_BAND 0x3000  // Dark red
+#define DISPLAY_BYTES_PER_PIXEL 3  // The ILI9488 takes 18-bit colour over SPI
+#define DISPLAY_WINDOW_BYTES 11  // CASET, RASET and RAMWR with their parameters, before every fill
 #endif
-#define FONT_SIZE_PROPANE 1
 #endif
 
+#define DISPLAY_UNSYNCED_INTERVAL 1000  // Clock refresh until the time is known
+#define DISPLAY_FRAME_BUDGET 20000  // Microseconds of drawing per loop(), beyond the CGM widgets
+#define DISPLAY_DEFERRED_DELAY 2  // Milliseconds between loops while widgets wait for budget, for the radio task
+#define DISPLAY_STALE_COLOR TFT_DARKGREY
+#define DISPLAY_CGM_CHANNELS (CHANNEL_BIT(CHANNEL_MG_PER_DL) | CHANNEL_BIT(CHANNEL_CGM_RATE))
+
+#if defined(DISPLAY_TYPE_TFT)
+#define BORDER_WIDTH 6
+
+// Four plain rectangles, each filled from a single window
 void drawBorder(TFT_eSPI* tft, int32_t x, int32_t y, int32_t w, int32_t h, int32_t color) {
-  float wd = 6.0;
-  float radius = wd / 2.0;
-
-  tft->drawWideLine(x + radius, y + radius, w - radius, y + radius, wd, color);
-  tft->drawWideLine(x + radius, y + radius, x + radius, h - radius, wd, color);
-  tft->drawWideLine(w - radius, y + radius, w - radius, h - radius, wd, color);
-  tft->drawWideLine(x + radius, h - radius, w - radius, h - radius, wd, color);
-}
-
-void rightJustify(TFT_eSPI* tft,
-                  const char* displayBuffer,
-                  uint8_t font,
-                  uint8_t fontSize,
-                  uint32_t color,
-                  int16_t baseX,
-                  int16_t baseY,
-                  int16_t textWidth) {
-  tft->setTextSize(fontSize);
-  tft->setTextColor(color, TFT_BLACK);
-  tft->setTextDatum(TR_DATUM);
-  tft->setTextPadding(textWidth);
-  tft->drawString(displayBuffer, baseX, baseY, font);
-  tft->setTextDatum(TL_DATUM);
-}
-
-Display::Display(volatile struct data_struct* data) {
+  tft->fillRect(x, y, w - x, BORDER_WIDTH, color);
+  tft->fillRect(x, h - BORDER_WIDTH, w - x, BORDER_WIDTH, color);
+  tft->fillRect(x, y + BORDER_WIDTH, BORDER_WIDTH, h - y - (2 * BORDER_WIDTH), color);
+  tft->fillRect(w - BORDER_WIDTH, y + BORDER_WIDTH, BORDER_WIDTH, h - y - (2 * BORDER_WIDTH), color);
+}
+
+// Arrow in a size by size box, pointing along the trend. The steep trends get two.
+void drawTrendArrow(TFT_eSPI* tft, int32_t x, int32_t y, int32_t size, trendArrow_enum arrow, uint32_t color) {
+  tft->fillRect(x, y, size, size, TFT_BLACK);
+
+  float angle;
+  uint count = 1;
+  switch (arrow) {
+    case TREND_ARROW_DOUBLE_DOWN:
+      count = 2;
+      // Fall through
+    case TREND_ARROW_DOWN:
+      angle = -90;
+      break;
+
+    case TREND_ARROW_DOWN_SLIGHTLY:
+      angle = -45;
+      break;
+
+    case TREND_ARROW_FLAT:
+      angle = 0;
+      break;
+
+    case TREND_ARROW_UP_SLIGHTLY:
+      angle = 45;
+      break;
+
+    case TREND_ARROW_DOUBLE_UP:
+      count = 2;
+      // Fall through
+    case TREND_ARROW_UP:
+      angle = 90;
+      break;
+
+    default:
+      return;
+  }
+
+  float dx = cos(angle * DEG_TO_RAD);
+  float dy = -sin(angle * DEG_TO_RAD);  // Screen y grows downwards
+  float radius = size * 0.45;
+  float head = size * 0.3;
+  float width = max(2.0, size * 0.08);
+  for (uint i = 0; i < count; i++) {
+    // Side by side across the direction of the arrow
+    float offset = (count == 1 ? 0 : (i == 0 ? -1 : 1) * size * 0.2);
+    float centerX = x + (size / 2.0) - (dy * offset);
+    float centerY = y + (size / 2.0) + (dx * offset);
+    float tipX = centerX + (dx * radius);
+    float tipY = centerY + (dy * radius);
+    float baseX = tipX - (dx * head);
+    float baseY = tipY - (dy * head);
+    float halfHead = head / (count == 1 ? 1.6 : 2.4);
+
+    tft->drawWideLine(centerX - (dx * radius), centerY - (dy * radius), baseX, baseY, width, color);
+    tft->fillTriangle(tipX, tipY,
+                      baseX - (dy * halfHead), baseY + (dx * halfHead),
+                      baseX + (dy * halfHead), baseY - (dx * halfHead),
+                      color);
+  }
+}
+#endif
+
+Display::Display(struct data_struct* data) :
+    _clockTimer(EVENT_DISPLAY_TIMER),
+    _staleTimer(EVENT_DISPLAY_TIMER) {
   _data = data;
-  _oldData = (struct data_struct*) malloc(sizeof(struct data_struct));
-  memcpy(_oldData, (const void*) _data, sizeof(struct data_struct));
+  _mutex = xSemaphoreCreateMutex();
+  _displayedMinute = -1;
+  _timezoneHint = -1;
+  _changes = 0;
+  _staleChannels = 0;
+  _deferredChannels = 0;
+  memset(&_alert, 0, sizeof(_alert));
+#if defined(DISPLAY_TYPE_ILI9488_480_320)
+  memset(_graphPoints, GRAPH_NO_POINT, sizeof(_graphPoints));
+  _graphColumn = GRAPH_EMPTY;
+  _graphPending = true;
+  _graphBackfill = true;
+#endif
+  _clockDeferred = false;
+  memset(_widgetMicros, 0, sizeof(_widgetMicros));
   _initializeDisplay = true;
+#if defined(DISPLAY_TYPE_TFT)
+  _tft = NULL;
+  _ownsTft = true;
+  _renderer = NULL;
+  memset(_glyphs, 0, sizeof(_glyphs));
+  memset(&_lastFrame, 0, sizeof(_lastFrame));
+  _resetWidgets();
+#endif
 }
 
-Display::~Display() {
-  free(_oldData);
+#if defined(DISPLAY_TYPE_TFT)
+// Renders into an off-screen sprite instead of the panel. setup() must not be called in this case.
+Display::Display(struct data_struct* data, TFT_eSprite* sprite) : Display(data) {
+  _tft = sprite;
+  _ownsTft = false;
+  _renderer = new Renderer(_tft, true);
+}
+#endif
 
+Display::~Display() {
 #if defined(DISPLAY_TYPE_LCD_042)
-  free(_u8g2);
+  delete _u8g2;
 #elif defined(DISPLAY_TYPE_TFT)
-    free(_tft);
+  delete _renderer;
+  for (uint i = 0; i < DISPLAY_GLYPH_SIZES; i++) {
+    delete _glyphs[i];
+  }
+  if (_ownsTft) {
+    delete _tft;
+  }
 #endif
+  vSemaphoreDelete(_mutex);
 }
 
 void Display::setup() {
@@ -72,11 +178,12 @@ void Display::setup() {
   _u8g2 = new U8G2_SSD1306_72X40_ER_F_HW_I2C(U8G2_R0, /* reset=*/ U8X8_PIN_NONE);   // EastRising 0.42" OLED
 #elif defined(DISPLAY_TYPE_TFT)
   _tft = new TFT_eSPI();  // Invoke custom library
+  _renderer = new Renderer(_tft);
 #endif
 
 #if defined(DISPLAY_TYPE_LCD_042)
   Wire.begin(SDA_PIN, SCL_PIN);
-  u8g2.begin();
+  _u8g2->begin();
 #elif defined(DISPLAY_TYPE_TFT)
   _tft->init();
   // _tft->init(INITR_BLACKTAB);
@@ -89,6 +196,9 @@ void Display::setup() {
   #else
   _tft->setRotation(3);
   #endif
+#if defined(RENDERER_DMA)
+  _renderer->setDma(_tft->initDMA());
+#endif
   _tft->setTextWrap(false, false);
   _tft->fillScreen(TFT_BLACK);
   drawBorder(_tft, 0, 0, _tft->width(), _tft->height(), TFT_GREEN);
@@ -105,154 +215,777 @@ void Display::setup() {
 }
 
 void Display::loop() {
-  _displayClock();
-  _displayCgmData();
+  xSemaphoreTake(_mutex, portMAX_DELAY);
+  unsigned long startMicros = micros();
+#if defined(DISPLAY_TYPE_TFT)
+  _renderer->service();  // The next band, if the display timer fired for one
+#endif
+
+  _changes = _data->changes.consume(DATA_SUBSCRIBER_DISPLAY);
+  bool alerted = (_changes & DATA_BIT(DATA_ALERT));
+  if (alerted) {
+    _alert = _data->alert.read();
+  }
+
+  // Only the channels that changed are visited, however many there are
+  uint32_t channels = (_initializeDisplay ? CHANNELS_DISPLAYED : DATA_CHANNELS(_changes) & CHANNELS_DISPLAYED) | _deferredChannels;
+  _deferredChannels = 0;
+  if (alerted ||
+      (channels & DISPLAY_CGM_CHANNELS)) {
+    channels |= DISPLAY_CGM_CHANNELS;  // The colours and the projection depend on both the reading and the rate
+  }
+  if ((channels != 0) ||
+      _staleTimer.isExpired()) {
+    channels |= _staleChanges();
+  }
+
+  // The reading goes first and always fits the budget, since an alert is not seen until it is drawn
+  for (uint32_t cgmChannels = channels & DISPLAY_CGM_CHANNELS; cgmChannels != 0; cgmChannels &= cgmChannels - 1) {
+    _drawWidget(__builtin_ctz(cgmChannels));
+  }
+  channels &= ~DISPLAY_CGM_CHANNELS;
+  if (alerted &&
+      (_alert.level != ALERT_NONE)) {
+    uint32_t latency = Clock::nowMillis() - _alert.raisedAt;
+    Metrics::record(METRIC_ALERT_RENDER_TIME, latency);
+    if (latency > ALERT_LATENCY_BUDGET) {
+      Metrics::increment(METRIC_ALERT_OVER_BUDGET);
+      LOG_WARN(LOG_ALERT_OVER_BUDGET, _alert.alertId, latency);
+    }
+  }
+
+  // Then the clock, the graph and the other channels, while the frame has
+  // budget left. Whatever does not fit is drawn by the next loop, after the
+  // radio had its turn.
+  if (_clockDue()) {
+    if (_fitsBudget(DISPLAY_WIDGET_CLOCK, startMicros)) {
+      _drawWidget(DISPLAY_WIDGET_CLOCK);
+      _clockDeferred = false;
+    } else {
+      _clockDeferred = true;
+    }
+  }
 #if defined(DISPLAY_TYPE_ILI9488_480_320)
-  _displayPropaneLevel();
-  _displayTemperature();
+  if (_graphPending &&
+      _fitsBudget(DISPLAY_WIDGET_GRAPH, startMicros)) {
+    _drawWidget(DISPLAY_WIDGET_GRAPH);
+    _graphPending = false;
+  }
 #endif
 
+  for (; channels != 0; channels &= channels - 1) {
+    // A new alert preempts the other widgets, which are drawn on the next loop
+    if ((_data->changes.pending(DATA_SUBSCRIBER_DISPLAY) & DATA_BIT(DATA_ALERT)) ||
+        !_fitsBudget(__builtin_ctz(channels), startMicros)) {
+      _deferredChannels = channels;
+      break;
+    }
+    _drawWidget(__builtin_ctz(channels));
+  }
+
   _initializeDisplay = false;
+
+#if defined(DISPLAY_TYPE_TFT)
+  _lastFrame = _renderer->endFrame();
+#endif
+  unsigned long frameMicros = micros() - startMicros;
+  Metrics::record(METRIC_DISPLAY_FRAME_TIME, frameMicros);
+  if (frameMicros > DISPLAY_FRAME_BUDGET) {
+    Metrics::increment(METRIC_DISPLAY_OVER_BUDGET);
+  }
+  xSemaphoreGive(_mutex);
 };
 
 void Display::print(const char* val) {
+#if defined(DISPLAY_TYPE_LCD_042)
+  _u8g2->print(val);
+#elif defined(DISPLAY_TYPE_TFT)
   _tft->print(val);
+#endif
 }
 
 void Display::println(const char* val) {
+#if defined(DISPLAY_TYPE_LCD_042)
+  _u8g2->println(val);
+#elif defined(DISPLAY_TYPE_TFT)
   _tft->println(val);
+#endif
 }
 
 void Display::resetDisplay() {
+#if defined(DISPLAY_TYPE_LCD_042)
+  _u8g2->clearBuffer();
+  _u8g2->sendBuffer();
+#elif defined(DISPLAY_TYPE_TFT)
+  _renderer->flush();
   _tft->fillScreen(TFT_BLACK);
   drawBorder(_tft, 0, 0, _tft->width(), _tft->height(), TFT_GREEN);
+  _resetWidgets();
+#endif
+#if defined(DISPLAY_TYPE_ILI9488_480_320)
+  _graphPending = true;
+  _graphBackfill = true;
+#endif
+  _initializeDisplay = true;
+}
+
+#if defined(DISPLAY_TYPE_LCD_042)
+// Right justified in its box, which is cleared first. The whole buffer of the
+// 72x40 panel is a single short I2C transfer.
+void Display::_drawLcdText(const char* text, const struct layoutBox_struct* box, const uint8_t* font) {
+  _u8g2->setDrawColor(0);
+  _u8g2->drawBox(box->x, box->y, box->w, box->h);
+  _u8g2->setDrawColor(1);
+  _u8g2->setFont(font);
+  _u8g2->setFontPosTop();
+  _u8g2->drawStr(box->x + box->w - _u8g2->getStrWidth(text), box->y, text);
+  _u8g2->sendBuffer();
+}
+
+#elif defined(DISPLAY_TYPE_TFT)
+// Everything is drawn again after the screen was cleared
+void Display::_resetWidgets() {
+  _borderColor = TFT_GREEN;
+  _cgmText.drawn = false;
+  _clockText.drawn = false;
+  _trendDrawn = false;
+#if defined(DISPLAY_TYPE_ILI9488_480_320)
+  _trendText.drawn = false;
+  _propaneText.drawn = false;
+  _temperatureText.drawn = false;
+#endif
+}
+
+// The border only changes with the CGM colour
+void Display::_drawBorder(uint32_t color) {
+  if (color == _borderColor) {
+    return;
+  }
+
+  int32_t w = _tft->width();
+  int32_t h = _tft->height();
+  _renderer->fill(0, 0, w, BORDER_WIDTH, color);
+  _renderer->fill(0, h - BORDER_WIDTH, w, BORDER_WIDTH, color);
+  _renderer->fill(0, BORDER_WIDTH, BORDER_WIDTH, h - (2 * BORDER_WIDTH), color);
+  _renderer->fill(w - BORDER_WIDTH, BORDER_WIDTH, BORDER_WIDTH, h - (2 * BORDER_WIDTH), color);
+  _borderColor = color;
+}
+
+// Right justified in its layout box, which wider text overflows to the left. When the text keeps its
+// width and colour, only the span from the first to the last changed character
+// is composed and pushed, since everything around it stays in place.
+void Display::_drawText(struct textWidget_struct* widget,
+                        const char* text,
+                        const struct layoutBox_struct* box,
+                        uint32_t color) {
+  if (widget->drawn &&
+      (widget->color == color) &&
+      (strcmp(widget->text, text) == 0)) {
+    return;
+  }
+
+  int32_t baseX = box->x + box->w;
+  _tft->setTextSize(box->fontSize);
+  int32_t width = _tft->textWidth(text, box->font);
+  int32_t left = baseX - max((int32_t) box->w, width);
+  int32_t right = baseX;
+  uint length = strlen(text);
+  if (widget->drawn &&
+      (widget->color == color) &&
+      (strlen(widget->text) == length) &&
+      (_tft->textWidth(widget->text, box->font) == width)) {
+    uint first = 0;
+    while (text[first] == widget->text[first]) {
+      first++;
+    }
+    uint last = length;
+    while (text[last - 1] == widget->text[last - 1]) {
+      last--;
+    }
+
+    char prefix[sizeof(widget->text)];
+    strncpy(prefix, text, first);
+    prefix[first] = '\0';
+    left = baseX - width + _tft->textWidth(prefix, box->font);
+    right = baseX - _tft->textWidth(&text[last], box->font);
+  }
+
+  TFT_eSPI* target = _renderer->begin(left, box->y, right - left, box->h);
+  target->setTextSize(box->fontSize);
+  target->setTextColor(color, TFT_BLACK);
+  target->setTextDatum(TR_DATUM);
+  target->setTextPadding(0);
+  target->drawString(text, baseX - left, 0, box->font);
+  target->setTextDatum(TL_DATUM);
+  _renderer->end();
+
+  strncpy(widget->text, text, sizeof(widget->text) - 1);
+  widget->text[sizeof(widget->text) - 1] = '\0';
+  widget->color = color;
+  widget->drawn = true;
+}
+
+GlyphCache* Display::_glyphCache(uint8_t font, uint8_t fontSize) {
+  for (uint i = 0; i < DISPLAY_GLYPH_SIZES; i++) {
+    if (_glyphs[i] == NULL) {
+      _glyphs[i] = new GlyphCache(_tft, font, fontSize);
+    }
+    if ((_glyphs[i]->font() == font) &&
+        (_glyphs[i]->size() == fontSize)) {
+      return _glyphs[i];
+    }
+  }
+  return NULL;
+}
+
+// Like _drawText() for the 7-segment font, but from the glyph cache. When the text
+// keeps its width and colour, every character sits in a fixed cell, so only the
+// cells whose character changed are composed and pushed, each on its own. A
+// minute tick of the clock touches a single digit.
+void Display::_drawNumber(struct textWidget_struct* widget,
+                          const char* text,
+                          const struct layoutBox_struct* box,
+                          uint32_t color) {
+  if (widget->drawn &&
+      (widget->color == color) &&
+      (strcmp(widget->text, text) == 0)) {
+    return;
+  }
+
+  int32_t baseX = box->x + box->w;
+  GlyphCache* glyphs = _glyphCache(box->font, box->fontSize);
+  int32_t width = (glyphs != NULL) ? glyphs->width(text) : -1;
+  if (width < 0) {
+    _drawText(widget, text, box, color);
+    return;
+  }
+
+  int32_t height = glyphs->height();
+  uint length = strlen(text);
+  if (widget->drawn &&
+      (widget->color == color) &&
+      (strlen(widget->text) == length) &&
+      (glyphs->width(widget->text) == width)) {
+    int32_t x = baseX - width;
+    for (uint i = 0; i < length; i++) {
+      int32_t cellWidth = glyphs->width(text[i]);
+      if ((text[i] != widget->text[i]) &&
+          (cellWidth > 0)) {
+        TFT_eSPI* target = _renderer->begin(x, box->y, cellWidth, height);
+        glyphs->draw(target, text[i], 0, 0, color);
+        _renderer->end();
+      }
+      x += cellWidth;
+    }
+  } else {
+    int32_t left = baseX - max((int32_t) box->w, width);
+    TFT_eSPI* target = _renderer->begin(left, box->y, baseX - left, height);
+    int32_t x = baseX - width - left;
+    for (uint i = 0; i < length; i++) {
+      glyphs->draw(target, text[i], x, 0, color);
+      x += glyphs->width(text[i]);
+    }
+    _renderer->end();
+  }
+
+  strncpy(widget->text, text, sizeof(widget->text) - 1);
+  widget->text[sizeof(widget->text) - 1] = '\0';
+  widget->color = color;
+  widget->drawn = true;
+}
+#endif
+
+// Also waits for the bands still on their way to the panel
+void Display::lock() {
+  xSemaphoreTake(_mutex, portMAX_DELAY);
+#if defined(DISPLAY_TYPE_TFT)
+  _renderer->flush();
+#endif
+}
+
+// 0 while loop() has something new to draw, DISPLAY_DEFERRED_DELAY while
+// widgets wait for a frame with budget left, ULONG_MAX otherwise. The clock and
+// staleness timers wake the display task through EVENT_DISPLAY_TIMER.
+unsigned long Display::nextDeadline() {
+  if (_initializeDisplay ||
+      _data->changes.pending(DATA_SUBSCRIBER_DISPLAY)) {
+    return 0;
+  }
+  if ((_deferredChannels != 0) ||
+#if defined(DISPLAY_TYPE_ILI9488_480_320)
+      _graphPending ||
+#endif
+      _clockDeferred) {
+    return DISPLAY_DEFERRED_DELAY;
+  }
+
+  return ULONG_MAX;
+}
+
+// Whether a widget still fits the frame budget, going by how long it took the
+// last time it drew anything. The first widget to draw in a frame always fits,
+// so that a widget slower than the whole budget is still drawn.
+bool Display::_fitsBudget(uint widget, unsigned long startMicros) {
+#if defined(DISPLAY_TYPE_TFT)
+  if ((_renderer->framePixels() == 0) ||
+      ((micros() - startMicros) + _widgetMicros[widget] <= DISPLAY_FRAME_BUDGET)) {
+    return true;
+  }
+
+  Metrics::increment(METRIC_DISPLAY_DEFERRED);
+  return false;
+#else
+  return true;
+#endif
+}
+
+void Display::_drawWidget(uint widget) {
+#if defined(DISPLAY_TYPE_TFT)
+  uint32_t pixels = _renderer->framePixels();
+  unsigned long startMicros = micros();
+#endif
+
+  if (widget < CHANNEL_COUNT) {
+    _displayChannel((channel_enum) widget);
+  } else if (widget == DISPLAY_WIDGET_CLOCK) {
+    PROFILE_SCOPE(PROFILE_DISPLAY_CLOCK);
+    _displayClock();
+#if defined(DISPLAY_TYPE_ILI9488_480_320)
+  } else if (widget == DISPLAY_WIDGET_GRAPH) {
+    PROFILE_SCOPE(PROFILE_DISPLAY_CGM_GRAPH);
+    _displayCgmGraph();
+#endif
+  }
+
+#if defined(DISPLAY_TYPE_TFT)
+  if (_renderer->framePixels() != pixels) {
+    _widgetMicros[widget] = micros() - startMicros;
+  }
+#endif
+}
+
+// Displayed channels whose staleness differs from how they are drawn. Also
+// finds the time at which the next drawn value goes stale.
+uint32_t Display::_staleChanges() {
+  uint32_t changed = 0;
+  int32_t nextStaleCheck = INT32_MAX;
+
+  for (uint32_t channels = CHANNELS_DISPLAYED; channels != 0; channels &= channels - 1) {
+    channel_enum channel = (channel_enum) __builtin_ctz(channels);
+    struct channelValue_struct channelValue = _data->read(channel);
+    bool stale = channelStale(channel, &channelValue);
+    if (stale != ((_staleChannels & CHANNEL_BIT(channel)) != 0)) {
+      changed |= CHANNEL_BIT(channel);
+    }
+    if (!stale &&
+        !isnan(channelValue.value)) {
+      nextStaleCheck = min(nextStaleCheck, channelValue.sampledAt + (int32_t) channelInfo[channel].maxAge + 1);
+    }
+  }
+
+  if (nextStaleCheck == INT32_MAX) {
+    _staleTimer.stop();
+  } else {
+    _staleTimer.startAt((uint64_t) max(nextStaleCheck, (int32_t) 0) * 1000);
+  }
+
+  return changed;
+}
+
+bool Display::_clockDue() {
+  time_t nowSecs = time(nullptr);
+  bool timeKnown = (nowSecs > 86400 * 365);  // Give NTP one year to sync
+  time_t minute = (timeKnown ? nowSecs / 60 : -1);
+  return ((minute != _displayedMinute) ||
+          !timeKnown ||
+          (_changes & DATA_BIT(DATA_CLOCK)) ||
+          _clockDeferred ||
+          _initializeDisplay);
 }
 
 void Display::_displayClock() {
-  if (((_data->time / 60) !=  (_oldData->time / 60)) ||
-      (_data->time < 0) ||
-      _data->forceDisplayTimeUpdate) {
+  time_t nowSecs = time(nullptr);
+  bool timeKnown = (nowSecs > 86400 * 365);  // Give NTP one year to sync
+  time_t minute = (timeKnown ? nowSecs / 60 : -1);
+  if (_clockDue()) {
     char displayBuffer[8];
-    if (_data->time > 0) {
-      time_t nowSecs = _data->time;
+    if (timeKnown) {
+      struct timezoneTable_struct timezoneTable;
+      _data->timezoneTable.read(&timezoneTable);
+
+      // Whole local time from one offset, so minute offsets and the day wrap both come out right
+      time_t localSecs = nowSecs + Timezone::offset(&timezoneTable, nowSecs, &_timezoneHint);
       struct tm timeinfo;
-      gmtime_r((const time_t *) &nowSecs, &timeinfo);
-
-      // Serial.print("nowSecs = ");
-      // Serial.println(nowSecs);
-      // Serial.print("_data->dstBegin = ");
-      // Serial.println(_data->dstBegin);
-      // Serial.print("_data->dstEnd) = ");
-      // Serial.println(_data->dstEnd);
-      // Serial.print("_data->daylightTimezoneOffset) = ");
-      // Serial.println(_data->daylightTimezoneOffset);
-
-      int32_t timezoneOffset;
-      if ((nowSecs >= _data->dstBegin) &&
-          (nowSecs < _data->dstEnd)) {
-        timezoneOffset = _data->daylightTimezoneOffset;
-      } else {
-        timezoneOffset = _data->standardTimezoneOffset;
-      }
-      int32_t hour = timeinfo.tm_hour + (timezoneOffset / 3600);
-      if (hour < 0) {
-        hour += 24;
-      }
+      gmtime_r(&localSecs, &timeinfo);
+      int32_t hour = timeinfo.tm_hour;
       sprintf(displayBuffer, "%2d:%02d", hour, timeinfo.tm_min);
 
-      Serial.print("Current time: ");
-      Serial.println(asctime(&timeinfo));
+      LOG_INFO(LOG_DISPLAY_TIME, hour, timeinfo.tm_min, (int64_t) nowSecs);
     } else {
       strcpy(displayBuffer, "--:--");
     }
-#if defined(DISPLAY_TYPE_ST7735_128_160)
-    rightJustify(_tft, displayBuffer, FONT_NUMBER, FONT_SIZE_CLOCK, TFT_GREEN, 150, 69, 5.75 * 24);
-#elif defined(DISPLAY_TYPE_ILI9488_480_320)
-    rightJustify(_tft, displayBuffer, FONT_NUMBER, FONT_SIZE_CLOCK, TFT_GREEN, 462, 160, 4.5 * 96);
+#if defined(DISPLAY_TYPE_LCD_042)
+    _drawLcdText(displayBuffer, &LAYOUT.clock, LCD_CLOCK_FONT);
+#elif defined(DISPLAY_TYPE_TFT)
+    _drawNumber(&_clockText, displayBuffer, &LAYOUT.clock, TFT_GREEN);
 #endif
-    _oldData->time = _data->time;
-    _data->forceDisplayTimeUpdate = false;
+    _displayedMinute = minute;
+  }
+
+  if (timeKnown) {
+    // Just past the next minute boundary
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    _clockTimer.start(60000 - (((now.tv_sec % 60) * 1000) + (now.tv_usec / 1000)) + 1);
+  } else {
+    _clockTimer.start(DISPLAY_UNSYNCED_INTERVAL);
   }
 }
 
-void Display::_displayCgmData() {
+void Display::_displayChannel(channel_enum channel) {
+  struct channelValue_struct channelValue = _data->read(channel);
+  float value = channelValue.value;
+  bool stale = channelStale(channel, &channelValue);
+  if (stale) {
+    _staleChannels |= CHANNEL_BIT(channel);
+  } else {
+    _staleChannels &= ~CHANNEL_BIT(channel);
+  }
+
+  switch (channelInfo[channel].display) {
+    case DISPLAY_BINDING_CGM:
+      {
+        PROFILE_SCOPE(PROFILE_DISPLAY_CGM);
+        _displayCgmData(value, stale);
+      }
+#if defined(DISPLAY_TYPE_ILI9488_480_320)
+      _graphPending = true;  // Drawn after the clock, when the frame has budget left
+#endif
+      break;
+
+#if defined(DISPLAY_TYPE_ILI9488_480_320)
+    case DISPLAY_BINDING_PROPANE:
+      {
+        PROFILE_SCOPE(PROFILE_DISPLAY_PROPANE);
+        _displayPropaneLevel(value, stale);
+      }
+      break;
+
+    case DISPLAY_BINDING_TEMPERATURE:
+      {
+        PROFILE_SCOPE(PROFILE_DISPLAY_TEMPERATURE);
+        _displayTemperature(value, stale);
+      }
+      break;
+#endif
+
+#if defined(DISPLAY_TYPE_TFT)
+    case DISPLAY_BINDING_CGM_TREND:
+      {
+        PROFILE_SCOPE(PROFILE_DISPLAY_CGM_TREND);
+        _displayCgmTrend(value, stale);
+      }
+      break;
+#endif
+
+    default:
+      break;
+  }
+}
+
+#if defined(DISPLAY_TYPE_TFT)
+// The rate goes with the reading, so a stale one is as good as unknown
+float Display::_cgmRate() {
+  struct channelValue_struct channelValue = _data->read(CHANNEL_CGM_RATE);
+  return (channelStale(CHANNEL_CGM_RATE, &channelValue) ? NAN : channelValue.value);
+}
+
+// Red for any alert level, including a projected one, and while an alert from
+// the collector is younger than the reading's maximum age
+uint32_t Display::_cgmColor(float mgPerDl, float rate) {
+  uint8_t minutes;
+  bool alertActive = ((_alert.level != ALERT_NONE) &&
+                      ((Clock::nowMillis() - _alert.raisedAt) < (uint64_t) channelInfo[CHANNEL_MG_PER_DL].maxAge * 1000));
+  if (isnan(mgPerDl)) {
+    return TFT_GREEN;
+  } else if (alertActive ||
+             (Alerts::level(mgPerDl, rate, ALERT_NONE, &minutes) != ALERT_NONE)) {
+    return TFT_RED;
+  } else if ((mgPerDl < CGM_LOW) ||
+             (mgPerDl > CGM_HIGH)) {
+    return TFT_YELLOW;
+  }
+
+  return TFT_GREEN;
+}
+#endif
+
+void Display::_displayCgmData(float mgPerDl, bool stale) {
   char displayBuffer[8];
 
-  ushort mgPerDl = _data->mgPerDl;
-  if ((mgPerDl != _oldData->mgPerDl) ||
-      _initializeDisplay) {
-    // Serial.println("---");
-    // Serial.println(mgPerDl);
-    // Serial.println(UNKNOWN_MG_PER_DL);
-    if (mgPerDl != UNKNOWN_MG_PER_DL) {
-      sprintf(displayBuffer, "%d", mgPerDl);
-    } else {
-      strcpy(displayBuffer, "---");
-    }
+  // Serial.println("---");
+  // Serial.println(mgPerDl);
+  if (!isnan(mgPerDl)) {
+    sprintf(displayBuffer, "%d", (int) mgPerDl);
+  } else {
+    strcpy(displayBuffer, "---");
+  }
 
 #if defined(DISPLAY_TYPE_LCD_042)
-    u8g2.clearBuffer();  // clear the internal memory
-    u8g2.setFont(u8g_font_9x18);  // choose a suitable font
-    u8g2.drawStrX2(0, 20, displayBuffer);  // write something to the internal memory
-    u8g2.sendBuffer();  // transfer internal memory to the display
+  _drawLcdText(displayBuffer, &LAYOUT.cgm, LCD_CGM_FONT);
 #elif defined(DISPLAY_TYPE_TFT)
-    uint32_t color;
-    if (mgPerDl == UNKNOWN_MG_PER_DL) {
-      color = TFT_GREEN;
-    } else if ((mgPerDl < 70) ||
-              (mgPerDl > 250)) {
-      color = TFT_RED;
-    } else if ((mgPerDl >= 70 && mgPerDl < 80) ||
-                (mgPerDl > 150 && mgPerDl <= 250)) {
-      color = TFT_YELLOW;
-    } else {
-      color = TFT_GREEN;
-    }
-    drawBorder(_tft, 0, 0, _tft->width(), _tft->height(), color);
+  uint32_t color;
+  if (stale) {
+    color = DISPLAY_STALE_COLOR;
+  } else {
+    color = _cgmColor(mgPerDl, _cgmRate());
+  }
+  _drawBorder(color);
 
-#if defined(DISPLAY_TYPE_ST7735_128_160)
-    rightJustify(_tft, displayBuffer, FONT_NUMBER, FONT_SIZE, color, 150, 13, 4.5 * 24);
-#elif defined(DISPLAY_TYPE_ILI9488_480_320)
-    rightJustify(_tft, displayBuffer, FONT_NUMBER, FONT_SIZE, color, 462, 9, 3 * 96);
-#endif
+  _drawNumber(&_cgmText, displayBuffer, &LAYOUT.cgm, color);
 #endif
 
-    _oldData->mgPerDl = mgPerDl;
+  LatencyTrace::rendered();
+}
+
+#if defined(DISPLAY_TYPE_TFT)
+void Display::_displayCgmTrend(float rate, bool stale) {
+  struct channelValue_struct cgm = _data->read(CHANNEL_MG_PER_DL);
+  if (stale ||
+      channelStale(CHANNEL_MG_PER_DL, &cgm)) {
+    rate = NAN;  // An old trend is worse than none
+  }
+
+  uint32_t color = _cgmColor(cgm.value, rate);
+  trendArrow_enum arrow = CgmTrend::arrow(rate);
+  if (!_trendDrawn ||
+      (arrow != _trendArrow) ||
+      (color != _trendColor)) {
+    TFT_eSPI* target = _renderer->begin(LAYOUT.trendArrow.x, LAYOUT.trendArrow.y, LAYOUT.trendArrow.w, LAYOUT.trendArrow.h);
+    drawTrendArrow(target, 0, 0, LAYOUT.trendArrow.w, arrow, color);
+    _renderer->end();
+    _trendArrow = arrow;
+    _trendColor = color;
+    _trendDrawn = true;
+  }
+
+#if defined(DISPLAY_TYPE_ILI9488_480_320)
+  // Time left until an urgent threshold, while it is within the projection limit
+  char displayBuffer[16] = "";
+  float minutes = CgmTrend::minutesBelow(CGM_URGENT_LOW, cgm.value, rate);
+  if ((minutes > 0) &&
+      !isnan(minutes)) {
+    sprintf(displayBuffer, "LOW %dm", (int) minutes);
+  } else {
+    minutes = CgmTrend::minutesAbove(CGM_URGENT_HIGH, cgm.value, rate);
+    if ((minutes > 0) &&
+        !isnan(minutes)) {
+      sprintf(displayBuffer, "HIGH %dm", (int) minutes);
+    }
   }
+  _drawText(&_trendText, displayBuffer, &LAYOUT.trendText, color);
+#endif
 }
+#endif
 
 #if defined(DISPLAY_TYPE_ILI9488_480_320)
-void Display::_displayPropaneLevel() {
-  char displayBuffer[8];
+static uint8_t graphRow(float mgPerDl) {
+  float clamped = constrain(mgPerDl, (float) GRAPH_MIN_MG, (float) GRAPH_MAX_MG);
+  return lroundf((GRAPH_MAX_MG - clamped) * (GRAPH_HEIGHT - 1) / (GRAPH_MAX_MG - GRAPH_MIN_MG));
+}
 
-  if ((_data->propaneLevel != _oldData->propaneLevel) ||
-      _initializeDisplay) {
-    _tft->pushImage(20, 11, 64, 64, PROPANE_TANK);
-    if (_data->propaneLevel != UNKNOWN_PROPANE_LEVEL) {
-      sprintf(displayBuffer, "%d", _data->propaneLevel);
-    } else {
-      strcpy(displayBuffer, "--");
+// Floor, since samples from before boot have negative times
+static int32_t graphColumn(int32_t seconds) {
+  return (seconds >= 0 ? seconds / GRAPH_COLUMN_SECONDS : -((GRAPH_COLUMN_SECONDS - 1 - seconds) / GRAPH_COLUMN_SECONDS));
+}
+
+static uint graphPosition(int32_t column) {
+  return ((column % GRAPH_WIDTH) + GRAPH_WIDTH) % GRAPH_WIDTH;
+}
+
+void Display::_displayCgmGraph() {
+  if (_graphBackfill) {
+    _backfillGraph();
+    _graphBackfill = false;
+  }
+
+  struct channelValue_struct channelValue = _data->read(CHANNEL_MG_PER_DL);
+  if (channelStale(CHANNEL_MG_PER_DL, &channelValue) ||
+      isnan(channelValue.value)) {
+    return;
+  }
+
+  int32_t column = graphColumn(channelValue.sampledAt);
+  uint8_t point = graphRow(channelValue.value);
+  if ((_graphColumn != GRAPH_EMPTY) &&
+      ((column < _graphColumn) ||
+       ((column == _graphColumn) && (point == _graphPoints[graphPosition(column)])))) {
+    return;  // Older, or the staleness changed without a new reading
+  }
+
+  uint32_t bytes = _graphAdd(column, point, true);
+  Metrics::record(METRIC_DISPLAY_GRAPH_UPDATE_BYTES, bytes);
+  Metrics::increment(METRIC_DISPLAY_GRAPH_SPI_BYTES, bytes);
+}
+
+// Starts over from the CGM history, if there is one, and draws every column once
+void Display::_backfillGraph() {
+  memset(_graphPoints, GRAPH_NO_POINT, sizeof(_graphPoints));
+  _graphColumn = GRAPH_EMPTY;
+
+  time_t now = time(nullptr);
+  TimeSeries* history = _data->history[CHANNEL_MG_PER_DL];
+  if ((history != NULL) &&
+      (now > 86400 * 365)) {
+    time_t offset = now - dataSeconds();  // History is in UTC seconds, columns are in dataSeconds()
+    TimeSeriesIterator iterator;
+    struct timeSeriesPoint_struct point;
+    history->query(now - (GRAPH_HOURS * 3600), now + 1, &iterator);
+    while (iterator.next(&point)) {
+      _graphAdd(graphColumn(point.time - offset), graphRow(point.value), false);
     }
-    rightJustify(_tft, displayBuffer, FONT_NUMBER, FONT_SIZE_PROPANE, TFT_GREEN, 160, 20, 2 * 16);
+  }
 
-    _oldData->propaneLevel = _data->propaneLevel;
+  uint32_t bytes = 0;
+  for (uint position = 0; position < GRAPH_WIDTH; position++) {
+    bytes += _drawGraphColumn(position);
   }
+  Metrics::increment(METRIC_DISPLAY_GRAPH_SPI_BYTES, bytes);
 }
 
-void Display::_displayTemperature() {
-  char displayBuffer[8];
+// Stores a reading in its column. Moving to a later column blanks the columns
+// skipped without readings and those that enter the gap ahead, all of which are
+// drawn along with the new one. Returns the SPI bytes it took.
+uint32_t Display::_graphAdd(int32_t column, uint8_t point, bool draw) {
+  uint32_t bytes = 0;
+  if ((_graphColumn == GRAPH_EMPTY) ||
+      (column > _graphColumn)) {
+    int32_t first = column + GRAPH_GAP - GRAPH_WIDTH + 1;
+    if ((_graphColumn != GRAPH_EMPTY) &&
+        ((_graphColumn + GRAPH_GAP + 1) > first)) {
+      first = _graphColumn + GRAPH_GAP + 1;  // Already blank
+    }
+    for (int32_t blank = first; blank <= (column + GRAPH_GAP); blank++) {
+      if (blank == column) {
+        continue;
+      }
+      _graphPoints[graphPosition(blank)] = GRAPH_NO_POINT;
+      if (draw) {
+        bytes += _drawGraphColumn(graphPosition(blank));
+      }
+    }
+    _graphColumn = column;
+  } else if (column <= (_graphColumn - GRAPH_WIDTH + GRAPH_GAP)) {
+    return 0;  // Scrolled off
+  }
 
-  if ((_data->outdoorTemperature != _oldData->outdoorTemperature) ||
-      _initializeDisplay) {
-    _tft->pushImage(19, 80, 64, 64, THERMOMETER);
-    if (_data->outdoorTemperature != UNKNOWN_TEMPERATURE) {
-      sprintf(displayBuffer, "%3.0f", _data->outdoorTemperature);
-    } else {
-      strcpy(displayBuffer, "--");
+  uint position = graphPosition(column);
+  _graphPoints[position] = point;
+  if (draw) {
+    bytes += _drawGraphColumn(position);
+    if (column < _graphColumn) {
+      bytes += _drawGraphColumn((position + 1) % GRAPH_WIDTH);  // Connects to the reading after it
     }
-    rightJustify(_tft, displayBuffer, FONT_NUMBER, FONT_SIZE_PROPANE, TFT_GREEN, 160, 89, 6 * 16);
+  }
 
-    _oldData->outdoorTemperature = _data->outdoorTemperature;
+  return bytes;
+}
+
+// The reading, joined to the one in the column before, over the target range bands
+uint32_t Display::_drawGraphColumn(uint position) {
+  int32_t x = LAYOUT.graph.x + position;
+  uint8_t point = _graphPoints[position];
+  if (point == GRAPH_NO_POINT) {
+    return _drawGraphBands(x, 0, GRAPH_HEIGHT - 1);
+  }
+
+  uint8_t previous = _graphPoints[(position + GRAPH_WIDTH - 1) % GRAPH_WIDTH];
+  int32_t top = point;
+  int32_t bottom = point;
+  if (previous != GRAPH_NO_POINT) {
+    top = min(top, (int32_t) previous);
+    bottom = max(bottom, (int32_t) previous);
+  }
+
+  uint32_t color = TFT_GREEN;
+  if ((point < graphRow(CGM_URGENT_HIGH)) ||
+      (point > graphRow(CGM_URGENT_LOW))) {
+    color = TFT_RED;
+  } else if ((point < graphRow(CGM_HIGH)) ||
+             (point > graphRow(CGM_LOW))) {
+    color = TFT_YELLOW;
+  }
+
+  _renderer->direct(bottom - top + 1);
+  _tft->drawFastVLine(x, LAYOUT.graph.y + top, bottom - top + 1, color);
+  return _drawGraphBands(x, 0, top - 1) +
+         _drawGraphBands(x, bottom + 1, GRAPH_HEIGHT - 1) +
+         DISPLAY_WINDOW_BYTES + ((bottom - top + 1) * DISPLAY_BYTES_PER_PIXEL);
+}
+
+// Rows from to to of a column's background. Returns the SPI bytes it took.
+uint32_t Display::_drawGraphBands(int32_t x, int32_t from, int32_t to) {
+  const struct {
+    int32_t first;
+    int32_t last;
+    uint32_t color;
+  } bands[] = {
+    { 0, graphRow(CGM_HIGH) - 1, GRAPH_HIGH_BAND },
+    { graphRow(CGM_HIGH), graphRow(CGM_LOW), GRAPH_TARGET_BAND },
+    { graphRow(CGM_LOW) + 1, GRAPH_HEIGHT - 1, GRAPH_LOW_BAND },
+  };
+
+  uint32_t bytes = 0;
+  for (uint i = 0; i < (sizeof(bands) / sizeof(bands[0])); i++) {
+    int32_t first = max(from, bands[i].first);
+    int32_t last = min(to, bands[i].last);
+    if (first <= last) {
+      _renderer->direct(last - first + 1);
+      _tft->drawFastVLine(x, LAYOUT.graph.y + first, last - first + 1, bands[i].color);
+      bytes += DISPLAY_WINDOW_BYTES + ((last - first + 1) * DISPLAY_BYTES_PER_PIXEL);
+    }
+  }
+
+  return bytes;
+}
+
+void Display::_drawIcon(const struct layoutBox_struct* box, const struct iconAsset_struct* icon) {
+  uint32_t windows;
+  uint32_t pixels;
+  _renderer->direct(0);
+  if (_renderer->offscreen() != NULL) {
+    pixels = Icons::push(_renderer->offscreen(), box->x, box->y, icon, true, &windows);
+  } else {
+    pixels = Icons::push(_tft, box->x, box->y, icon, true, &windows);
+  }
+  _renderer->pushed(pixels, windows);
+}
+
+void Display::_displayPropaneLevel(float propaneLevel, bool stale) {
+  char displayBuffer[8];
+
+  if (!_propaneText.drawn) {
+    _drawIcon(&LAYOUT.propaneIcon, &PROPANE_TANK);
+  }
+  if (!isnan(propaneLevel)) {
+    sprintf(displayBuffer, "%d", (int) propaneLevel);
+  } else {
+    strcpy(displayBuffer, "--");
+  }
+  _drawNumber(&_propaneText, displayBuffer, &LAYOUT.propane, (stale ? DISPLAY_STALE_COLOR : TFT_GREEN));
+}
+
+void Display::_displayTemperature(float temperature, bool stale) {
+  char displayBuffer[8];
+
+  if (!_temperatureText.drawn) {
+    _drawIcon(&LAYOUT.temperatureIcon, &THERMOMETER);
+  }
+  if (!isnan(temperature)) {
+    sprintf(displayBuffer, "%3.0f", temperature);
+  } else {
+    strcpy(displayBuffer, "--");
   }
+  _drawNumber(&_temperatureText, displayBuffer, &LAYOUT.temperature, (stale ? DISPLAY_STALE_COLOR : TFT_GREEN));
 }
 #endif
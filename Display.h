@@ -2,40 +2,123 @@
 
 #include "lora-cgm-sender.ino.globals.h"
 #include "data.h"
+#include "TimerWheel.h"
+#include "CgmTrend.h"
 
 // #define DISPLAY_TYPE_LCD_042
 #define DISPLAY_TYPE_TFT
 // #define DISPLAY_TYPE_ST7735_128_160
 #define DISPLAY_TYPE_ILI9488_480_320
 
+#include "Layout.h"
+#if defined(DISPLAY_TYPE_LCD_042)
+#define LAYOUT LAYOUT_LCD_042
+#elif defined(DISPLAY_TYPE_ST7735_128_160)
+#define LAYOUT LAYOUT_ST7735_128_160
+#elif defined(DISPLAY_TYPE_ILI9488_480_320)
+#define LAYOUT LAYOUT_ILI9488_480_320
+#endif
+
+// Widgets scheduled by loop(), the displayed channels and these
+#define DISPLAY_WIDGET_CLOCK CHANNEL_COUNT
+#define DISPLAY_WIDGET_GRAPH (CHANNEL_COUNT + 1)
+#define DISPLAY_WIDGET_COUNT (CHANNEL_COUNT + 2)
 
 #if defined(DISPLAY_TYPE_LCD_042)
 #include <U8g2lib.h>
 #include <Wire.h>
 #elif defined(DISPLAY_TYPE_TFT)
 #include <TFT_eSPI.h> // Graphics and font library for ST7735 driver chip
+#include "Renderer.h"
+#include "Glyphs.h"
+
+// What a text widget last drew, so that only the characters that changed are drawn again
+struct textWidget_struct {
+  char text[12];
+  uint32_t color;
+  bool drawn;
+};
+
+#define DISPLAY_GLYPH_SIZES 3  // Fonts and text sizes with a glyph cache
 #endif
 
 class Display {
   private:
-    volatile struct data_struct* _data;
-    struct data_struct* _oldData;
+    struct data_struct* _data;
+    SemaphoreHandle_t _mutex;  // Held by loop(), and by anyone borrowing the panel
+    time_t _displayedMinute;
+    int _timezoneHint;  // Of Timezone::offset(), kept from minute to minute
+    uint32_t _changes;  // Consumed at the start of every loop()
+    uint32_t _staleChannels;  // Channels currently drawn as stale
+    uint32_t _deferredChannels;  // Left over when an alert or the frame budget cut the last loop() short
+    bool _clockDeferred;
+    uint32_t _widgetMicros[DISPLAY_WIDGET_COUNT];  // How long each took the last time it drew anything
+    struct alert_struct _alert;  // The latest one raised or received
+    DeadlineTimer _clockTimer;  // Next minute boundary
+    DeadlineTimer _staleTimer;  // When a drawn value goes stale
 #if defined(DISPLAY_TYPE_LCD_042)
     U8G2_SSD1306_72X40_ER_F_HW_I2C* _u8g2;
 #elif defined(DISPLAY_TYPE_TFT)
     TFT_eSPI* _tft;
+    bool _ownsTft;
+    Renderer* _renderer;
+    struct rendererFrame_struct _lastFrame;
+    GlyphCache* _glyphs[DISPLAY_GLYPH_SIZES];  // Created on first use of each font and size
+    uint32_t _borderColor;
+    struct textWidget_struct _cgmText;
+    struct textWidget_struct _clockText;
+    trendArrow_enum _trendArrow;
+    uint32_t _trendColor;
+    bool _trendDrawn;
+#if defined(DISPLAY_TYPE_ILI9488_480_320)
+    struct textWidget_struct _trendText;
+    struct textWidget_struct _propaneText;
+    struct textWidget_struct _temperatureText;
+#endif
 #endif
     bool _initializeDisplay;
 
+    bool _clockDue();
     void _displayClock();
-    void _displayCgmData();
+    bool _fitsBudget(uint widget, unsigned long startMicros);
+    void _drawWidget(uint widget);
+    uint32_t _staleChanges();
+    void _displayChannel(channel_enum channel);
+    void _displayCgmData(float mgPerDl, bool stale);
+#if defined(DISPLAY_TYPE_LCD_042)
+    void _drawLcdText(const char* text, const struct layoutBox_struct* box, const uint8_t* font);
+#elif defined(DISPLAY_TYPE_TFT)
+    void _resetWidgets();
+    void _drawBorder(uint32_t color);
+    void _drawText(struct textWidget_struct* widget, const char* text, const struct layoutBox_struct* box, uint32_t color);
+    GlyphCache* _glyphCache(uint8_t font, uint8_t fontSize);
+    void _drawNumber(struct textWidget_struct* widget, const char* text, const struct layoutBox_struct* box, uint32_t color);
+    float _cgmRate();
+    uint32_t _cgmColor(float mgPerDl, float rate);
+    void _displayCgmTrend(float rate, bool stale);
+#endif
 #if defined(DISPLAY_TYPE_ILI9488_480_320)
-    void _displayPropaneLevel();
-    void _displayTemperature();
+    uint8_t _graphPoints[GRAPH_WIDTH];  // Row of the reading in each column, GRAPH_NO_POINT if none
+    int32_t _graphColumn;  // Absolute column of the newest reading, GRAPH_EMPTY before the first
+
+    bool _graphPending;  // The CGM changed since the graph was drawn
+    bool _graphBackfill;  // Drawn again from the history, after the screen was cleared
+
+    void _displayCgmGraph();
+    void _backfillGraph();
+    uint32_t _graphAdd(int32_t column, uint8_t point, bool draw);
+    uint32_t _drawGraphColumn(uint position);
+    uint32_t _drawGraphBands(int32_t x, int32_t from, int32_t to);
+    void _drawIcon(const struct layoutBox_struct* box, const struct iconAsset_struct* icon);
+    void _displayPropaneLevel(float propaneLevel, bool stale);
+    void _displayTemperature(float temperature, bool stale);
 #endif
 
   public:
-    Display(volatile struct data_struct* data);
+    Display(struct data_struct* data);
+#if defined(DISPLAY_TYPE_TFT)
+    Display(struct data_struct* data, TFT_eSprite* sprite);
+#endif
     ~Display();
 
     void setup();
@@ -44,4 +127,14 @@ class Display {
     void print(const char* val);
     void println(const char* val);
     void resetDisplay();
+    unsigned long nextDeadline();
+
+    // Keeps loop() off the panel, for the benchmarks
+    void lock();
+    void unlock() { xSemaphoreGive(_mutex); };
+#if defined(DISPLAY_TYPE_TFT)
+    TFT_eSPI* panel() { return _tft; };
+    // What the last loop() pushed
+    struct rendererFrame_struct lastFrame() { return _lastFrame; };
+#endif
 };
\ No newline at end of file
@@ -0,0 +1,142 @@
+#include "DisplaySnapshot.h"
+
+#if defined(ENABLE_DISPLAY_SNAPSHOT)
+#include "Display.h"
+#include "data.h"
+
+#if defined(ENABLE_DISPLAY)
+extern Display* display;
+#endif
+
+#if defined(DISPLAY_TYPE_ST7735_128_160)
+#define SNAPSHOT_LAYOUT "st7735_128_160"
+#elif defined(DISPLAY_TYPE_ILI9488_480_320)
+#define SNAPSHOT_LAYOUT "ili9488_480_320"
+#endif
+
+#if defined(DISPLAY_TYPE_TFT)
+#define SNAPSHOT_WIDTH ((TFT_WIDTH > TFT_HEIGHT) ? TFT_WIDTH : TFT_HEIGHT)  // Landscape, as setup() rotates the panel
+#define SNAPSHOT_HEIGHT ((TFT_WIDTH > TFT_HEIGHT) ? TFT_HEIGHT : TFT_WIDTH)
+
+// Pixels that differ from the last frame, which becomes this one
+static uint32_t changedPixels(TFT_eSprite* sprite, uint16_t* previous) {
+  uint32_t changed = 0;
+
+  for (int32_t y = 0; y < SNAPSHOT_HEIGHT; y++) {
+    for (int32_t x = 0; x < SNAPSHOT_WIDTH; x++) {
+      uint16_t color = sprite->readPixel(x, y);
+      uint16_t* last = &previous[(y * SNAPSHOT_WIDTH) + x];
+      if (color != *last) {
+        changed++;
+        *last = color;
+      }
+    }
+  }
+
+  return changed;
+}
+
+template <typename Fn>
+static void step(Print* out, const char* name, Display* display, TFT_eSprite* sprite, uint16_t* previous, Fn fn) {
+  fn();
+
+  // Until the frame budget left nothing for later
+  uint32_t loops = 0;
+  uint32_t pixels = 0;
+  uint32_t windows = 0;
+  do {
+    display->loop();
+    loops++;
+    pixels += display->lastFrame().pixels;
+    windows += display->lastFrame().windows;
+  } while (display->nextDeadline() != ULONG_MAX);
+
+  uint32_t changed = changedPixels(sprite, previous);
+  out->printf("{\"snapshot\":\"%s\",\"layout\":\"%s\",\"loops\":%u,\"pixels\":%u,\"windows\":%u,\"changed\":%u,\"overdraw\":%d}\n",
+              name,
+              SNAPSHOT_LAYOUT,
+              loops,
+              pixels,
+              windows,
+              changed,
+              (int32_t) (pixels - changed));
+}
+
+// RGB565 widened to 8 bits per channel, a row at a time
+static void writePpm(Print* out, TFT_eSprite* sprite) {
+  static uint8_t line[SNAPSHOT_WIDTH * 3];
+
+  out->printf("P6\n# lora-cgm %s\n%d %d\n255\n", SNAPSHOT_LAYOUT, SNAPSHOT_WIDTH, SNAPSHOT_HEIGHT);
+  for (int32_t y = 0; y < SNAPSHOT_HEIGHT; y++) {
+    for (int32_t x = 0; x < SNAPSHOT_WIDTH; x++) {
+      uint16_t color = sprite->readPixel(x, y);
+      line[(x * 3)] = ((color >> 8) & 0xF8) | (color >> 13);
+      line[(x * 3) + 1] = ((color >> 3) & 0xFC) | ((color >> 9) & 0x03);
+      line[(x * 3) + 2] = ((color << 3) & 0xF8) | ((color >> 2) & 0x07);
+    }
+    out->write(line, sizeof(line));
+  }
+  out->println();
+}
+#endif
+
+static void render(Print* out) {
+#if defined(DISPLAY_TYPE_TFT)
+  TFT_eSPI parent;
+  TFT_eSprite sprite(&parent);
+  sprite.setColorDepth(16);
+  uint16_t* previous = (uint16_t*) malloc(SNAPSHOT_WIDTH * SNAPSHOT_HEIGHT * sizeof(uint16_t));
+  if ((previous == NULL) ||
+      (sprite.createSprite(SNAPSHOT_WIDTH, SNAPSHOT_HEIGHT) == NULL)) {
+    free(previous);
+    out->println("{\"snapshot\":\"skipped\",\"reason\":\"framebuffer could not be allocated\"}");
+    return;
+  }
+
+  // The same readings every time, so that only the clock and where the graph
+  // puts them differ between runs. The graph's columns follow the uptime.
+  struct data_struct snapshotData;
+  snapshotData.update(CHANNEL_MG_PER_DL, 112);
+  snapshotData.update(CHANNEL_PROPANE_LEVEL, 64);
+  snapshotData.update(CHANNEL_INDOOR_TEMPERATURE, 70.0);
+  snapshotData.update(CHANNEL_INDOOR_HUMIDITY, 40);
+  snapshotData.update(CHANNEL_OUTDOOR_TEMPERATURE, 52.5);
+  snapshotData.update(CHANNEL_OUTDOOR_HUMIDITY, 86);
+
+  Display snapshotDisplay(&snapshotData, &sprite);
+  snapshotDisplay.resetDisplay();
+  changedPixels(&sprite, previous);
+
+  step(out, "full_redraw", &snapshotDisplay, &sprite, previous, []() {});
+  step(out, "cgm_update", &snapshotDisplay, &sprite, previous, [&]() {
+    snapshotData.update(CHANNEL_MG_PER_DL, 113);
+  });
+  step(out, "cgm_width_change", &snapshotDisplay, &sprite, previous, [&]() {
+    snapshotData.update(CHANNEL_MG_PER_DL, 98);
+  });
+  step(out, "temperature_update", &snapshotDisplay, &sprite, previous, [&]() {
+    snapshotData.update(CHANNEL_OUTDOOR_TEMPERATURE, 53.5);  // The one the panel shows
+  });
+  step(out, "idle", &snapshotDisplay, &sprite, previous, []() {});
+
+  writePpm(out, &sprite);
+  sprite.deleteSprite();
+  free(previous);
+#else
+  out->println("{\"snapshot\":\"skipped\",\"reason\":\"no TFT layout\"}");
+#endif
+}
+
+namespace DisplaySnapshot {
+  void capture(Print* out) {
+    // Every TFT_eSPI drives the panel's pins and bus, so the display task is kept off them meanwhile
+#if defined(ENABLE_DISPLAY)
+    display->lock();
+#endif
+    render(out);
+#if defined(ENABLE_DISPLAY)
+    display->unlock();
+#endif
+  }
+};
+#endif
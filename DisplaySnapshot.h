@@ -0,0 +1,14 @@
+#pragma once
+
+#include <Arduino.h>
+#include "lora-cgm-sender.ino.globals.h"
+
+#if defined(ENABLE_DISPLAY_SNAPSHOT)
+namespace DisplaySnapshot {
+  // Renders the layout from fixed readings into an off-screen framebuffer.
+  // Prints one JSON object per step with the loops, pixels and windows it took, the
+  // pixels that really changed and the overdraw, then the final frame as a
+  // binary PPM, which tools/display-snapshot.py compares with a golden image.
+  void capture(Print* out);
+};
+#endif
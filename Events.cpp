@@ -0,0 +1,125 @@
+#include "Events.h"
+
+#if defined(ENABLE_EVENT_LOOP)
+#include <atomic>
+#if defined(EVENTS_LIGHT_SLEEP)
+#include <esp_pm.h>
+#endif
+
+struct subscriber_struct {
+  TaskHandle_t task;
+  uint32_t events;
+  uint32_t pendingEvents;  // Only used by the subscribed task
+};
+
+static struct subscriber_struct subscribers[EVENT_MAX_SUBSCRIBERS];
+static std::atomic<uint> subscriberCount(0);
+static portMUX_TYPE subscriberMux = portMUX_INITIALIZER_UNLOCKED;
+
+static struct subscriber_struct* currentSubscriber() {
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+  uint count = subscriberCount.load();
+  for (uint i = 0; i < count; i++) {
+    if (subscribers[i].task == task) {
+      return &subscribers[i];
+    }
+  }
+
+  return NULL;
+}
+
+// Moves the notifications that arrived since the last call into the pending events
+static void collect(struct subscriber_struct* subscriber, TickType_t timeout) {
+  uint32_t events;
+  if (xTaskNotifyWait(0, UINT32_MAX, &events, timeout) == pdTRUE) {
+    subscriber->pendingEvents |= events;
+  }
+}
+
+namespace Events {
+  void setup() {
+#if defined(EVENTS_LIGHT_SLEEP)
+    // The idle task enters light sleep whenever nothing is scheduled before the next tick
+    esp_pm_config_t pmConfig = {
+      .max_freq_mhz = (int) getCpuFrequencyMhz(),
+      .min_freq_mhz = (int) getXtalFrequencyMhz(),
+      .light_sleep_enable = true
+    };
+    esp_err_t result = esp_pm_configure(&pmConfig);
+    if (result != ESP_OK) {
+      Serial.print("esp_pm_configure() returned ");
+      Serial.println(result);
+    }
+#endif
+  }
+
+  bool subscribe(uint32_t events) {
+    bool subscribed = false;
+
+    portENTER_CRITICAL(&subscriberMux);
+    uint count = subscriberCount.load();
+    if (count < EVENT_MAX_SUBSCRIBERS) {
+      subscribers[count].task = xTaskGetCurrentTaskHandle();
+      subscribers[count].events = events;
+      subscribers[count].pendingEvents = 0;
+      subscriberCount.store(count + 1);  // Publishes the entry to the notifying tasks
+      subscribed = true;
+    }
+    portEXIT_CRITICAL(&subscriberMux);
+
+    if (!subscribed) {
+      Serial.println("No more event subscribers are available");
+    }
+
+    return subscribed;
+  }
+
+  void notify(uint32_t events) {
+    uint count = subscriberCount.load();
+    for (uint i = 0; i < count; i++) {
+      if (subscribers[i].events & events) {
+        xTaskNotify(subscribers[i].task, subscribers[i].events & events, eSetBits);
+      }
+    }
+  }
+
+  void IRAM_ATTR notifyFromIsr(uint32_t events) {
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+    uint count = subscriberCount.load();
+    for (uint i = 0; i < count; i++) {
+      if (subscribers[i].events & events) {
+        xTaskNotifyFromISR(subscribers[i].task, subscribers[i].events & events, eSetBits, &higherPriorityTaskWoken);
+      }
+    }
+    if (higherPriorityTaskWoken) {
+      portYIELD_FROM_ISR();
+    }
+  }
+
+  void wait(unsigned long timeoutMillis) {
+    struct subscriber_struct* subscriber = currentSubscriber();
+    if (subscriber == NULL) {
+      vTaskDelay(1);
+      return;
+    }
+
+    if (timeoutMillis > EVENT_IDLE_TIMEOUT) {
+      timeoutMillis = EVENT_IDLE_TIMEOUT;
+    }
+    collect(subscriber, (subscriber->pendingEvents != 0 ? 0 : pdMS_TO_TICKS(timeoutMillis)));
+  }
+
+  bool take(uint32_t events) {
+    struct subscriber_struct* subscriber = currentSubscriber();
+    if (subscriber == NULL) {
+      return false;
+    }
+
+    collect(subscriber, 0);
+    bool pending = ((subscriber->pendingEvents & events) != 0);
+    subscriber->pendingEvents &= ~events;
+
+    return pending;
+  }
+}
+#endif
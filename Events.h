@@ -0,0 +1,50 @@
+#pragma once
+
+#include <Arduino.h>
+#include "lora-cgm-sender.ino.globals.h"
+
+// Wake sources for the radio and display tasks. Instead of spinning, each task
+// blocks until one of the events it subscribed to is raised. Deadlines arrive
+// as events too, raised by the timer wheel when one of the task's timers fires.
+#define EVENT_LORA_IRQ (1 << 0)  // DIO0: packet received or transmission finished
+#define EVENT_LORA_QUEUED (1 << 1)  // A packet was queued for transmission
+#define EVENT_DATA_CHANGED (1 << 2)  // Another task updated data
+#define EVENT_RADIO_TIMER (1 << 3)  // A LoRaSync deadline passed
+#define EVENT_DISPLAY_TIMER (1 << 4)  // A Display deadline passed
+
+#define EVENT_IDLE_TIMEOUT 5000  // Longest wait, in case a wake-up gets lost
+#define EVENT_MAX_SUBSCRIBERS 4
+
+// Light sleep between events needs power management and tickless idle in the SDK configuration
+#if defined(ENABLE_EVENT_LOOP) && defined(CONFIG_PM_ENABLE) && defined(CONFIG_FREERTOS_USE_TICKLESS_IDLE)
+#define EVENTS_LIGHT_SLEEP
+#endif
+
+#if defined(ENABLE_EVENT_LOOP)
+namespace Events {
+  void setup();
+  // Registers the calling task for the given events
+  bool subscribe(uint32_t events);
+
+  void notify(uint32_t events);
+  void notifyFromIsr(uint32_t events);
+
+  // Blocks the calling task until one of its events arrives or timeoutMillis
+  // passes. Returns right away while events are still pending.
+  void wait(unsigned long timeoutMillis);
+  // Returns true and clears the events if any of them are pending for the calling task
+  bool take(uint32_t events);
+};
+#else
+// Without events, every task polls once per tick
+namespace Events {
+  inline void setup() {};
+  inline bool subscribe(uint32_t events) { return true; };
+
+  inline void notify(uint32_t events) {};
+  inline void notifyFromIsr(uint32_t events) {};
+
+  inline void wait(unsigned long timeoutMillis) { vTaskDelay(1); };
+  inline bool take(uint32_t events) { return true; };
+};
+#endif
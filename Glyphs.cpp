@@ -0,0 +1,155 @@
+#include "Display.h"
+#include "Glyphs.h"
+
+#if defined(DISPLAY_TYPE_TFT)
+GlyphCache::GlyphCache(TFT_eSPI* tft, uint8_t font, uint8_t size) {
+  _tft = tft;
+  _font = font;
+  _size = size;
+  _height = 0;
+  memset(_widths, 0, sizeof(_widths));
+  memset(_offsets, 0, sizeof(_offsets));
+  _runs = NULL;
+  _built = false;
+}
+
+GlyphCache::~GlyphCache() {
+  free(_runs);
+}
+
+// The rows of an 8-bit glyph as runs, only counting the bytes when runs is NULL
+static uint32_t encodeRows(const uint8_t* pixels, int32_t pitch, int32_t w, int32_t h, uint8_t* runs) {
+  uint32_t bytes = 0;
+
+  for (int32_t row = 0; row < h; row++) {
+    const uint8_t* line = &pixels[row * pitch];
+    uint32_t countAt = bytes++;
+    uint8_t count = 0;
+    for (int32_t column = 0; column < w;) {
+      if (line[column] == 0) {
+        column++;
+        continue;
+      }
+      int32_t start = column;
+      while ((column < w) &&
+             (line[column] != 0)) {
+        column++;
+      }
+      if (runs != NULL) {
+        runs[bytes] = start;
+        runs[bytes + 1] = column - start;
+      }
+      bytes += 2;
+      count++;
+    }
+    if (runs != NULL) {
+      runs[countAt] = count;
+    }
+  }
+
+  return bytes;
+}
+
+// Draws every character once into an 8-bit sprite and keeps its runs
+bool GlyphCache::_build() {
+  _built = true;
+
+  _tft->setTextSize(_size);
+  _height = _tft->fontHeight(_font);
+  int32_t maxWidth = 0;
+  for (uint i = 0; i < GLYPH_COUNT; i++) {
+    char text[2] = { GLYPH_CHARACTERS[i], '\0' };
+    int32_t width = _tft->textWidth(text, _font);
+    if (width > GLYPH_MAX_WIDTH) {
+      return false;
+    }
+    _widths[i] = width;
+    maxWidth = max(maxWidth, width);
+  }
+  if ((maxWidth == 0) ||
+      (_height == 0)) {
+    return false;
+  }
+
+  TFT_eSprite* sprite = new TFT_eSprite(_tft);
+  sprite->setColorDepth(8);
+  if (sprite->createSprite(maxWidth, _height) == NULL) {
+    delete sprite;
+    return false;
+  }
+  sprite->setTextSize(_size);
+  sprite->setTextColor(TFT_WHITE, TFT_BLACK);
+
+  uint32_t total = 0;
+  bool built = true;
+  for (uint i = 0; i < GLYPH_COUNT; i++) {
+    sprite->fillSprite(TFT_BLACK);
+    sprite->drawChar(GLYPH_CHARACTERS[i], 0, 0, _font);
+    const uint8_t* pixels = (const uint8_t*) sprite->getPointer();
+    uint32_t bytes = encodeRows(pixels, maxWidth, _widths[i], _height, NULL);
+    uint8_t* runs = (uint8_t*) realloc(_runs, total + bytes);
+    if ((runs == NULL) ||
+        (total > UINT16_MAX)) {
+      built = false;
+      break;
+    }
+    _runs = runs;
+    _offsets[i] = total;
+    encodeRows(pixels, maxWidth, _widths[i], _height, &_runs[total]);
+    total += bytes;
+  }
+
+  sprite->deleteSprite();
+  delete sprite;
+  if (!built) {
+    free(_runs);
+    _runs = NULL;
+  }
+  return built;
+}
+
+int GlyphCache::_glyph(char c) {
+  const char* found = (c != '\0') ? strchr(GLYPH_CHARACTERS, c) : NULL;
+  return (found != NULL) ? (found - GLYPH_CHARACTERS) : -1;
+}
+
+int32_t GlyphCache::width(const char* text) {
+  if (!_built) {
+    _build();
+  }
+  if (_runs == NULL) {
+    return -1;
+  }
+
+  int32_t width = 0;
+  for (const char* c = text; *c != '\0'; c++) {
+    int glyph = _glyph(*c);
+    if (glyph < 0) {
+      return -1;
+    }
+    width += _widths[glyph];
+  }
+  return width;
+}
+
+int32_t GlyphCache::width(char c) {
+  int glyph = _glyph(c);
+  return (glyph >= 0) ? _widths[glyph] : 0;
+}
+
+void GlyphCache::draw(TFT_eSPI* target, char c, int32_t x, int32_t y, uint32_t color) {
+  int glyph = _glyph(c);
+  if ((glyph < 0) ||
+      (_runs == NULL)) {
+    return;
+  }
+
+  const uint8_t* runs = &_runs[_offsets[glyph]];
+  for (int32_t row = 0; row < _height; row++) {
+    for (uint8_t count = *runs++; count > 0; count--) {
+      target->drawFastHLine(x + runs[0], y + row, runs[1], color);
+      runs += 2;
+    }
+  }
+}
+#endif
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <Arduino.h>
+#include <TFT_eSPI.h>
+
+// The characters of one font and text size, rendered once and kept as the runs
+// of ink on every row, which for the 7-segment Font 7 is at most a few per row.
+// A glyph is then drawn into its cell with horizontal lines in any colour, so
+// a changed digit only needs its own cell and never the rest of the text.
+//
+// Every row is a count followed by that many (start, length) pairs.
+#define GLYPH_CHARACTERS " -.0123456789:"
+#define GLYPH_COUNT (sizeof(GLYPH_CHARACTERS) - 1)
+#define GLYPH_MAX_WIDTH 255  // Run starts and lengths are a byte each
+
+class GlyphCache {
+  private:
+    TFT_eSPI* _tft;
+    uint8_t _font;
+    uint8_t _size;
+    int32_t _height;
+    uint8_t _widths[GLYPH_COUNT];
+    uint16_t _offsets[GLYPH_COUNT];  // Of the first row in _runs
+    uint8_t* _runs;
+    bool _built;
+
+    bool _build();
+    int _glyph(char c);
+
+  public:
+    GlyphCache(TFT_eSPI* tft, uint8_t font, uint8_t size);
+    ~GlyphCache();
+
+    uint8_t font() { return _font; }
+    uint8_t size() { return _size; }
+    int32_t height() { return _height; }
+    // Of the whole text, -1 when a character is not cached
+    int32_t width(const char* text);
+    // Of one cached character
+    int32_t width(char c);
+    // Into a cell already cleared to the background, with its top left corner at x, y
+    void draw(TFT_eSPI* target, char c, int32_t x, int32_t y, uint32_t color);
+};
@@ -0,0 +1,102 @@
+#include "HttpsPool.h"
+#include "Metrics.h"
+
+struct httpsConnection_struct {
+  char host[HTTPS_HOST_LENGTH];  // Empty when the slot is free
+  WiFiClientSecure client;
+  HTTPClient https;
+  unsigned long lastUsed;
+};
+
+static struct httpsConnection_struct connections[HTTPS_POOL_SIZE];
+
+// Copies the host[:port] of an http(s)://host[:port]/path URL
+static bool hostOf(const char* url, char* host) {
+  const char* start = strstr(url, "://");
+  if (start == NULL) {
+    return false;
+  }
+  start += 3;
+  size_t length = strcspn(start, "/?");
+  if ((length == 0) ||
+      (length >= HTTPS_HOST_LENGTH)) {
+    return false;
+  }
+  memcpy(host, start, length);
+  host[length] = '\0';
+  return true;
+}
+
+static void closeConnection(struct httpsConnection_struct* connection) {
+  connection->client.stop();  // Frees the mbedTLS buffers
+  connection->host[0] = '\0';
+}
+
+namespace HttpsPool {
+  HTTPClient* begin(const char* url) {
+    char host[HTTPS_HOST_LENGTH];
+    if (!hostOf(url, host)) {
+      return NULL;
+    }
+    closeIdle();
+
+    struct httpsConnection_struct* connection = NULL;
+    for (uint i = 0; (connection == NULL) && (i < HTTPS_POOL_SIZE); i++) {
+      if (strcmp(connections[i].host, host) == 0) {
+        connection = &connections[i];
+      }
+    }
+    if (connection == NULL) {
+      // A free slot, else the least recently used
+      unsigned long now = millis();
+      connection = &connections[0];
+      for (uint i = 1; i < HTTPS_POOL_SIZE; i++) {
+        if ((connection->host[0] != '\0') &&
+            ((connections[i].host[0] == '\0') ||
+             ((now - connections[i].lastUsed) > (now - connection->lastUsed)))) {
+          connection = &connections[i];
+        }
+      }
+      closeConnection(connection);
+      connection->client.setInsecure();
+      strcpy(connection->host, host);
+    }
+
+    if (connection->client.connected()) {
+      Metrics::increment(METRIC_HTTPS_REUSED);
+    } else {
+      Metrics::increment(METRIC_HTTPS_CONNECTS);  // HTTPClient connects when the request is sent
+    }
+    connection->lastUsed = millis();
+    connection->https.setReuse(true);
+    if (!connection->https.begin(connection->client, url)) {
+      closeConnection(connection);
+      return NULL;
+    }
+    return &connection->https;
+  }
+
+  void end(HTTPClient* https, bool close) {
+    https->end();  // Leaves the connection open when the response allows keep-alive
+    for (uint i = 0; i < HTTPS_POOL_SIZE; i++) {
+      if (&connections[i].https == https) {
+        if (close ||
+            !connections[i].client.connected()) {
+          closeConnection(&connections[i]);
+        } else {
+          connections[i].lastUsed = millis();
+        }
+      }
+    }
+  }
+
+  void closeIdle() {
+    unsigned long now = millis();
+    for (uint i = 0; i < HTTPS_POOL_SIZE; i++) {
+      if ((connections[i].host[0] != '\0') &&
+          ((now - connections[i].lastUsed) > HTTPS_IDLE_TIMEOUT)) {
+        closeConnection(&connections[i]);
+      }
+    }
+  }
+};
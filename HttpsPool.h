@@ -0,0 +1,23 @@
+#pragma once
+
+#include <Arduino.h>
+#include <HTTPClient.h>
+#include <WiFiClientSecure.h>
+
+// Keeps the TLS connection to an API host open between requests, so a poll of
+// a host used recently goes out over HTTP/1.1 keep-alive instead of paying the
+// TCP and TLS handshakes again. Those take several hundred milliseconds and
+// tens of KB of heap for mbedTLS every time. Only the HTTPS task uses it.
+#define HTTPS_POOL_SIZE 2  // Open connections, the least recently used is closed for a new host
+#define HTTPS_IDLE_TIMEOUT 120000  // ms, servers drop idle connections by then anyway, so the heap is freed
+#define HTTPS_HOST_LENGTH 64
+
+namespace HttpsPool {
+  // An HTTPClient begun on url, over the open connection to its host when there
+  // is one. Headers are added after this. NULL if the URL has no usable host.
+  HTTPClient* begin(const char* url);
+  // Once the response was read. The connection stays open for the next request
+  // to the same host unless the server asked to close it or close is set.
+  void end(HTTPClient* https, bool close = false);
+  void closeIdle();
+};
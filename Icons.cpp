@@ -0,0 +1,65 @@
+#include "Display.h"
+#include "Icons.h"
+
+#if defined(DISPLAY_TYPE_TFT)
+// TFT_eSPI::pushImage() is not virtual, so the target's own type picks where the lines go
+template <typename Target>
+static uint32_t pushIcon(Target* tft, int32_t x, int32_t y, const struct iconAsset_struct* icon, bool skipBackground, uint32_t* windows) {
+  uint16_t line[ICON_MAX_WIDTH];
+  uint runBits = 8 - icon->indexBits;
+  uint8_t lengthMask = (1 << runBits) - 1;
+  const uint8_t* runs = icon->runs;
+  uint32_t pixels = 0;
+  *windows = 0;
+  if (icon->width > ICON_MAX_WIDTH) {
+    return 0;  // The generated assets assert this, but the line buffer must never overflow
+  }
+
+  for (int32_t row = 0; row < icon->height; row++) {
+    int32_t column = 0;
+    int32_t spanStart = -1;  // First pixel of the span not pushed yet
+    while (column < icon->width) {
+      uint8_t run = pgm_read_byte(runs++);
+      uint index = run >> runBits;
+      int32_t length = min((int32_t) (run & lengthMask) + 1, (int32_t) icon->width - column);
+
+      if (skipBackground &&
+          (index == 0)) {
+        if (spanStart >= 0) {
+          tft->pushImage(x + spanStart, y + row, column - spanStart, 1, &line[spanStart]);
+          pixels += column - spanStart;
+          (*windows)++;
+          spanStart = -1;
+        }
+      } else {
+        uint16_t color = pgm_read_word(&icon->palette[index]);
+        for (int32_t i = 0; i < length; i++) {
+          line[column + i] = color;
+        }
+        if (spanStart < 0) {
+          spanStart = column;
+        }
+      }
+      column += length;
+    }
+
+    if (spanStart >= 0) {
+      tft->pushImage(x + spanStart, y + row, column - spanStart, 1, &line[spanStart]);
+      pixels += column - spanStart;
+      (*windows)++;
+    }
+  }
+
+  return pixels;
+}
+
+namespace Icons {
+  uint32_t push(TFT_eSPI* tft, int32_t x, int32_t y, const struct iconAsset_struct* icon, bool skipBackground, uint32_t* windows) {
+    return pushIcon(tft, x, y, icon, skipBackground, windows);
+  }
+
+  uint32_t push(TFT_eSprite* sprite, int32_t x, int32_t y, const struct iconAsset_struct* icon, bool skipBackground, uint32_t* windows) {
+    return pushIcon(sprite, x, y, icon, skipBackground, windows);
+  }
+};
+#endif
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Icons are palette + run-length encoded by tools/icon2asset.py and stay in
+// flash. Every byte is a run, with the palette index in the top indexBits bits
+// and the length minus one in the rest. Runs never cross a row.
+struct iconAsset_struct {
+  uint16_t width;
+  uint16_t height;
+  uint8_t indexBits;
+  const uint16_t* palette;  // Byte swapped RGB565, [0] is the background
+  const uint8_t* runs;
+};
+
+#define ICON_MAX_WIDTH 128  // Of the line buffer
+
+class TFT_eSPI;
+class TFT_eSprite;
+
+namespace Icons {
+  // Decodes one line at a time into a line buffer and pushes it. With
+  // skipBackground, background runs are left alone, so only the spans in
+  // between go out over SPI. Returns the pixels pushed, and the spans in windows.
+  uint32_t push(TFT_eSPI* tft, int32_t x, int32_t y, const struct iconAsset_struct* icon, bool skipBackground, uint32_t* windows);
+  // The same into an off-screen sprite, which a TFT_eSPI* would bypass for the panel
+  uint32_t push(TFT_eSprite* sprite, int32_t x, int32_t y, const struct iconAsset_struct* icon, bool skipBackground, uint32_t* windows);
+};
@@ -0,0 +1,135 @@
+#include "LatencyTrace.h"
+
+#if defined(ENABLE_LATENCY_TRACE)
+#include <atomic>
+#include "Metrics.h"
+
+#define LATENCY_STAGE_NAME(id, name) name,
+static const char* const stageNames[] = { LATENCY_STAGES(LATENCY_STAGE_NAME) };
+#undef LATENCY_STAGE_NAME
+
+#define RENDER_NONE 0
+#define RENDER_LOCAL 1
+#define RENDER_REMOTE 2
+
+static MetricsHistogram stageHistograms[LATENCY_STAGE_COUNT];
+
+// Timestamps in micros() of the reading currently in flight. The HTTPS task
+// writes the first two, so everything is atomic.
+static std::atomic<uint32_t> apiStartedAt(0);
+static std::atomic<uint32_t> apiDoneAt(0);
+static std::atomic<uint32_t> publishedAt(0);
+static std::atomic<uint32_t> queuedAt(0);
+static std::atomic<uint32_t> transmitStartedAt(0);
+static std::atomic<uint32_t> receiveStartedAt(0);
+static std::atomic<uint32_t> receiveDoneAt(0);
+static std::atomic<uint32_t> remoteMicros(0);  // Sender pipeline plus time on air
+static std::atomic<bool> sendPending(false);
+static std::atomic<bool> transmitPending(false);
+static std::atomic<uint8_t> renderPending(RENDER_NONE);
+
+namespace LatencyTrace {
+  void apiStarted() {
+    apiStartedAt.store(micros());
+  }
+
+  void apiDone() {
+    uint32_t now = micros();
+    apiDoneAt.store(now);
+    stageHistograms[LATENCY_API].record(now - apiStartedAt.load());
+  }
+
+  void published() {
+    uint32_t now = micros();
+    publishedAt.store(now);
+    stageHistograms[LATENCY_PUBLISH].record(now - apiDoneAt.load());
+    sendPending.store(true);
+    renderPending.store(RENDER_LOCAL);
+  }
+
+  void queued() {
+    if (!sendPending.exchange(false)) {
+      return;
+    }
+
+    uint32_t now = micros();
+    queuedAt.store(now);
+    stageHistograms[LATENCY_SEND].record(now - publishedAt.load());
+    transmitPending.store(true);
+  }
+
+  void transmitStarted() {
+    if (!transmitPending.load()) {
+      return;
+    }
+
+    uint32_t now = micros();
+    transmitStartedAt.store(now);
+    stageHistograms[LATENCY_QUEUE].record(now - queuedAt.load());
+  }
+
+  // Time since the reading was parsed, or LATENCY_UNKNOWN_MILLIS for a repeated reading
+  uint16_t senderMillis() {
+    if (!transmitPending.load()) {
+      return LATENCY_UNKNOWN_MILLIS;
+    }
+
+    uint32_t elapsedMillis = (micros() - apiDoneAt.load()) / 1000;
+
+    return (elapsedMillis >= LATENCY_UNKNOWN_MILLIS ? LATENCY_UNKNOWN_MILLIS - 1 : elapsedMillis);
+  }
+
+  void transmitDone() {
+    if (!transmitPending.exchange(false)) {
+      return;
+    }
+
+    stageHistograms[LATENCY_AIR].record(micros() - transmitStartedAt.load());
+  }
+
+  void receiveStarted() {
+    receiveStartedAt.store(micros());
+  }
+
+  void receiveDone(uint16_t senderMillis, uint32_t timeOnAirMicros) {
+    if (senderMillis == LATENCY_UNKNOWN_MILLIS) {
+      return;
+    }
+
+    uint32_t now = micros();
+    receiveDoneAt.store(now);
+    stageHistograms[LATENCY_AIR].record(timeOnAirMicros);
+    stageHistograms[LATENCY_RECEIVE].record(now - receiveStartedAt.load());
+    remoteMicros.store(((uint32_t) senderMillis * 1000) + timeOnAirMicros);
+    renderPending.store(RENDER_REMOTE);
+  }
+
+  void rendered() {
+    uint32_t now = micros();
+    switch (renderPending.exchange(RENDER_NONE)) {
+      case RENDER_LOCAL:
+        stageHistograms[LATENCY_RENDER].record(now - publishedAt.load());
+        stageHistograms[LATENCY_END_TO_END_LOCAL].record(now - apiDoneAt.load());
+        break;
+
+      case RENDER_REMOTE:
+        stageHistograms[LATENCY_RENDER].record(now - receiveDoneAt.load());
+        stageHistograms[LATENCY_END_TO_END_REMOTE].record(remoteMicros.load() + (now - receiveStartedAt.load()));
+        break;
+    }
+  }
+
+  void report(Print* out) {
+    out->println("--- CGM latency (us) ---");
+    for (uint i = 0; i < LATENCY_STAGE_COUNT; i++) {
+      MetricsHistogram* histogram = &stageHistograms[i];
+      out->printf("%-18s count=%u p50=%u p99=%u max=%u\n",
+                  stageNames[i],
+                  histogram->count(),
+                  histogram->percentile(50),
+                  histogram->percentile(99),
+                  histogram->max());
+    }
+  }
+}
+#endif
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <Arduino.h>
+#include "lora-cgm-sender.ino.globals.h"
+
+// Follows each new CGM reading from the API response to the rendered digits.
+// Senders carry the time spent before transmission in the channel message, so a
+// receiver can report the full end-to-end latency without synchronized clocks.
+#define LATENCY_STAGES(X) \
+  X(LATENCY_API, "api") /* callApi request started -> reading parsed */ \
+  X(LATENCY_PUBLISH, "publish") /* reading parsed -> CGM channel published */ \
+  X(LATENCY_SEND, "send") /* CGM channel published -> _sendChannels queued the packet */ \
+  X(LATENCY_QUEUE, "queue") /* packet queued -> transmission started */ \
+  X(LATENCY_AIR, "air") /* transmission started -> finished (time on air on receivers) */ \
+  X(LATENCY_RECEIVE, "receive") /* packet detected -> CGM channel published */ \
+  X(LATENCY_RENDER, "render") /* CGM channel published -> _displayCgmData finished */ \
+  X(LATENCY_END_TO_END_LOCAL, "end_to_end.local") /* reading parsed -> rendered on the collector */ \
+  X(LATENCY_END_TO_END_REMOTE, "end_to_end.remote") /* reading parsed -> rendered on a receiver */
+
+#define LATENCY_UNKNOWN_MILLIS 0xFFFF
+
+#define LATENCY_STAGE_ENUM(id, name) id,
+enum latencyStage_enum : uint8_t { LATENCY_STAGES(LATENCY_STAGE_ENUM) LATENCY_STAGE_COUNT };
+#undef LATENCY_STAGE_ENUM
+
+#if defined(ENABLE_LATENCY_TRACE)
+namespace LatencyTrace {
+  void apiStarted();
+  void apiDone();
+  void published();
+  void queued();
+  void transmitStarted();
+  void transmitDone();
+  uint16_t senderMillis();
+  void receiveStarted();
+  void receiveDone(uint16_t senderMillis, uint32_t timeOnAirMicros);
+  void rendered();
+
+  void report(Print* out);
+};
+#else
+namespace LatencyTrace {
+  inline void apiStarted() {};
+  inline void apiDone() {};
+  inline void published() {};
+  inline void queued() {};
+  inline void transmitStarted() {};
+  inline void transmitDone() {};
+  inline uint16_t senderMillis() { return LATENCY_UNKNOWN_MILLIS; };
+  inline void receiveStarted() {};
+  inline void receiveDone(uint16_t senderMillis, uint32_t timeOnAirMicros) {};
+  inline void rendered() {};
+};
+#endif
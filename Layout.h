@@ -0,0 +1,119 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Where every widget sits on each panel, worked out by the compiler. Display.h
+// picks the LAYOUT of the panel it was built for, and the drawing code only
+// ever reads boxes from it, so a new panel is one more layout here.
+struct layoutBox_struct {
+  int16_t x;
+  int16_t y;
+  int16_t w;
+  int16_t h;
+  uint8_t font;  // Of text widgets, which are right justified against x + w
+  uint8_t fontSize;
+};
+
+struct layout_struct {
+  int16_t width;
+  int16_t height;
+  struct layoutBox_struct cgm;
+  struct layoutBox_struct clock;
+  struct layoutBox_struct trendArrow;
+  struct layoutBox_struct trendText;  // Empty when not shown
+  struct layoutBox_struct graph;
+  struct layoutBox_struct propaneIcon;
+  struct layoutBox_struct propane;
+  struct layoutBox_struct temperatureIcon;
+  struct layoutBox_struct temperature;
+};
+
+#define LAYOUT_FONT_NUMBER 7  // 7-segment digits
+#define LAYOUT_FONT_TEXT 4
+
+// Line heights of the TFT_eSPI fonts at text size 1
+constexpr int16_t layoutFontHeight(uint8_t font) {
+  return (font == 2) ? 16 : (font == 4) ? 26 : (font == 6) ? 48 : (font == 7) ? 48 : (font == 8) ? 75 : 8;
+}
+
+constexpr struct layoutBox_struct layoutBox(int16_t x, int16_t y, int16_t w, int16_t h) {
+  return { x, y, w, h, 0, 0 };
+}
+
+// Text ending at right, padded to width
+constexpr struct layoutBox_struct layoutText(int16_t right, int16_t y, int16_t width, uint8_t font, uint8_t fontSize) {
+  return { (int16_t) (right - width), y, width, (int16_t) (layoutFontHeight(font) * fontSize), font, fontSize };
+}
+
+constexpr struct layoutBox_struct LAYOUT_NONE = { 0, 0, 0, 0, 0, 0 };
+
+constexpr bool layoutFits(const struct layout_struct& layout, const struct layoutBox_struct& box) {
+  return (box.x >= 0) && (box.y >= 0) && (box.x + box.w <= layout.width) && (box.y + box.h <= layout.height);
+}
+
+constexpr bool layoutValid(const struct layout_struct& layout) {
+  return layoutFits(layout, layout.cgm) && layoutFits(layout, layout.clock) && layoutFits(layout, layout.trendArrow) &&
+         layoutFits(layout, layout.trendText) && layoutFits(layout, layout.graph) &&
+         layoutFits(layout, layout.propaneIcon) && layoutFits(layout, layout.propane) &&
+         layoutFits(layout, layout.temperatureIcon) && layoutFits(layout, layout.temperature);
+}
+
+constexpr int16_t layoutMax(int16_t a, int16_t b) {
+  return (a > b) ? a : b;
+}
+
+// The largest box a widget composes off-screen, which sizes the renderer's
+// sprites. The graph and the icons go straight to the panel.
+constexpr int16_t layoutSpriteWidth(const struct layout_struct& layout) {
+  return layoutMax(layoutMax(layoutMax(layout.cgm.w, layout.clock.w), layoutMax(layout.trendArrow.w, layout.trendText.w)),
+                   layoutMax(layout.propane.w, layout.temperature.w));
+}
+
+constexpr int16_t layoutSpriteHeight(const struct layout_struct& layout) {
+  return layoutMax(layoutMax(layoutMax(layout.cgm.h, layout.clock.h), layoutMax(layout.trendArrow.h, layout.trendText.h)),
+                   layoutMax(layout.propane.h, layout.temperature.h));
+}
+
+// CGM graph in the lower right corner of the ILI9488 layout. It sweeps left to
+// right and wraps like a monitor trace, so a new reading only redraws its own
+// column and blanks one ahead of the gap, instead of scrolling the whole chart.
+#define GRAPH_WIDTH 288
+
+constexpr struct layout_struct LAYOUT_ST7735_128_160 = {
+  160, 128,
+  layoutText(150, 13, 108, LAYOUT_FONT_NUMBER, 1),  // cgm
+  layoutText(150, 69, 138, LAYOUT_FONT_NUMBER, 1),  // clock
+  layoutBox(10, 20, 28, 28),  // trendArrow
+  LAYOUT_NONE,  // trendText
+  LAYOUT_NONE,  // graph
+  LAYOUT_NONE,  // propaneIcon
+  LAYOUT_NONE,  // propane
+  LAYOUT_NONE,  // temperatureIcon
+  LAYOUT_NONE  // temperature
+};
+
+constexpr struct layout_struct LAYOUT_ILI9488_480_320 = {
+  480, 320,
+  layoutText(462, 9, 288, LAYOUT_FONT_NUMBER, 3),  // cgm
+  layoutText(462, 176, 288, LAYOUT_FONT_NUMBER, 2),  // clock, leaving the lower left corner to the trend
+  layoutBox(48, 168, 80, 80),  // trendArrow
+  layoutText(168, 260, 144, LAYOUT_FONT_TEXT, 1),  // trendText
+  layoutBox(176, 278, GRAPH_WIDTH, 34),  // graph
+  layoutBox(20, 11, 64, 64),  // propaneIcon
+  layoutText(160, 20, 32, LAYOUT_FONT_NUMBER, 1),  // propane
+  layoutBox(19, 80, 64, 64),  // temperatureIcon
+  layoutText(160, 89, 96, LAYOUT_FONT_NUMBER, 1)  // temperature
+};
+
+// The 0.42" OLED shows the reading over the clock. Its text is drawn with u8g2
+// fonts from the top of each box, so the boxes carry no TFT font.
+constexpr struct layout_struct LAYOUT_LCD_042 = {
+  72, 40,
+  layoutBox(0, 0, 72, 24),  // cgm
+  layoutBox(0, 26, 72, 14),  // clock
+  LAYOUT_NONE, LAYOUT_NONE, LAYOUT_NONE, LAYOUT_NONE, LAYOUT_NONE, LAYOUT_NONE, LAYOUT_NONE
+};
+
+static_assert(layoutValid(LAYOUT_ST7735_128_160), "An ST7735 widget is off the panel");
+static_assert(layoutValid(LAYOUT_ILI9488_480_320), "An ILI9488 widget is off the panel");
+static_assert(layoutValid(LAYOUT_LCD_042), "An LCD widget is off the panel");
@@ -3,12 +3,29 @@
 #include <ChaCha.h>
 #include "data.h"
 #include "LoRaSync.h"
+#include "Log.h"
+#include "Metrics.h"
+#include "Profiler.h"
+#include "LatencyTrace.h"
+#include "Events.h"
 
 #include "lora-cgm-sender.ino.globals.h"
 #if defined(ENABLE_SYNC)
-#include <cppQueue.h>
+#include "LockFreeQueue.h"
 #endif
 
+#define LORA_FREQUENCY 912900000
+#define LORA_SPREADING_FACTOR 10
+#define LORA_SIGNAL_BANDWIDTH 125000
+#define LORA_CODING_RATE_4 5
+#define LORA_PREAMBLE_LENGTH 8
+#define LORA_DIO0_PIN 4
+#define LORA_TRANSMIT_GAP 1000  // Quiet time after each transmission
+#define TELEMETRY_INTERVAL 900000  // Once every fifteen minutes
+#define ALERT_RETRY_INTERVAL 3000  // Longer than the slots of all acknowledgements
+#define ALERT_MAX_RETRIES 5
+#define ALERT_ACK_SLOT 400  // Per deviceMapping entry, so that acknowledgements do not collide
+
 struct deviceMapping_struct {
   const char* macAddress;
   uint16_t deviceId;
@@ -31,15 +48,34 @@ struct bootSync_struct {
 };
 
 #define LORA_QUEUE_ENTRIES 8
+#define LORA_ALERT_QUEUE_ENTRIES 4
 struct loRaQueueEntry_struct {
   uint16_t messageType;
   byte data[255];
   uint dataLength;
   bool randomizeTiming;
+  uint16_t delayMillis;  // Fixed delay before a priority packet
 };
-cppQueue loRaQueue(sizeof(loRaQueueEntry_struct), LORA_QUEUE_ENTRIES, FIFO);
+// Any task may queue packets, only the radio task sends them. Alerts and their
+// acknowledgements go through their own queue, which is always served first.
+LockFreeQueue<loRaQueueEntry_struct, LORA_QUEUE_ENTRIES> loRaQueue;
+LockFreeQueue<loRaQueueEntry_struct, LORA_ALERT_QUEUE_ENTRIES> loRaAlertQueue;
 #endif
 
+// Alert message (type 33), repeated until every display acknowledged it with type 34
+struct alertMessage_struct {
+  uint16_t alertId;
+  uint16_t senderMillis;  // Since the alert was raised, filled in when the transmission starts
+  uint16_t mgPerDl;  // Encoded like CHANNEL_MG_PER_DL
+  uint16_t age;  // Seconds, of the reading
+  uint8_t level;
+  uint8_t minutes;
+};
+
+struct alertAck_struct {
+  uint16_t alertId;
+};
+
 struct clockInfo_struct {
   time_t time;
   time_t dstBegin;
@@ -48,8 +84,17 @@ struct clockInfo_struct {
   int32_t daylightTimezoneOffset;
 };
 
+// Channel message (type 32): this header followed by the wire ID, encoded value
+// and 16-bit age in seconds of every channel in the message. The age lets
+// receivers keep judging staleness without synchronized clocks. Types 29 to 31
+// are still decoded for nodes running older firmware.
+struct channelMessageHeader_struct {
+  uint16_t senderMillis;  // Age of the CGM reading at transmission, LATENCY_UNKNOWN_MILLIS if not traced
+};
+
 struct cgm_struct {
   uint16_t mgPerDl;
+  uint16_t senderMillis;  // Reading age at transmission (fills what used to be padding)
   time_t time;
 };
 
@@ -63,12 +108,55 @@ struct temperature_struct {
 
 LoRaCrypto* loRaCrypto;
 
-LoRaSync::LoRaSync(uint16_t appId, struct semver_struct* version, volatile struct data_struct* data, SPIClass* spi) {
+#define DEVICE_MAPPING_COUNT (sizeof(deviceMapping) / sizeof(struct deviceMapping_struct))
+
+// Index into deviceMapping, DEVICE_MAPPING_COUNT for an unknown device
+static uint deviceIndex(uint16_t deviceId) {
+  uint i;
+  for (i = 0; i < DEVICE_MAPPING_COUNT; i++) {
+    if (deviceMapping[i].deviceId == deviceId) {
+      break;
+    }
+  }
+
+  return i;
+}
+
+#if defined(ENABLE_EVENT_LOOP) && defined(ENABLE_SYNC_RECEIVER)
+static void IRAM_ATTR loRaInterrupt() {
+  Events::notifyFromIsr(EVENT_LORA_IRQ);
+}
+#endif
+
+// Time on air in microseconds for an explicit-header packet with CRC (Semtech AN1200.13)
+static uint32_t timeOnAir(uint payloadLength) {
+  uint32_t symbolTime = ((uint32_t) 1000000 << LORA_SPREADING_FACTOR) / LORA_SIGNAL_BANDWIDTH;
+  int lowDataRateOptimize = (symbolTime > 16000 ? 1 : 0);
+  int numerator = (8 * payloadLength) - (4 * LORA_SPREADING_FACTOR) + 28 + 16;
+  int denominator = 4 * (LORA_SPREADING_FACTOR - (2 * lowDataRateOptimize));
+  int payloadSymbols = 8;
+  if (numerator > 0) {
+    payloadSymbols += ((numerator + denominator - 1) / denominator) * LORA_CODING_RATE_4;
+  }
+
+  return ((((LORA_PREAMBLE_LENGTH * 4) + 17) * symbolTime) / 4) + (payloadSymbols * symbolTime);
+}
+
+LoRaSync::LoRaSync(uint16_t appId, struct semver_struct* version, struct data_struct* data, SPIClass* spi) :
+    _heartbeatTimer(EVENT_RADIO_TIMER),
+    _telemetryTimer(EVENT_RADIO_TIMER),
+    _processPacketTimer(EVENT_RADIO_TIMER),
+    _alertTimer(EVENT_RADIO_TIMER) {
   _appId = appId;
   _version = *version;
   _data = data;
-  _oldData = (struct data_struct*) malloc(sizeof(struct data_struct));
-  memcpy(_oldData, (const void*) _data, sizeof(struct data_struct));
+  _changes = 0;
+  uint64_t now = Clock::nowMillis();
+  for (uint i = 0; i < CHANNEL_COUNT; i++) {
+    _lastHeartbeat[i] = now;
+  }
+  _scheduleHeartbeats();
+  _telemetryTimer.start(TELEMETRY_INTERVAL);
 
   _spi = spi;
   _loRa = new LoRaClass();
@@ -78,12 +166,15 @@ LoRaSync::LoRaSync(uint16_t appId, struct semver_struct* version, volatile struc
   Serial.println(seed);
   randomSeed(seed);  // Open pin on the back of the board
   _processPacketState = 0x00;
+  _sendingPriority = false;
+  _alertId = 0;
+  _alertReceivers = 0;
+  _alertPendingAcks = 0;
+  _alertRetries = 0;
 }
 
 LoRaSync::~LoRaSync() {
   delete _loRa;
-
-  free(_oldData);
 }
 
 void LoRaSync::setup() {
@@ -93,10 +184,10 @@ void LoRaSync::setup() {
   // _loRa->setPins(7, 9, 18);  // ESP32 C3 dev board
   // _loRa->setPins(8, 9, 10);  // Pico
   // _loRa->setPins(8, 4, 3);  // Feather M0 LoRa
-  _loRa->setPins(8, 9, 4);  // ESP32-Zero-RFM95W (S3)
+  _loRa->setPins(8, 9, LORA_DIO0_PIN);  // ESP32-Zero-RFM95W (S3)
   pinMode(8, OUTPUT);
   pinMode(9, OUTPUT);
-  pinMode(4, INPUT);
+  pinMode(LORA_DIO0_PIN, INPUT);
 
   uint8_t baseMac[6];
   char macAddress[20];
@@ -121,9 +212,8 @@ void LoRaSync::setup() {
   Serial.print("MAC address = ");
   Serial.println(macAddress);
 
-  uint deviceMappingCount = sizeof(deviceMapping) / sizeof(struct deviceMapping_struct);
   uint i;
-  for (i = 0; i < deviceMappingCount; i++) {
+  for (i = 0; i < DEVICE_MAPPING_COUNT; i++) {
     if (strcmp(macAddress, deviceMapping[i].macAddress) == 0) {
       _deviceId = deviceMapping[i].deviceId;
       Serial.print("Device ID = ");
@@ -132,11 +222,12 @@ void LoRaSync::setup() {
     }
   }
 
-  if (i == deviceMappingCount) {
+  if (i == DEVICE_MAPPING_COUNT) {
     Serial.println("There is no matching device!!! Using device ID 0");
   }
+  _alertReceivers = ((1 << DEVICE_MAPPING_COUNT) - 1) & ~(1 << i);
 
-  if (!_loRa->begin(912900000)) {
+  if (!_loRa->begin(LORA_FREQUENCY)) {
     Serial.println("Starting LoRa failed! Waiting 60 seconds for restart...");
     delay(60000);
     Serial.println("Restarting!");
@@ -144,10 +235,10 @@ void LoRaSync::setup() {
     // while (1);
   }
 
-  _loRa->setSpreadingFactor(10);
-  _loRa->setSignalBandwidth(125000);
-  _loRa->setCodingRate4(5);
-  _loRa->setPreambleLength(8);
+  _loRa->setSpreadingFactor(LORA_SPREADING_FACTOR);
+  _loRa->setSignalBandwidth(LORA_SIGNAL_BANDWIDTH);
+  _loRa->setCodingRate4(LORA_CODING_RATE_4);
+  _loRa->setPreambleLength(LORA_PREAMBLE_LENGTH);
   _loRa->setSyncWord(0x12);
   _loRa->enableCrc();
 
@@ -158,6 +249,14 @@ void LoRaSync::setup() {
   // _loRa->idle();
 #if defined(ENABLE_SYNC_RECEIVER)
   _loRa->receive();
+#if defined(ENABLE_EVENT_LOOP)
+  // Continuous receive mode raises DIO0 for every packet, so parsePacket() is only called when one arrived
+  attachInterrupt(digitalPinToInterrupt(LORA_DIO0_PIN), loRaInterrupt, RISING);
+#if defined(EVENTS_LIGHT_SLEEP)
+  gpio_wakeup_enable((gpio_num_t) LORA_DIO0_PIN, GPIO_INTR_HIGH_LEVEL);
+  esp_sleep_enable_gpio_wakeup();
+#endif
+#endif
 #endif
 }
 
@@ -182,22 +281,73 @@ void LoRaSync::sendBootSync() {
 
 void LoRaSync::loop() {
 #if defined(ENABLE_SYNC)
-  _processQueuedPackets();
+  {
+    PROFILE_SCOPE(PROFILE_SYNC_QUEUE);
+    _processQueuedPackets();
+  }
+  {
+    PROFILE_SCOPE(PROFILE_SYNC_TELEMETRY);
+    _sendTelemetry();
+  }
 #endif
 
- #if defined(ENABLE_SYNC_SENDER)
- if (_data->forceLoRaTimeUpdate) {
-    _sendNetworkTime(true);
-    _data->forceLoRaTimeUpdate = false;
+#if defined(ENABLE_SYNC_SENDER)
+  {
+    PROFILE_SCOPE(PROFILE_SYNC_SEND);
+    _changes = _data->changes.consume(DATA_SUBSCRIBER_LORA);
+#if defined(DATA_COLLECTOR)
+    if (_changes & DATA_BIT(DATA_ALERT)) {
+      _sendAlert(false);
+    } else if (_alertTimer.isExpired()) {
+      _sendAlert(true);
+    }
+#endif
+    if (_changes & DATA_BIT(DATA_NETWORK_TIME)) {
+      _sendNetworkTime(true);
+    }
+    _sendChannels(false);
   }
-  _sendCgmData(false);
-  _sendPropaneLevel(false);
-  _sendTemperatures(false);
 #endif
 #if defined(ENABLE_SYNC_RECEIVER)
-  // Serial.println("ENABLE_SYNC_RECEIVER");
-  _receiveLoRaData();
+  {
+    PROFILE_SCOPE(PROFILE_SYNC_RECEIVE);
+#if defined(ENABLE_EVENT_LOOP)
+    // DIO0 stays high until the packet is read, which also covers an edge that came before the subscription
+    if (Events::take(EVENT_LORA_IRQ) ||
+        (digitalRead(LORA_DIO0_PIN) == HIGH)) {
+      _receiveLoRaData();
+      _loRa->receive();  // parsePacket() leaves the radio in standby or single receive mode
+    }
+#else
+    _receiveLoRaData();
+#endif
+  }
+#endif
+}
+
+// 0 while loop() has work right now, ULONG_MAX otherwise. The timers wake the
+// radio task through EVENT_RADIO_TIMER.
+unsigned long LoRaSync::nextDeadline() {
+#if defined(ENABLE_SYNC)
+  if (((_processPacketState == 0x00) && !loRaQueue.isEmpty()) ||
+      (_processPacketState == 0x02)) {
+    return 0;
+  }
+
+  // An alert cuts the jitter and the transmit gap short, but not its own acknowledgement slot
+  if (!loRaAlertQueue.isEmpty() &&
+      !((_processPacketState == 0x01) && _sendingPriority)) {
+    return 0;
+  }
+#endif
+
+#if defined(ENABLE_SYNC_SENDER)
+  if (_data->changes.pending(DATA_SUBSCRIBER_LORA)) {
+    return 0;
+  }
 #endif
+
+  return ULONG_MAX;
 }
 
 #if defined(ENABLE_SYNC)  // Receivers will send boot-sync messages
@@ -212,8 +362,28 @@ void LoRaSync::_sendPacket(uint16_t messageType, byte* data, uint dataLength, bo
   loRaQueueEntry.messageType = messageType;
   loRaQueueEntry.dataLength = dataLength;
   loRaQueueEntry.randomizeTiming = randomizeTiming;
+  loRaQueueEntry.delayMillis = 0;
+  memcpy(loRaQueueEntry.data, data, loRaQueueEntry.dataLength);
+  if (!loRaQueue.push(loRaQueueEntry)) {
+    Metrics::increment(METRIC_LORA_QUEUE_OVERFLOWS);
+  }
+  Metrics::setGauge(METRIC_LORA_QUEUE_DEPTH, loRaQueue.count());
+  Events::notify(EVENT_LORA_QUEUED);
+}
+
+// Jumps ahead of everything in loRaQueue, and is sent after delayMillis instead of a random delay
+void LoRaSync::_sendPriorityPacket(uint16_t messageType, byte* data, uint dataLength, uint16_t delayMillis) {
+  loRaQueueEntry_struct loRaQueueEntry;
+
+  loRaQueueEntry.messageType = messageType;
+  loRaQueueEntry.dataLength = min(dataLength, (uint) sizeof(loRaQueueEntry.data));
+  loRaQueueEntry.randomizeTiming = false;
+  loRaQueueEntry.delayMillis = delayMillis;
   memcpy(loRaQueueEntry.data, data, loRaQueueEntry.dataLength);
-  loRaQueue.push(&loRaQueueEntry);
+  if (!loRaAlertQueue.push(loRaQueueEntry)) {
+    Metrics::increment(METRIC_LORA_QUEUE_OVERFLOWS);
+  }
+  Events::notify(EVENT_LORA_QUEUED);
 }
 
 void LoRaSync::_processQueuedPackets() {
@@ -221,10 +391,18 @@ void LoRaSync::_processQueuedPackets() {
     case 0x00:
       {
         loRaQueueEntry_struct loRaQueueEntry;
-        if (loRaQueue.peek(&loRaQueueEntry)) {
+        if (loRaAlertQueue.peek(&loRaQueueEntry)) {
+          _sendingPriority = true;
+          if (loRaQueueEntry.delayMillis > 0) {
+            _processPacketTimer.start(loRaQueueEntry.delayMillis);
+            _processPacketState = 0x01;
+          } else {
+            _processPacketState = 0x02;
+          }
+        } else if (loRaQueue.peek(&loRaQueueEntry)) {
+          _sendingPriority = false;
           if (loRaQueueEntry.randomizeTiming) {
-            _randomLoRaDelay = random(0, 3000) & 0xFFFF;
-            _processPacketTimer.reset();
+            _processPacketTimer.start(random(0, 3000));
             _processPacketState = 0x01;
           } else {
             _processPacketState = 0x02;
@@ -235,8 +413,12 @@ void LoRaSync::_processQueuedPackets() {
       break;
 
     case 0x01:
-      if (_processPacketTimer.isExpired(_randomLoRaDelay)) {
+      if (_processPacketTimer.isExpired()) {
         _processPacketState = 0x02;
+      } else if (!_sendingPriority &&
+                 !loRaAlertQueue.isEmpty()) {
+        _processPacketTimer.stop();  // The random delay starts over after the alert
+        _processPacketState = 0x00;
       }
 
       break;
@@ -244,7 +426,27 @@ void LoRaSync::_processQueuedPackets() {
     case 0x02:
       {
         loRaQueueEntry_struct loRaQueueEntry;
-        if (loRaQueue.pull(&loRaQueueEntry)) {
+        if (_sendingPriority ? loRaAlertQueue.pop(&loRaQueueEntry) : loRaQueue.pop(&loRaQueueEntry)) {
+          struct channelMessageHeader_struct* header = (struct channelMessageHeader_struct*) loRaQueueEntry.data;
+          bool traced = ((loRaQueueEntry.messageType == 32) &&
+                         (header->senderMillis != LATENCY_UNKNOWN_MILLIS));
+          if (traced) {
+            LatencyTrace::transmitStarted();
+            header->senderMillis = LatencyTrace::senderMillis();
+          }
+
+          if (loRaQueueEntry.messageType == 33) {
+            struct alertMessage_struct* alertMessage = (struct alertMessage_struct*) loRaQueueEntry.data;
+            struct alert_struct alert = _data->alert.read();
+            uint64_t elapsed = Clock::nowMillis() - alert.raisedAt;
+            alertMessage->senderMillis = (alert.alertId == alertMessage->alertId ?
+                                          min(elapsed, (uint64_t) (LATENCY_UNKNOWN_MILLIS - 1)) :
+                                          LATENCY_UNKNOWN_MILLIS);
+            if (_alertRetries == 0) {
+              Metrics::record(METRIC_ALERT_QUEUE_TIME, elapsed);
+            }
+          }
+
           // _loRa->idle();
           _loRa->beginPacket();
 
@@ -258,18 +460,20 @@ void LoRaSync::_processQueuedPackets() {
                                                 loRaQueueEntry.dataLength);
           _loRa->write(encryptedMessage, encryptedMessageLength);
 
-          Serial.print("Sending packet: device ID = ");
-          Serial.print(_deviceId);
-          Serial.print(", counter = ");
-          Serial.print(counter);
-          Serial.print(", type = ");
-          Serial.print(loRaQueueEntry.messageType);
-          Serial.print(", length = ");
-          Serial.println(loRaQueueEntry.dataLength);
+          LOG_INFO(LOG_LORA_SEND, _deviceId, counter, loRaQueueEntry.messageType, loRaQueueEntry.dataLength);
+          Metrics::countLoRaPacket(true, loRaQueueEntry.messageType);
+          Metrics::increment(METRIC_LORA_TIME_ON_AIR, timeOnAir(encryptedMessageLength) / 1000);
+          Metrics::setGauge(METRIC_LORA_QUEUE_DEPTH, loRaQueue.count());
 
           _loRa->endPacket();
+          if (traced) {
+            LatencyTrace::transmitDone();
+          }
+#if defined(ENABLE_EVENT_LOOP) && defined(ENABLE_SYNC_RECEIVER)
+          _loRa->receive();
+#endif
 
-          _processPacketTimer.reset();
+          _processPacketTimer.start(LORA_TRANSMIT_GAP);
           _processPacketState = 0x03;
 
           // delay(50);  // Wait for the message to transmit
@@ -279,11 +483,12 @@ void LoRaSync::_processQueuedPackets() {
       break;
 
     case 0x03:
-      if (_processPacketTimer.isExpired(1000)) {
+      if (_processPacketTimer.isExpired() ||
+          !loRaAlertQueue.isEmpty()) {
         // _loRa->receive();
         // _loRa->sleep();
 
-        _processPacketTimer.reset(ULONG_MAX);
+        _processPacketTimer.stop();
         _processPacketState = 0x00;
       }
 
@@ -291,63 +496,141 @@ void LoRaSync::_processQueuedPackets() {
   }
 }
 
+void LoRaSync::_sendTelemetry() {
+  if (_telemetryTimer.isExpired()) {
+    struct telemetry_struct telemetry;
+
+    Metrics::buildTelemetry(&telemetry);
+    _sendPacket(40, (byte*) &telemetry, sizeof(telemetry) - sizeof(telemetry.padding0), true);  // Telemetry
+    _telemetryTimer.start(TELEMETRY_INTERVAL);
+  }
+}
+
+// A new alert is sent to every display right away, a retry only to the ones that did not acknowledge it yet
+void LoRaSync::_sendAlert(bool retry) {
+#if defined(DATA_COLLECTOR)
+  struct alert_struct alert = _data->alert.read();
+  if (alert.alertId == 0) {
+    return;
+  }
+
+  if (retry) {
+    if ((_alertPendingAcks == 0) ||
+        (_alertRetries >= ALERT_MAX_RETRIES)) {
+      if (_alertPendingAcks != 0) {
+        LOG_WARN(LOG_LORA_ALERT_UNACKNOWLEDGED, _alertId, _alertPendingAcks);
+        Metrics::increment(METRIC_ALERT_UNACKNOWLEDGED, __builtin_popcount(_alertPendingAcks));
+        _alertPendingAcks = 0;
+      }
+      _alertTimer.stop();
+      return;
+    }
+    _alertRetries++;
+    Metrics::increment(METRIC_ALERT_RETRANSMISSIONS);
+  } else {
+    _alertId = alert.alertId;
+    _alertPendingAcks = _alertReceivers;
+    _alertRetries = 0;
+  }
+
+  struct channelValue_struct reading = _data->read(CHANNEL_MG_PER_DL);
+  struct alertMessage_struct message;
+  message.alertId = alert.alertId;
+  message.senderMillis = LATENCY_UNKNOWN_MILLIS;
+  Channels::encode(CHANNEL_MG_PER_DL, reading.value, (byte*) &message.mgPerDl);
+  message.age = min(channelAge(&reading), (uint32_t) CHANNEL_AGE_SATURATED);
+  message.level = alert.level;
+  message.minutes = alert.minutes;
+  _sendPriorityPacket(33, (byte*) &message, sizeof(message), 0);  // Alert
+  _alertTimer.start(ALERT_RETRY_INTERVAL);
+#endif
+}
+
 void LoRaSync::_sendNetworkTime(bool randomizeTiming) {
 #if defined(DATA_COLLECTOR)
   struct clockInfo_struct clockInfo;
+  struct timezoneInfo_struct timezoneInfo;
 
-  Serial.println("LoRa: sending network time");
+  LOG_INFO(LOG_LORA_SEND_NETWORK_TIME);
+  _data->timezoneInfo.read(&timezoneInfo);
   clockInfo.time = time(nullptr);
-  clockInfo.dstBegin = _data->dstBegin;
-  clockInfo.dstEnd = _data->dstEnd;
-  clockInfo.standardTimezoneOffset = _data->standardTimezoneOffset;
-  clockInfo.daylightTimezoneOffset = _data->daylightTimezoneOffset;
+  clockInfo.dstBegin = timezoneInfo.dstBegin;
+  clockInfo.dstEnd = timezoneInfo.dstEnd;
+  clockInfo.standardTimezoneOffset = timezoneInfo.standardTimezoneOffset;
+  clockInfo.daylightTimezoneOffset = timezoneInfo.daylightTimezoneOffset;
 
   _sendPacket(1, (byte*) &clockInfo, sizeof(clockInfo), randomizeTiming);  // Time update
 #endif
 }
 
-void LoRaSync::_sendCgmData(bool forceUpdate) {
-  if ((_data->mgPerDl != _oldData->mgPerDl) ||
-      _cgmGuaranteeTimer.isExpired(600000) ||  // Once every ten minutes
-      forceUpdate) {
-    struct cgm_struct cgm = { _data->mgPerDl & 0xFFFF, time(nullptr) };
-    _sendPacket(29, (byte*) &cgm, sizeof(cgm), forceUpdate);  // CGM reading
-    _cgmGuaranteeTimer.reset();
-    _oldData->mgPerDl = _data->mgPerDl;
+// Sends every transmitted channel that changed or whose heartbeat is due in one packet
+void LoRaSync::_sendChannels(bool forceUpdate) {
+  uint64_t now = Clock::nowMillis();
+  uint32_t changed = DATA_CHANNELS(_changes) & CHANNELS_TRANSMITTED;
+  uint32_t due = (forceUpdate ? CHANNELS_TRANSMITTED : changed);
+  _changes &= ~DATA_CHANNEL_BITS(CHANNELS_TRANSMITTED);
+
+  if (_heartbeatTimer.isExpired()) {
+    for (uint32_t channels = CHANNELS_TRANSMITTED; channels != 0; channels &= channels - 1) {
+      uint channel = __builtin_ctz(channels);
+      if ((now - _lastHeartbeat[channel]) >= channelInfo[channel].heartbeat) {
+        due |= CHANNEL_BIT(channel);
+      }
+    }
   }
-}
 
-void LoRaSync::_sendPropaneLevel(bool forceUpdate) {
-  if ((_data->propaneLevel != _oldData->propaneLevel) ||
-      _propaneGuaranteeTimer.isExpired(3600000) ||  // Once per hour
-      forceUpdate) {
-    byte data = (_data->propaneLevel >= 0 ? _data->propaneLevel & 0xFF : 0xFF);
-    _sendPacket(30, (byte*) &data, sizeof(data), forceUpdate);  // Propane level in percent
-    _propaneGuaranteeTimer.reset();
-    _oldData->propaneLevel = _data->propaneLevel;
+  if (due == 0) {
+    return;
+  }
+
+  byte message[sizeof(struct channelMessageHeader_struct) + (CHANNEL_COUNT * (1 + CHANNEL_MAX_ENCODED_SIZE + sizeof(uint16_t)))];
+  uint messageLength = sizeof(struct channelMessageHeader_struct);
+  bool traced = false;
+  for (uint32_t channels = due; channels != 0; channels &= channels - 1) {
+    channel_enum channel = (channel_enum) __builtin_ctz(channels);
+    struct channelValue_struct channelValue = _data->read(channel);
+    _lastHeartbeat[channel] = now;
+
+    // Repeating an unknown value could overwrite a known one from another node, and a stale one only wastes airtime
+    if ((isnan(channelValue.value) && !(changed & CHANNEL_BIT(channel))) ||
+        channelStale(channel, &channelValue)) {
+      continue;
+    }
+
+    uint16_t age = min(channelAge(&channelValue), (uint32_t) CHANNEL_AGE_SATURATED);
+    message[messageLength++] = channelInfo[channel].wireId;
+    messageLength += Channels::encode(channel, channelValue.value, &message[messageLength]);
+    memcpy(&message[messageLength], &age, sizeof(age));
+    messageLength += sizeof(age);
+    if ((channel == CHANNEL_MG_PER_DL) &&
+        (changed & CHANNEL_BIT(channel))) {
+      traced = true;
+    }
+  }
+  _scheduleHeartbeats();
+
+  if (messageLength == sizeof(struct channelMessageHeader_struct)) {
+    return;
+  }
+
+  // Any value other than LATENCY_UNKNOWN_MILLIS asks _processQueuedPackets() to fill in the age
+  struct channelMessageHeader_struct header = { (uint16_t) (traced ? 0 : LATENCY_UNKNOWN_MILLIS) };
+  memcpy(message, &header, sizeof(header));
+  _sendPacket(32, message, messageLength, forceUpdate);  // Channel values
+  if (traced) {
+    LatencyTrace::queued();
   }
 }
 
-void LoRaSync::_sendTemperatures(bool forceUpdate) {
-  if ((_data->indoorTemperature != _oldData->indoorTemperature) ||
-      (_data->indoorHumidity != _oldData->indoorHumidity) ||
-      (_data->outdoorTemperature != _oldData->outdoorTemperature) ||
-      (_data->outdoorHumidity != _oldData->outdoorHumidity) ||
-      _temperatureGuaranteeTimer.isExpired(300000) ||  // Once every five minutes
-      forceUpdate) {
-    struct temperature_struct temperatures;
-
-    temperatures.indoorTemperature = _data->indoorTemperature;
-    temperatures.indoorHumidity = _data->indoorHumidity;
-    temperatures.outdoorTemperature = _data->outdoorTemperature;
-    temperatures.outdoorHumidity = _data->outdoorHumidity;
-
-    _sendPacket(31, (byte*) &temperatures, sizeof(temperatures) - sizeof(temperatures.padding0), forceUpdate);
-    _temperatureGuaranteeTimer.reset();
-    _oldData->indoorHumidity = _data->indoorHumidity;
-    _oldData->indoorTemperature = _data->indoorTemperature;
-    _oldData->outdoorHumidity = _data->outdoorHumidity;
-    _oldData->outdoorTemperature = _data->outdoorTemperature;
+void LoRaSync::_scheduleHeartbeats() {
+  uint64_t next = UINT64_MAX;
+  for (uint32_t channels = CHANNELS_TRANSMITTED; channels != 0; channels &= channels - 1) {
+    uint channel = __builtin_ctz(channels);
+    next = min(next, _lastHeartbeat[channel] + channelInfo[channel].heartbeat);
+  }
+
+  if (next != UINT64_MAX) {
+    _heartbeatTimer.startAt(next);
   }
 }
 #endif
@@ -362,11 +645,8 @@ void LoRaSync::_receiveLoRaData() {
   }
 
   // received an encrypted message
-  Serial.print("Received message, size = ");
-  Serial.print(encryptedMessageSize);
-  // print RSSI of message
-  Serial.print(" with RSSI ");
-  Serial.print(_loRa->packetRssi());
+  LatencyTrace::receiveStarted();
+  LOG_INFO(LOG_LORA_RECEIVE, encryptedMessageSize, _loRa->packetRssi());
 
   // read encrypted message
   byte encryptedMessage[255];
@@ -379,29 +659,21 @@ void LoRaSync::_receiveLoRaData() {
   MessageMetadata messageMetadata;
   uint decryptStatus = loRaCrypto->decrypt(messageData, encryptedMessage, encryptedMessageLength, &messageMetadata);
   if (decryptStatus != LoRaCryptoDecryptErrors::DECRYPT_OK) {
-    char message[255];
-    loRaCrypto->decryptErrorMessage(decryptStatus, message);
-    Serial.print(" (");
-    Serial.print(message);
-    Serial.println(")");
+    LOG_WARN(LOG_LORA_DECRYPT_ERROR, decryptStatus);
+    Metrics::increment(METRIC_LORA_DECRYPT_FAILURES);
 
     return;
   }
 
-  char displayBuffer[255];
-  sprintf(displayBuffer, ", device id = %d, message type = %d, ", messageMetadata.deviceId, messageMetadata.type);
-  Serial.print(displayBuffer);
+  LOG_INFO(LOG_LORA_MESSAGE, messageMetadata.deviceId, messageMetadata.type);
+  Metrics::countLoRaPacket(false, messageMetadata.type);
 
   switch (messageMetadata.type) {
     // Network time
     case 1:
       struct clockInfo_struct clockInfo;
       if (messageMetadata.length < sizeof(clockInfo)) {
-          Serial.print("error: the message has the wrong length. It is ");
-          Serial.print(messageMetadata.length);
-          Serial.print(" byte(s) long, but must be at least ");
-          Serial.print(sizeof(clockInfo));
-          Serial.println(" bytes");
+        LOG_WARN(LOG_LORA_WRONG_LENGTH, messageMetadata.length, (uint32_t) sizeof(clockInfo));
         break;
       }
       memcpy(&clockInfo, messageData, sizeof(clockInfo));
@@ -417,25 +689,19 @@ void LoRaSync::_receiveLoRaData() {
         tv.tv_sec = clockInfo.time;
         tv.tv_usec = 0;
         settimeofday(&tv, NULL);
-        _data->dstBegin = clockInfo.dstBegin;
-        _data->dstEnd = clockInfo.dstEnd;
-        _data->standardTimezoneOffset = clockInfo.standardTimezoneOffset;
-        _data->daylightTimezoneOffset = clockInfo.daylightTimezoneOffset;
-        Serial.print("Updating _data->daylightTimezoneOffset to ");
-        Serial.println(_data->daylightTimezoneOffset);
-        _data->forceDisplayTimeUpdate = true;
-        // We won't change the value of _data->forceDisplayTimeUpdate for the following reasons:
-        //   1. We don't want to keep bouncing updates back and forth between devices when they receive a time from another device,
-        //      so we don't want to set this value to true, and
-        //   2. If _data->forceDisplayTimeUpdate was already set to true then that means that an update came from someplace else
-        //      and we want that update to finish
-        // _data->forceDisplayTimeUpdate = true;
+        struct timezoneInfo_struct timezoneInfo;
+        timezoneInfo.dstBegin = clockInfo.dstBegin;
+        timezoneInfo.dstEnd = clockInfo.dstEnd;
+        timezoneInfo.standardTimezoneOffset = clockInfo.standardTimezoneOffset;
+        timezoneInfo.daylightTimezoneOffset = clockInfo.daylightTimezoneOffset;
+        _data->setTimezone(&timezoneInfo);  // Built into the same table as the collector's
+        LOG_INFO(LOG_LORA_SET_TIME, (int64_t) clockInfo.time, timezoneInfo.daylightTimezoneOffset);
+        // Only the display is told. DATA_NETWORK_TIME is not published because we don't want to keep bouncing
+        // updates back and forth between devices when they receive a time from another device
+        _data->changes.publish(DATA_BIT(DATA_CLOCK));
       }
 
-      sprintf(displayBuffer, "\"time messageId %d with deviceId = %d at time %" PRId64 "\"", messageMetadata.counter, *((uint16_t*) messageData), time(nullptr));
-      Serial.println(displayBuffer);
-      Serial.print("Setting time to ");
-      Serial.println(clockInfo.time);
+      LOG_INFO(LOG_LORA_TIME, messageMetadata.counter, messageMetadata.deviceId, (int64_t) time(nullptr));
 
       break;
 
@@ -443,100 +709,202 @@ void LoRaSync::_receiveLoRaData() {
     case 2:
       struct bootSync_struct bootSync;
       if (messageMetadata.length < (sizeof(bootSync) - sizeof(bootSync.padding0))) {
-          Serial.print("error: the message has the wrong length. It is ");
-          Serial.print(messageMetadata.length);
-          Serial.print(" byte(s) long, but must be at least ");
-          Serial.print(sizeof(bootSync) - sizeof(bootSync.padding0));
-          Serial.println(" bytes");
+        LOG_WARN(LOG_LORA_WRONG_LENGTH, messageMetadata.length, (uint32_t) (sizeof(bootSync) - sizeof(bootSync.padding0)));
         break;
       }
       memcpy(&bootSync, messageData, sizeof(bootSync));
 
-      sprintf(displayBuffer, "\"boot-sync messageId %d with deviceId = %d, appId = %d, version = %d.%d.%d at time %" PRId64 "\"",
-              messageMetadata.counter,
-              bootSync.deviceId,
-              bootSync.appId,
-              bootSync.major,
-              bootSync.minor,
-              bootSync.patch,
-              time(nullptr));
-      Serial.println(displayBuffer);
+      LOG_INFO(LOG_LORA_BOOT_SYNC,
+               messageMetadata.counter,
+               bootSync.deviceId,
+               bootSync.appId,
+               bootSync.major,
+               bootSync.minor,
+               bootSync.patch,
+               (int64_t) time(nullptr));
 
 #if defined(ENABLE_SYNC_SENDER)
       {
         _sendNetworkTime(true);
-        _sendCgmData(true);
-        _sendPropaneLevel(true);
-        _sendTemperatures(true);
+        _sendChannels(true);
       }
 #endif
       break;
 
+    // Legacy CGM reading
     case 29:
       {
         struct cgm_struct cgm;
         if (messageMetadata.length < sizeof(cgm)) {
-          Serial.print("error: the message has the wrong length. It is ");
-          Serial.print(messageMetadata.length);
-          Serial.print(" byte(s) long, but must be at least ");
-          Serial.print(sizeof(cgm));
-          Serial.println(" bytes");
+          LOG_WARN(LOG_LORA_WRONG_LENGTH, messageMetadata.length, (uint32_t) sizeof(cgm));
           break;
         }
         memcpy(&cgm, messageData, sizeof(cgm));
 
-        _data->mgPerDl = scrubMgPerDl(cgm.mgPerDl);
-        sprintf(displayBuffer, "\"messageId %d with cgm reading = %d at time %" PRId64 "\"", messageMetadata.counter, _data->mgPerDl, cgm.time);
-        Serial.println(displayBuffer);
+        if (_data->update(CHANNEL_MG_PER_DL, cgm.mgPerDl)) {
+          LatencyTrace::receiveDone(cgm.senderMillis, timeOnAir(encryptedMessageLength));
+        }
+        LOG_INFO(LOG_LORA_CGM, messageMetadata.counter, cgm.mgPerDl, (int64_t) cgm.time);
       }
       break;
 
+    // Legacy propane level
     case 30:
       {
         if (messageMetadata.length < 1) {
-          Serial.print("error: the message has the wrong length. It is ");
-          Serial.print(messageMetadata.length);
-          Serial.println(" byte(s) long, but must be at least 1 byte");
+          LOG_WARN(LOG_LORA_WRONG_LENGTH, messageMetadata.length, 1);
           break;
         }
 
-        _data->propaneLevel = scrubPropaneLevel((byte) messageData[0]);
-        sprintf(displayBuffer, "\"messageId %d with propane reading = %d at time %" PRId64 "\"", messageMetadata.counter, _data->propaneLevel, time(nullptr));
-        Serial.println(displayBuffer);
+        _data->update(CHANNEL_PROPANE_LEVEL, (byte) messageData[0]);
+        LOG_INFO(LOG_LORA_PROPANE, messageMetadata.counter, (byte) messageData[0], (int64_t) time(nullptr));
       }
       break;
 
+    // Legacy temperatures
     case 31:
       {
         struct temperature_struct temperatures;
 
         if (messageMetadata.length < (sizeof(temperatures) - sizeof(temperatures.padding0))) {
-          Serial.print("error: the message has the wrong length. It is ");
-          Serial.print(messageMetadata.length);
-          Serial.println(" byte(s) long, but must be at least 10 bytes");
+          LOG_WARN(LOG_LORA_WRONG_LENGTH, messageMetadata.length, (uint32_t) (sizeof(temperatures) - sizeof(temperatures.padding0)));
           break;
         }
 
         memcpy(&temperatures, messageData, sizeof(temperatures));
-        _data->indoorTemperature = scrubTemperature(temperatures.indoorTemperature);
-        _data->indoorHumidity = scrubHumidity(temperatures.indoorHumidity);
-        _data->outdoorTemperature = scrubTemperature(temperatures.outdoorTemperature);
-        _data->outdoorHumidity = scrubHumidity(temperatures.outdoorHumidity);
-        sprintf(displayBuffer,
-                "\"messageId %d with temperature readings (IT) = %f, (IH) = %d, (OT) = %f, (OH) = %d at time %" PRId64 "\"",
-                messageMetadata.counter,
-                _data->indoorTemperature,
-                _data->indoorHumidity,
-                _data->outdoorTemperature,
-                _data->outdoorHumidity,
-                time(nullptr));
-        Serial.println(displayBuffer);
+        _data->update(CHANNEL_INDOOR_TEMPERATURE, temperatures.indoorTemperature);
+        _data->update(CHANNEL_INDOOR_HUMIDITY, temperatures.indoorHumidity);
+        _data->update(CHANNEL_OUTDOOR_TEMPERATURE, temperatures.outdoorTemperature);
+        _data->update(CHANNEL_OUTDOOR_HUMIDITY, temperatures.outdoorHumidity);
+        LOG_INFO(LOG_LORA_TEMPERATURES,
+                 messageMetadata.counter,
+                 temperatures.indoorTemperature,
+                 temperatures.indoorHumidity,
+                 temperatures.outdoorTemperature,
+                 temperatures.outdoorHumidity,
+                 (int64_t) time(nullptr));
+      }
+      break;
+
+    // Channel values
+    case 32:
+      {
+        struct channelMessageHeader_struct header;
+        if (messageMetadata.length < sizeof(header)) {
+          LOG_WARN(LOG_LORA_WRONG_LENGTH, messageMetadata.length, (uint32_t) sizeof(header));
+          break;
+        }
+        memcpy(&header, messageData, sizeof(header));
+
+        uint offset = sizeof(header);
+        while (offset < messageMetadata.length) {
+          channel_enum channel;
+          if (!Channels::find(messageData[offset], &channel)) {
+            // The size of an unknown channel's value is unknown, so the rest of the message is lost
+            LOG_WARN(LOG_LORA_UNKNOWN_CHANNEL, messageData[offset]);
+            break;
+          }
+
+          uint encodedSize = Channels::encodedSize(channel);
+          uint entryLength = 1 + encodedSize + sizeof(uint16_t);
+          if ((offset + entryLength) > messageMetadata.length) {
+            LOG_WARN(LOG_LORA_WRONG_LENGTH, messageMetadata.length, offset + entryLength);
+            break;
+          }
+
+          float value = Channels::decode(channel, &messageData[offset + 1]);
+          uint16_t age;
+          memcpy(&age, &messageData[offset + 1 + encodedSize], sizeof(age));
+          if (_data->update(channel, value, age) &&
+              (channel == CHANNEL_MG_PER_DL)) {
+            LatencyTrace::receiveDone(header.senderMillis, timeOnAir(encryptedMessageLength));
+          }
+          LOG_INFO(LOG_LORA_CHANNEL, messageMetadata.counter, channelInfo[channel].name, value, age);
+          offset += entryLength;
+        }
+      }
+      break;
+
+    // Alert
+    case 33:
+      {
+        struct alertMessage_struct message;
+        if (messageMetadata.length < sizeof(message)) {
+          LOG_WARN(LOG_LORA_WRONG_LENGTH, messageMetadata.length, (uint32_t) sizeof(message));
+          break;
+        }
+        memcpy(&message, messageData, sizeof(message));
+
+        float mgPerDl = Channels::decode(CHANNEL_MG_PER_DL, (byte*) &message.mgPerDl);
+        LOG_INFO(LOG_LORA_ALERT, messageMetadata.counter, message.alertId, Alerts::name((alertLevel_enum) message.level), mgPerDl);
+#if !defined(DATA_COLLECTOR)
+        _data->update(CHANNEL_MG_PER_DL, mgPerDl, message.age);
+
+        // Retransmissions only need another acknowledgement
+        struct alert_struct alert = _data->alert.read();
+        if ((alert.alertId != message.alertId) ||
+            (alert.level != message.level)) {
+          uint32_t elapsed = timeOnAir(encryptedMessageLength) / 1000;
+          if (message.senderMillis != LATENCY_UNKNOWN_MILLIS) {
+            elapsed += message.senderMillis;
+          }
+          alert.alertId = message.alertId;
+          alert.level = (alertLevel_enum) message.level;
+          alert.minutes = message.minutes;
+          alert.mgPerDl = mgPerDl;
+          alert.raisedAt = Clock::nowMillis() - elapsed;
+          _data->alert.write(alert);
+          _data->changes.publish(DATA_BIT(DATA_ALERT));
+        }
+
+        struct alertAck_struct ack = { message.alertId };
+        _sendPriorityPacket(34, (byte*) &ack, sizeof(ack), (deviceIndex(_deviceId) + 1) * ALERT_ACK_SLOT);  // Alert acknowledgement
+#endif
+      }
+      break;
+
+    // Alert acknowledgement
+    case 34:
+      {
+        struct alertAck_struct ack;
+        if (messageMetadata.length < sizeof(ack)) {
+          LOG_WARN(LOG_LORA_WRONG_LENGTH, messageMetadata.length, (uint32_t) sizeof(ack));
+          break;
+        }
+        memcpy(&ack, messageData, sizeof(ack));
+
+        LOG_INFO(LOG_LORA_ALERT_ACK, messageMetadata.counter, ack.alertId, messageMetadata.deviceId);
+#if defined(DATA_COLLECTOR)
+        uint32_t device = 1 << deviceIndex(messageMetadata.deviceId);
+        if ((ack.alertId == _alertId) &&
+            (_alertPendingAcks & device)) {
+          _alertPendingAcks &= ~device;
+          Metrics::record(METRIC_ALERT_ACK_TIME, Clock::nowMillis() - _data->alert.read().raisedAt);
+          if (_alertPendingAcks == 0) {
+            _alertTimer.stop();
+          }
+        }
+#endif
+      }
+      break;
+
+    case 40:
+      {
+        struct telemetry_struct telemetry;
+
+        if (messageMetadata.length < (sizeof(telemetry) - sizeof(telemetry.padding0))) {
+          LOG_WARN(LOG_LORA_WRONG_LENGTH, messageMetadata.length, (uint32_t) (sizeof(telemetry) - sizeof(telemetry.padding0)));
+          break;
+        }
+
+        memcpy(&telemetry, messageData, sizeof(telemetry) - sizeof(telemetry.padding0));
+        Metrics::recordTelemetry(messageMetadata.deviceId, &telemetry);
+        LOG_INFO(LOG_LORA_TELEMETRY, messageMetadata.counter, messageMetadata.deviceId, telemetry.uptime);
       }
       break;
 
     default:
-      sprintf(displayBuffer, "unknown message type %d", messageMetadata.type);
-      Serial.println(displayBuffer);
+      LOG_WARN(LOG_LORA_UNKNOWN_TYPE, messageMetadata.type);
   }
 }
 #endif
@@ -6,42 +6,53 @@
 #include "semver.h"
 #include "credentials.h"
 #include "data.h"
-#include <ExpirationTimer.h>
+#include "TimerWheel.h"
 #include <LoRaCrypto.h>
 #include <LoRaCryptoCreds.h>
+#include "Metrics.h"
 
 class LoRaSync {
   private:
     uint16_t _appId;
     struct semver_struct _version;
-    volatile struct data_struct* _data;
-    struct data_struct* _oldData;
+    struct data_struct* _data;
+    uint32_t _changes;  // Consumed at the start of every loop()
     uint16_t _deviceId = 0;
     SPIClass* _spi;
     LoRaClass* _loRa;
-    ExpirationTimer _cgmGuaranteeTimer;
-    ExpirationTimer _propaneGuaranteeTimer;
-    ExpirationTimer _temperatureGuaranteeTimer;
-    int _randomLoRaDelay;
+    uint64_t _lastHeartbeat[CHANNEL_COUNT];  // Clock::nowMillis() of the last transmission of each channel
+    DeadlineTimer _heartbeatTimer;  // Earliest heartbeat
+    DeadlineTimer _telemetryTimer;
 
     int _processPacketState;
-    ExpirationTimer _processPacketTimer;
+    DeadlineTimer _processPacketTimer;
+    bool _sendingPriority;  // The packet in progress came from the alert queue
+
+    // Alert being sent by the collector
+    uint16_t _alertId;
+    uint32_t _alertReceivers;  // deviceMapping entries expected to acknowledge, all but this device
+    uint32_t _alertPendingAcks;
+    uint _alertRetries;
+    DeadlineTimer _alertTimer;
 
     void _sendPacket(uint16_t messageType, byte* data, uint dataLength, bool randomizeTiming = false);
+    void _sendPriorityPacket(uint16_t messageType, byte* data, uint dataLength, uint16_t delayMillis);
+    void _sendAlert(bool retry);
     void _processQueuedPackets();
+    void _sendTelemetry();
     void _sendNetworkTime(bool randomizeTiming);
-    void _sendCgmData(bool forceUpdate);
-    void _sendPropaneLevel(bool forceUpdate);
-    void _sendTemperatures(bool forceUpdate);
+    void _sendChannels(bool forceUpdate);
+    void _scheduleHeartbeats();
     void _receiveLoRaData();
 
   public:
-    LoRaSync(uint16_t appId, struct semver_struct* version, volatile struct data_struct* data, SPIClass* spi);
+    LoRaSync(uint16_t appId, struct semver_struct* version, struct data_struct* data, SPIClass* spi);
     ~LoRaSync();
 
     void setup();
     void loop();
 
     void sendBootSync();
+    unsigned long nextDeadline();
     uint16_t deviceId() { return _deviceId; };
 };
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bounded multi-producer/multi-consumer queue (Vyukov). Every cell carries a
+// sequence number, so producers and consumers only contend on one atomic
+// position each and never take a lock. ENTRIES must be a power of two.
+template <typename T, size_t ENTRIES>
+class LockFreeQueue {
+  static_assert((ENTRIES >= 2) && ((ENTRIES & (ENTRIES - 1)) == 0), "ENTRIES must be a power of two");
+
+  private:
+    struct cell_struct {
+      std::atomic<size_t> sequence;
+      T data;
+    };
+
+    cell_struct _cells[ENTRIES];
+    std::atomic<size_t> _enqueuePosition;
+    std::atomic<size_t> _dequeuePosition;
+
+  public:
+    LockFreeQueue() {
+      for (size_t i = 0; i < ENTRIES; i++) {
+        _cells[i].sequence.store(i, std::memory_order_relaxed);
+      }
+      _enqueuePosition.store(0, std::memory_order_relaxed);
+      _dequeuePosition.store(0, std::memory_order_relaxed);
+    };
+
+    // Returns false when the queue is full
+    bool push(const T& item) {
+      cell_struct* cell;
+      size_t position = _enqueuePosition.load(std::memory_order_relaxed);
+      while (true) {
+        cell = &_cells[position & (ENTRIES - 1)];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        intptr_t difference = (intptr_t) sequence - (intptr_t) position;
+        if (difference == 0) {
+          if (_enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+            break;
+          }
+        } else if (difference < 0) {
+          return false;
+        } else {
+          position = _enqueuePosition.load(std::memory_order_relaxed);
+        }
+      }
+
+      cell->data = item;
+      cell->sequence.store(position + 1, std::memory_order_release);
+
+      return true;
+    };
+
+    // Returns false when the queue is empty
+    bool pop(T* item) {
+      cell_struct* cell;
+      size_t position = _dequeuePosition.load(std::memory_order_relaxed);
+      while (true) {
+        cell = &_cells[position & (ENTRIES - 1)];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        intptr_t difference = (intptr_t) sequence - (intptr_t) (position + 1);
+        if (difference == 0) {
+          if (_dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+            break;
+          }
+        } else if (difference < 0) {
+          return false;
+        } else {
+          position = _dequeuePosition.load(std::memory_order_relaxed);
+        }
+      }
+
+      *item = cell->data;
+      cell->sequence.store(position + ENTRIES, std::memory_order_release);
+
+      return true;
+    };
+
+    // Only meaningful when there is a single consumer
+    bool peek(T* item) {
+      size_t position = _dequeuePosition.load(std::memory_order_relaxed);
+      cell_struct* cell = &_cells[position & (ENTRIES - 1)];
+      if (cell->sequence.load(std::memory_order_acquire) != (position + 1)) {
+        return false;
+      }
+
+      *item = cell->data;
+
+      return true;
+    };
+
+    size_t count() {
+      size_t enqueuePosition = _enqueuePosition.load(std::memory_order_relaxed);
+      size_t dequeuePosition = _dequeuePosition.load(std::memory_order_relaxed);
+
+      return (enqueuePosition >= dequeuePosition ? enqueuePosition - dequeuePosition : 0);
+    };
+
+    bool isEmpty() {
+      return count() == 0;
+    };
+};
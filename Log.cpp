@@ -0,0 +1,144 @@
+#include "Log.h"
+#include "LockFreeQueue.h"
+#include "Metrics.h"
+
+#define LOG_QUEUE_ENTRIES 128
+#define LOG_TASK_STACK_SIZE 4096
+#define LOG_TASK_IDLE_DELAY 10  // In ticks
+#define LOG_BINARY_SYNC_0 0xA5
+#define LOG_BINARY_SYNC_1 0x5A
+
+static const char logLevelNames[] = { '-', 'E', 'W', 'I', 'D' };
+
+static LockFreeQueue<struct logRecord_struct, LOG_QUEUE_ENTRIES> logQueue;
+static volatile bool logBinaryOutput = false;
+
+// Formats one record by walking the printf conversions of its format string and
+// handing each one the matching raw argument
+static void formatRecord(const struct logRecord_struct* record, char* buffer, size_t size) {
+  const char* format = (record->formatId < LOG_FORMAT_COUNT ? logFormats[record->formatId] : "unknown log format");
+  size_t length = snprintf(buffer, size, "[%lu] %c ",
+                           (unsigned long) (record->timestamp / 1000),
+                           logLevelNames[record->level < sizeof(logLevelNames) ? record->level : 0]);
+  uint argIndex = 0;
+
+  while ((*format != '\0') &&
+         (length < (size - 1))) {
+    if (*format != '%') {
+      buffer[length++] = *format++;
+      continue;
+    }
+
+    if (format[1] == '%') {
+      buffer[length++] = '%';
+      format += 2;
+      continue;
+    }
+
+    char specifier[16];
+    uint specifierLength = 0;
+    uint longCount = 0;
+    while ((*format != '\0') &&
+           (specifierLength < (sizeof(specifier) - 1))) {
+      char c = *format++;
+      specifier[specifierLength++] = c;
+      if (c == 'l') {
+        longCount++;
+      }
+      if (strchr("diuxXcfFeEgGsp", c) && (specifierLength > 1)) {
+        break;
+      }
+    }
+    specifier[specifierLength] = '\0';
+
+    char conversion = specifier[specifierLength - 1];
+    int written;
+    if (logLongWords(longCount) == 2) {
+      uint64_t value = 0;
+      if ((argIndex + 1) < record->argCount) {
+        value = record->args[argIndex] | ((uint64_t) record->args[argIndex + 1] << 32);
+      }
+      argIndex += 2;
+      written = snprintf(&buffer[length], size - length, specifier, value);
+    } else if (strchr("fFeEgG", conversion)) {
+      float value = 0.0;
+      if (argIndex < record->argCount) {
+        memcpy(&value, &record->args[argIndex], sizeof(value));
+      }
+      argIndex++;
+      written = snprintf(&buffer[length], size - length, specifier, (double) value);
+    } else if (conversion == 's') {
+      const char* value = "";
+      if (argIndex < record->argCount) {
+        value = (const char*) (uintptr_t) record->args[argIndex];
+      }
+      argIndex++;
+      written = snprintf(&buffer[length], size - length, specifier, value);
+    } else {
+      uint32_t value = (argIndex < record->argCount ? record->args[argIndex] : 0);
+      argIndex++;
+      written = snprintf(&buffer[length], size - length, specifier, value);
+    }
+
+    if (written > 0) {
+      length += written;
+      if (length >= size) {
+        length = size - 1;
+      }
+    }
+  }
+
+  buffer[length] = '\0';
+}
+
+static void vLogTask(void* pvParameters) {
+  while (true) {
+    struct logRecord_struct record;
+    if (!logQueue.pop(&record)) {
+      vTaskDelay(LOG_TASK_IDLE_DELAY);
+      continue;
+    }
+
+    if (logBinaryOutput) {
+      // Sync bytes followed by the header and only the argument words in use
+      Serial.write(LOG_BINARY_SYNC_0);
+      Serial.write(LOG_BINARY_SYNC_1);
+      Serial.write((const uint8_t*) &record, sizeof(record) - sizeof(record.args) + (record.argCount * sizeof(uint32_t)));
+    } else {
+      char buffer[255];
+      formatRecord(&record, buffer, sizeof(buffer));
+      Serial.println(buffer);
+    }
+  }
+}
+
+namespace Log {
+  void setup() {
+    TaskHandle_t xHandle = NULL;
+    BaseType_t xReturned = xTaskCreate(
+      vLogTask,
+      "Log",
+      LOG_TASK_STACK_SIZE,
+      NULL,
+      tskIDLE_PRIORITY + 1,
+      &xHandle);
+
+    if (xReturned != pdPASS) {
+      Serial.println("LogTask could not be created");
+    }
+    Metrics::registerTask(xHandle);
+  }
+
+  void setBinaryOutput(bool binaryOutput) {
+    logBinaryOutput = binaryOutput;
+  }
+
+  bool push(const struct logRecord_struct* record) {
+    if (!logQueue.push(*record)) {
+      Metrics::increment(METRIC_LOG_DROPPED);
+      return false;
+    }
+
+    return true;
+  }
+}
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <Arduino.h>
+#include <inttypes.h>
+#include <type_traits>
+#include "lora-cgm-sender.ino.globals.h"
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#if !defined(LOG_LEVEL)
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Every log message is identified by a format ID. The argument types are taken
+// from the printf conversions when the record is formatted (%d/%u/%x are 32 bits,
+// %lld/PRId64 are 64 bits, %f is a float, %s must point at a string literal).
+// New formats are appended to the end so that binary captures stay decodable.
+#define LOG_FORMATS(X) \
+  X(LOG_LORA_SEND, "Sending packet: device ID = %u, counter = %u, type = %u, length = %u") \
+  X(LOG_LORA_SEND_NETWORK_TIME, "LoRa: sending network time") \
+  X(LOG_LORA_RECEIVE, "Received message, size = %d with RSSI %d") \
+  X(LOG_LORA_DECRYPT_ERROR, "Received message could not be decrypted (error %u)") \
+  X(LOG_LORA_MESSAGE, "Received message from device id = %u, message type = %u") \
+  X(LOG_LORA_WRONG_LENGTH, "error: the message has the wrong length. It is %u byte(s) long, but must be at least %u bytes") \
+  X(LOG_LORA_TIME, "\"time messageId %u with deviceId = %u at time %" PRId64 "\"") \
+  X(LOG_LORA_SET_TIME, "Setting time to %" PRId64 " with daylight timezone offset %d") \
+  X(LOG_LORA_BOOT_SYNC, "\"boot-sync messageId %u with deviceId = %u, appId = %u, version = %u.%u.%u at time %" PRId64 "\"") \
+  X(LOG_LORA_CGM, "\"messageId %u with cgm reading = %u at time %" PRId64 "\"") \
+  X(LOG_LORA_PROPANE, "\"messageId %u with propane reading = %u at time %" PRId64 "\"") \
+  X(LOG_LORA_TEMPERATURES, "\"messageId %u with temperature readings (IT) = %f, (IH) = %u, (OT) = %f, (OH) = %u at time %" PRId64 "\"") \
+  X(LOG_LORA_UNKNOWN_TYPE, "unknown message type %u") \
+  X(LOG_DISPLAY_TIME, "Current time: %02d:%02d (%" PRId64 ")") \
+  X(LOG_HTTPS_CONNECT_FAILED, "[HTTPS] %s: unable to connect") \
+  X(LOG_HTTPS_REQUEST_FAILED, "[HTTPS] %s: request failed, error: %d") \
+  X(LOG_HTTPS_RESPONSE_CODE, "[HTTPS] %s: request not processed due to response code %d") \
+  X(LOG_LORA_TELEMETRY, "\"telemetry messageId %u from deviceId = %u with uptime %u s\"") \
+  X(LOG_DATA_CHANGED, "Data changed: %s = %f") \
+  X(LOG_LORA_CHANNEL, "\"messageId %u with %s = %f, %u s old\"") \
+  X(LOG_LORA_UNKNOWN_CHANNEL, "unknown channel %u, ignoring the rest of the message") \
+  X(LOG_ALERT, "Alert %u: %s at %f mg/dL") \
+  X(LOG_ALERT_OVER_BUDGET, "Alert %u drawn %u ms after it was raised") \
+  X(LOG_LORA_ALERT, "\"messageId %u with alert %u: %s at %f mg/dL\"") \
+  X(LOG_LORA_ALERT_ACK, "\"messageId %u acknowledging alert %u from device %u\"") \
+  X(LOG_LORA_ALERT_UNACKNOWLEDGED, "alert %u was not acknowledged by %x") \
+  X(LOG_TIMEZONE_UPDATED, "Timezone: %u transitions, standard offset %d s") \
+  X(LOG_TIMEZONE_NOT_SAVED, "Timezone: unable to save the transition table") \
+  X(LOG_RENDERER_NO_SPRITES, "Renderer: no memory for %u sprite(s) of %ux%u, drawing straight to the panel")
+
+#define LOG_FORMAT_ENUM(id, format) id,
+enum logFormat_enum : uint16_t {
+  LOG_FORMATS(LOG_FORMAT_ENUM)
+  LOG_FORMAT_COUNT
+};
+#undef LOG_FORMAT_ENUM
+
+#define LOG_FORMAT_STRING(id, format) format,
+constexpr const char* logFormats[] = {
+  LOG_FORMATS(LOG_FORMAT_STRING)
+};
+#undef LOG_FORMAT_STRING
+
+// 32-bit words of a conversion with longCount 'l' modifiers, as the formatter reads them
+constexpr uint8_t logLongWords(uint8_t longCount) {
+  return ((longCount >= 2) || ((longCount == 1) && (sizeof(long) > sizeof(uint32_t)))) ? 2 : 1;
+}
+
+constexpr bool logIsConversion(char c, const char* conversions = "diuxXcfFeEgGsp") {
+  return (*conversions != '\0') && ((*conversions == c) || logIsConversion(c, conversions + 1));
+}
+
+constexpr uint8_t logFormatWords(const char* format);
+
+// From just after the '%' to the conversion character
+constexpr uint8_t logSpecifierWords(const char* format, uint8_t longCount) {
+  return (*format == '\0') ? 0 :
+         logIsConversion(*format) ? (logLongWords(longCount) + logFormatWords(format + 1)) :
+         logSpecifierWords(format + 1, longCount + ((*format == 'l') ? 1 : 0));
+}
+
+// The argument words a format reads, checked against the arguments of every log call
+constexpr uint8_t logFormatWords(const char* format) {
+  return (*format == '\0') ? 0 :
+         (*format != '%') ? logFormatWords(format + 1) :
+         (format[1] == '%') ? logFormatWords(format + 2) :
+         logSpecifierWords(format + 1, 0);
+}
+
+#define LOG_MAX_ARGS 8
+struct logRecord_struct {
+  uint32_t timestamp;  // micros()
+  uint16_t formatId;
+  uint8_t level;
+  uint8_t argCount;  // In 32-bit words
+  uint32_t args[LOG_MAX_ARGS];
+};
+
+namespace Log {
+  void setup();
+  void setBinaryOutput(bool binaryOutput);
+  bool push(const struct logRecord_struct* record);
+
+  inline void pack(struct logRecord_struct* record) {
+  }
+
+  template <typename T, typename... Args>
+  inline void pack(struct logRecord_struct* record, T value, Args... args);
+
+  template <typename T>
+  inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, void>::type
+  packValue(struct logRecord_struct* record, T value) {
+    if ((sizeof(T) > sizeof(uint32_t)) &&
+        (record->argCount < (LOG_MAX_ARGS - 1))) {
+      uint64_t wide = (uint64_t) value;
+      record->args[record->argCount++] = (uint32_t) wide;
+      record->args[record->argCount++] = (uint32_t) (wide >> 32);
+    } else if ((sizeof(T) <= sizeof(uint32_t)) &&
+               (record->argCount < LOG_MAX_ARGS)) {
+      record->args[record->argCount++] = (uint32_t) value;
+    }
+  }
+
+  template <typename T>
+  inline typename std::enable_if<std::is_floating_point<T>::value, void>::type
+  packValue(struct logRecord_struct* record, T value) {
+    if (record->argCount < LOG_MAX_ARGS) {
+      float narrow = (float) value;
+      memcpy(&record->args[record->argCount++], &narrow, sizeof(narrow));
+    }
+  }
+
+  inline void packValue(struct logRecord_struct* record, const char* value) {
+    if (record->argCount < LOG_MAX_ARGS) {
+      record->args[record->argCount++] = (uint32_t) (uintptr_t) value;
+    }
+  }
+
+  template <typename T, typename... Args>
+  inline void pack(struct logRecord_struct* record, T value, Args... args) {
+    packValue(record, value);
+    pack(record, args...);
+  }
+
+  // The argument words pack() stores
+  template <typename... Args>
+  struct argWords {
+    static constexpr uint8_t value = 0;
+  };
+
+  template <typename T, typename... Args>
+  struct argWords<T, Args...> {
+    static constexpr uint8_t value = ((((std::is_integral<T>::value || std::is_enum<T>::value) &&
+                                        (sizeof(T) > sizeof(uint32_t))) ? 2 : 1) +
+                                      argWords<Args...>::value);
+  };
+
+  template <uint16_t formatId, typename... Args>
+  inline void write(uint8_t level, Args... args) {
+    static_assert(logFormatWords(logFormats[formatId]) == argWords<Args...>::value,
+                  "The log arguments don't match the format, cast 64-bit values such as time_t to int64_t");
+    static_assert(argWords<Args...>::value <= LOG_MAX_ARGS, "Too many log arguments");
+    struct logRecord_struct record;
+
+    record.timestamp = micros();
+    record.formatId = formatId;
+    record.level = level;
+    record.argCount = 0;
+    pack(&record, args...);
+    push(&record);
+  }
+};
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(formatId, ...) Log::write<formatId>(LOG_LEVEL_ERROR, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(...) do { } while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(formatId, ...) Log::write<formatId>(LOG_LEVEL_WARN, ##__VA_ARGS__)
+#else
+#define LOG_WARN(...) do { } while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(formatId, ...) Log::write<formatId>(LOG_LEVEL_INFO, ##__VA_ARGS__)
+#else
+#define LOG_INFO(...) do { } while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(formatId, ...) Log::write<formatId>(LOG_LEVEL_DEBUG, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do { } while (0)
+#endif
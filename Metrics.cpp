@@ -0,0 +1,299 @@
+#include "Metrics.h"
+#include "TimerWheel.h"
+
+#define METRIC_NAME(id, name) name,
+static const char* const counterNames[] = { METRICS_COUNTERS(METRIC_NAME) };
+static const char* const gaugeNames[] = { METRICS_GAUGES(METRIC_NAME) };
+static const char* const histogramNames[] = { METRICS_HISTOGRAMS(METRIC_NAME) };
+static const char* const loRaMessageTypeNames[] = { METRICS_LORA_MESSAGE_TYPES(METRIC_NAME) "other" };
+#undef METRIC_NAME
+
+#define METRIC_MESSAGE_TYPE(type, name) type,
+static const uint16_t loRaMessageTypes[] = { METRICS_LORA_MESSAGE_TYPES(METRIC_MESSAGE_TYPE) };
+#undef METRIC_MESSAGE_TYPE
+
+#define METRIC_ENDPOINT_NAME(name) name,
+static const char* const httpsEndpointNames[] = { METRICS_HTTPS_ENDPOINTS(METRIC_ENDPOINT_NAME) };
+#undef METRIC_ENDPOINT_NAME
+
+static std::atomic<uint32_t> counters[METRIC_COUNTER_COUNT];
+static std::atomic<int32_t> gauges[METRIC_GAUGE_COUNT];
+static MetricsHistogram histograms[METRIC_HISTOGRAM_COUNT];
+
+static std::atomic<uint32_t> loRaPacketsTransmitted[METRICS_LORA_MESSAGE_TYPE_COUNT];
+static std::atomic<uint32_t> loRaPacketsReceived[METRICS_LORA_MESSAGE_TYPE_COUNT];
+static std::atomic<uint32_t> httpsFailures[METRICS_HTTPS_ENDPOINT_COUNT];
+static MetricsHistogram httpsLatency[METRICS_HTTPS_ENDPOINT_COUNT];
+
+static TaskHandle_t tasks[METRICS_MAX_TASKS];
+static std::atomic<uint> taskCount(0);
+
+struct fleetDevice_struct {
+  uint16_t deviceId;
+  unsigned long lastSeen;
+  struct telemetry_struct telemetry;
+};
+static struct fleetDevice_struct fleet[METRICS_MAX_FLEET_DEVICES];
+static uint fleetCount = 0;
+static portMUX_TYPE fleetMux = portMUX_INITIALIZER_UNLOCKED;
+
+MetricsHistogram::MetricsHistogram() {
+  reset();
+}
+
+void MetricsHistogram::record(uint32_t value) {
+  uint bucket = (value == 0 ? 0 : 32 - __builtin_clz(value));
+  if (bucket >= METRICS_HISTOGRAM_BUCKETS) {
+    bucket = METRICS_HISTOGRAM_BUCKETS - 1;
+  }
+  _buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+  _count.fetch_add(1, std::memory_order_relaxed);
+
+  uint32_t max = _max.load(std::memory_order_relaxed);
+  while ((value > max) &&
+         !_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+  }
+}
+
+void MetricsHistogram::reset() {
+  for (uint i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++) {
+    _buckets[i].store(0, std::memory_order_relaxed);
+  }
+  _count.store(0, std::memory_order_relaxed);
+  _max.store(0, std::memory_order_relaxed);
+}
+
+// Returns the upper bound of the bucket holding the percentile, capped at the maximum seen
+uint32_t MetricsHistogram::percentile(uint percent, uint scale) {
+  uint32_t count = _count.load(std::memory_order_relaxed);
+  if (count == 0) {
+    return 0;
+  }
+
+  uint32_t target = (uint32_t) (((uint64_t) count * percent + (scale - 1)) / scale);
+  uint32_t seen = 0;
+  for (uint i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++) {
+    seen += _buckets[i].load(std::memory_order_relaxed);
+    if (seen >= target) {
+      uint32_t upperBound = (i == 0 ? 0 : (i >= 32 ? UINT32_MAX : (uint32_t) ((1ULL << i) - 1)));
+      uint32_t max = _max.load(std::memory_order_relaxed);
+
+      return (upperBound < max ? upperBound : max);
+    }
+  }
+
+  return _max.load(std::memory_order_relaxed);
+}
+
+void MetricsHistogram::print(Print* out, const char* name) {
+  out->printf("%s count=%u p50=%u p90=%u p99=%u max=%u\n",
+              name,
+              count(),
+              percentile(50),
+              percentile(90),
+              percentile(99),
+              max());
+}
+
+static uint loRaMessageTypeIndex(uint16_t messageType) {
+  uint i;
+  for (i = 0; i < (METRICS_LORA_MESSAGE_TYPE_COUNT - 1); i++) {
+    if (loRaMessageTypes[i] == messageType) {
+      break;
+    }
+  }
+
+  return i;
+}
+
+static int httpsEndpointIndex(const char* requestType) {
+  for (uint i = 0; i < METRICS_HTTPS_ENDPOINT_COUNT; i++) {
+    if (strcmp(requestType, httpsEndpointNames[i]) == 0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+static uint32_t sum(std::atomic<uint32_t>* values, uint count) {
+  uint32_t total = 0;
+  for (uint i = 0; i < count; i++) {
+    total += values[i].load(std::memory_order_relaxed);
+  }
+
+  return total;
+}
+
+static uint32_t minStackHighWaterMark() {
+  uint32_t minimum = UINT32_MAX;
+  uint count = taskCount.load(std::memory_order_acquire);
+  for (uint i = 0; i < count; i++) {
+    uint32_t highWaterMark = uxTaskGetStackHighWaterMark(tasks[i]);
+    if (highWaterMark < minimum) {
+      minimum = highWaterMark;
+    }
+  }
+
+  return minimum;
+}
+
+static void sampleGauges() {
+  Metrics::setGauge(METRIC_HEAP_FREE, ESP.getFreeHeap());
+  Metrics::setGauge(METRIC_HEAP_MIN_FREE, ESP.getMinFreeHeap());
+
+  uint64_t untilNext = TimerWheel::untilNext();
+  Metrics::setGauge(METRIC_TIMER_NEXT_DEADLINE, (untilNext == UINT64_MAX ? -1 : (int32_t) min(untilNext, (uint64_t) INT32_MAX)));
+}
+
+namespace Metrics {
+  void increment(metricCounter_enum counter, uint32_t amount) {
+    counters[counter].fetch_add(amount, std::memory_order_relaxed);
+  }
+
+  void setGauge(metricGauge_enum gauge, int32_t value) {
+    gauges[gauge].store(value, std::memory_order_relaxed);
+  }
+
+  void record(metricHistogram_enum histogram, uint32_t value) {
+    histograms[histogram].record(value);
+  }
+
+  void countLoRaPacket(bool transmitted, uint16_t messageType) {
+    uint index = loRaMessageTypeIndex(messageType);
+    if (transmitted) {
+      loRaPacketsTransmitted[index].fetch_add(1, std::memory_order_relaxed);
+    } else {
+      loRaPacketsReceived[index].fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  void recordHttpsCall(const char* requestType, bool succeeded, uint32_t latencyMicros) {
+    int index = httpsEndpointIndex(requestType);
+    if (index < 0) {
+      return;
+    }
+
+    httpsLatency[index].record(latencyMicros);
+    if (!succeeded) {
+      httpsFailures[index].fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  void registerTask(TaskHandle_t task) {
+    uint index = taskCount.load(std::memory_order_relaxed);
+    if ((task == NULL) ||
+        (index >= METRICS_MAX_TASKS)) {
+      return;
+    }
+
+    tasks[index] = task;
+    taskCount.store(index + 1, std::memory_order_release);
+  }
+
+  void recordTelemetry(uint16_t deviceId, const struct telemetry_struct* telemetry) {
+    portENTER_CRITICAL(&fleetMux);
+    uint i;
+    for (i = 0; i < fleetCount; i++) {
+      if (fleet[i].deviceId == deviceId) {
+        break;
+      }
+    }
+
+    if (i < METRICS_MAX_FLEET_DEVICES) {
+      if (i == fleetCount) {
+        fleetCount++;
+      }
+      fleet[i].deviceId = deviceId;
+      fleet[i].lastSeen = millis();
+      fleet[i].telemetry = *telemetry;
+    }
+    portEXIT_CRITICAL(&fleetMux);
+  }
+
+  void buildTelemetry(struct telemetry_struct* telemetry) {
+    sampleGauges();
+
+    uint32_t httpsLatencyP99 = 0;
+    for (uint i = 0; i < METRICS_HTTPS_ENDPOINT_COUNT; i++) {
+      uint32_t p99 = httpsLatency[i].percentile(99);
+      if (p99 > httpsLatencyP99) {
+        httpsLatencyP99 = p99;
+      }
+    }
+
+    uint32_t stackHighWaterMark = minStackHighWaterMark();
+
+    memset(telemetry, 0, sizeof(struct telemetry_struct));
+    telemetry->uptime = millis() / 1000;
+    telemetry->packetsTransmitted = sum(loRaPacketsTransmitted, METRICS_LORA_MESSAGE_TYPE_COUNT) & 0xFFFF;
+    telemetry->packetsReceived = sum(loRaPacketsReceived, METRICS_LORA_MESSAGE_TYPE_COUNT) & 0xFFFF;
+    telemetry->decryptFailures = counters[METRIC_LORA_DECRYPT_FAILURES].load(std::memory_order_relaxed) & 0xFFFF;
+    telemetry->httpsFailures = sum(httpsFailures, METRICS_HTTPS_ENDPOINT_COUNT) & 0xFFFF;
+    telemetry->timeOnAir = (counters[METRIC_LORA_TIME_ON_AIR].load(std::memory_order_relaxed) / 1000) & 0xFFFF;
+    telemetry->freeHeap = (gauges[METRIC_HEAP_FREE].load(std::memory_order_relaxed) / 256) & 0xFFFF;
+    telemetry->minFreeHeap = (gauges[METRIC_HEAP_MIN_FREE].load(std::memory_order_relaxed) / 256) & 0xFFFF;
+    telemetry->minStackHighWaterMark = (stackHighWaterMark > 0xFFFF ? 0xFFFF : stackHighWaterMark);
+    telemetry->wifiReconnects = counters[METRIC_WIFI_RECONNECTS].load(std::memory_order_relaxed) & 0xFFFF;
+    telemetry->httpsLatencyP99 = ((httpsLatencyP99 / 1000) > 0xFFFF ? 0xFFFF : (httpsLatencyP99 / 1000));
+    int32_t queueDepth = gauges[METRIC_LORA_QUEUE_DEPTH].load(std::memory_order_relaxed);
+    telemetry->queueDepth = (queueDepth > 0xFF ? 0xFF : queueDepth);
+  }
+
+  void dump(Print* out) {
+    sampleGauges();
+
+    out->println("--- metrics ---");
+    for (uint i = 0; i < METRIC_COUNTER_COUNT; i++) {
+      out->printf("%s %u\n", counterNames[i], counters[i].load(std::memory_order_relaxed));
+    }
+    for (uint i = 0; i < METRIC_GAUGE_COUNT; i++) {
+      out->printf("%s %d\n", gaugeNames[i], gauges[i].load(std::memory_order_relaxed));
+    }
+    for (uint i = 0; i < METRICS_LORA_MESSAGE_TYPE_COUNT; i++) {
+      out->printf("lora.tx.%s %u\n", loRaMessageTypeNames[i], loRaPacketsTransmitted[i].load(std::memory_order_relaxed));
+      out->printf("lora.rx.%s %u\n", loRaMessageTypeNames[i], loRaPacketsReceived[i].load(std::memory_order_relaxed));
+    }
+    for (uint i = 0; i < METRICS_HTTPS_ENDPOINT_COUNT; i++) {
+      char name[48];
+      snprintf(name, sizeof(name), "https.%s.failures", httpsEndpointNames[i]);
+      out->printf("%s %u\n", name, httpsFailures[i].load(std::memory_order_relaxed));
+      snprintf(name, sizeof(name), "https.%s.latency_us", httpsEndpointNames[i]);
+      httpsLatency[i].print(out, name);
+    }
+    for (uint i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {
+      histograms[i].print(out, histogramNames[i]);
+    }
+
+    uint count = taskCount.load(std::memory_order_acquire);
+    for (uint i = 0; i < count; i++) {
+      out->printf("task.%s.stack_high_water_mark %u\n", pcTaskGetName(tasks[i]), uxTaskGetStackHighWaterMark(tasks[i]));
+    }
+
+    struct fleetDevice_struct snapshot[METRICS_MAX_FLEET_DEVICES];
+    portENTER_CRITICAL(&fleetMux);
+    uint snapshotCount = fleetCount;
+    memcpy(snapshot, fleet, sizeof(fleet));
+    portEXIT_CRITICAL(&fleetMux);
+
+    for (uint i = 0; i < snapshotCount; i++) {
+      struct telemetry_struct* telemetry = &snapshot[i].telemetry;
+      out->printf("fleet.%u uptime=%u tx=%u rx=%u decrypt_failures=%u https_failures=%u time_on_air_s=%u "
+                  "heap=%u min_heap=%u min_stack=%u wifi_reconnects=%u https_p99_ms=%u queue=%u age_s=%lu\n",
+                  snapshot[i].deviceId,
+                  telemetry->uptime,
+                  telemetry->packetsTransmitted,
+                  telemetry->packetsReceived,
+                  telemetry->decryptFailures,
+                  telemetry->httpsFailures,
+                  telemetry->timeOnAir,
+                  telemetry->freeHeap * 256,
+                  telemetry->minFreeHeap * 256,
+                  telemetry->minStackHighWaterMark,
+                  telemetry->wifiReconnects,
+                  telemetry->httpsLatencyP99,
+                  telemetry->queueDepth,
+                  (millis() - snapshot[i].lastSeen) / 1000);
+    }
+  }
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+#define METRICS_COUNTERS(X) \
+  X(METRIC_LORA_DECRYPT_FAILURES, "lora.decrypt_failures") \
+  X(METRIC_LORA_QUEUE_OVERFLOWS, "lora.queue_overflows") \
+  X(METRIC_LORA_TIME_ON_AIR, "lora.time_on_air_ms") \
+  X(METRIC_WIFI_RECONNECTS, "wifi.reconnects") \
+  X(METRIC_LOG_DROPPED, "log.dropped") \
+  X(METRIC_HISTORY_FLASH_WRITES, "history.flash_writes") \
+  X(METRIC_ALERT_RETRANSMISSIONS, "alert.retransmissions") \
+  X(METRIC_ALERT_UNACKNOWLEDGED, "alert.unacknowledged") /* Gave up on a display */ \
+  X(METRIC_ALERT_OVER_BUDGET, "alert.over_budget") /* Drawn later than ALERT_LATENCY_BUDGET */ \
+  X(METRIC_DISPLAY_GRAPH_SPI_BYTES, "display.graph_spi_bytes") \
+  X(METRIC_DISPLAY_PIXELS, "display.pixels") /* Pushed to the panel */ \
+  X(METRIC_DISPLAY_WINDOWS, "display.windows") /* Address windows set on the panel, one SPI transaction each */ \
+  X(METRIC_DISPLAY_DEFERRED, "display.deferred") /* Widgets left to the next loop by the frame budget */ \
+  X(METRIC_DISPLAY_OVER_BUDGET, "display.over_budget") /* Loops that ran past DISPLAY_FRAME_BUDGET */ \
+  X(METRIC_HTTPS_CONNECTS, "https.connects") /* Requests that needed a new TLS connection */ \
+  X(METRIC_HTTPS_REUSED, "https.reused") /* Requests sent over a kept connection */ \
+  X(METRIC_HTTPS_RETRIES, "https.retries") /* Kept connections found closed by the server */
+
+#define METRICS_GAUGES(X) \
+  X(METRIC_LORA_QUEUE_DEPTH, "lora.queue_depth") \
+  X(METRIC_HEAP_FREE, "heap.free") \
+  X(METRIC_HEAP_MIN_FREE, "heap.min_free") \
+  X(METRIC_TIMER_NEXT_DEADLINE, "timers.next_deadline_ms")  /* -1 if no timer is queued */
+
+#define METRICS_HISTOGRAMS(X) \
+  X(METRIC_JSON_PARSE_TIME, "json.parse_us") \
+  X(METRIC_DISPLAY_FRAME_TIME, "display.frame_us") \
+  X(METRIC_DISPLAY_GRAPH_UPDATE_BYTES, "display.graph_update_bytes") /* SPI bytes per new reading */ \
+  X(METRIC_DISPLAY_FRAME_PIXELS, "display.frame_pixels") /* Pushed per loop() that drew anything */ \
+  X(METRIC_DISPLAY_BLOCKED_TIME, "display.blocked_us") /* Waiting on SPI in the same loops */ \
+  X(METRIC_ALERT_QUEUE_TIME, "alert.queue_ms") /* Raised -> first transmission started, on the collector */ \
+  X(METRIC_ALERT_ACK_TIME, "alert.ack_ms") /* Raised -> acknowledged, per display */ \
+  X(METRIC_ALERT_RENDER_TIME, "alert.render_ms") /* Raised -> drawn, on every display */
+
+// LoRa message types that get their own TX/RX counters. Anything else is counted as "other".
+#define METRICS_LORA_MESSAGE_TYPES(X) \
+  X(1, "time") \
+  X(2, "boot_sync") \
+  X(29, "cgm") \
+  X(30, "propane") \
+  X(31, "temperature") \
+  X(32, "channels") \
+  X(33, "alert") \
+  X(34, "alert_ack") \
+  X(40, "telemetry")
+
+// Matches the requestType strings passed to callApi
+#define METRICS_HTTPS_ENDPOINTS(X) \
+  X("timezoneInfo") \
+  X("cgmLogin") \
+  X("cgmNologin") \
+  X("propane") \
+  X("temperature")
+
+#define METRIC_ENUM(id, name) id,
+enum metricCounter_enum : uint8_t { METRICS_COUNTERS(METRIC_ENUM) METRIC_COUNTER_COUNT };
+enum metricGauge_enum : uint8_t { METRICS_GAUGES(METRIC_ENUM) METRIC_GAUGE_COUNT };
+enum metricHistogram_enum : uint8_t { METRICS_HISTOGRAMS(METRIC_ENUM) METRIC_HISTOGRAM_COUNT };
+#undef METRIC_ENUM
+
+#define METRIC_COUNT_ONE(...) + 1
+#define METRICS_LORA_MESSAGE_TYPE_COUNT (0 METRICS_LORA_MESSAGE_TYPES(METRIC_COUNT_ONE) + 1)  // Plus "other"
+#define METRICS_HTTPS_ENDPOINT_COUNT (0 METRICS_HTTPS_ENDPOINTS(METRIC_COUNT_ONE))
+
+#define METRICS_MAX_TASKS 8
+#define METRICS_MAX_FLEET_DEVICES 8
+
+// Fixed log2 buckets: bucket n holds values in [2^(n-1), 2^n)
+#define METRICS_HISTOGRAM_BUCKETS 32
+class MetricsHistogram {
+  private:
+    std::atomic<uint32_t> _buckets[METRICS_HISTOGRAM_BUCKETS];
+    std::atomic<uint32_t> _count;
+    std::atomic<uint32_t> _max;
+
+  public:
+    MetricsHistogram();
+
+    void record(uint32_t value);
+    void reset();
+    uint32_t count() { return _count.load(std::memory_order_relaxed); };
+    uint32_t max() { return _max.load(std::memory_order_relaxed); };
+    uint32_t percentile(uint percent, uint scale = 100);  // percentile(999, 1000) is p99.9
+    void print(Print* out, const char* name);
+};
+
+// Compact periodic health report that every node broadcasts over LoRa
+struct telemetry_struct {
+  uint32_t uptime;  // In seconds
+  uint16_t packetsTransmitted;
+  uint16_t packetsReceived;
+  uint16_t decryptFailures;
+  uint16_t httpsFailures;
+  uint16_t timeOnAir;  // In seconds
+  uint16_t freeHeap;  // In 256 byte units
+  uint16_t minFreeHeap;  // In 256 byte units
+  uint16_t minStackHighWaterMark;  // In words
+  uint16_t wifiReconnects;
+  uint16_t httpsLatencyP99;  // In milliseconds
+  byte queueDepth;
+  byte padding0[3];
+};
+
+namespace Metrics {
+  void increment(metricCounter_enum counter, uint32_t amount = 1);
+  void setGauge(metricGauge_enum gauge, int32_t value);
+  void record(metricHistogram_enum histogram, uint32_t value);
+
+  void countLoRaPacket(bool transmitted, uint16_t messageType);
+  void recordHttpsCall(const char* requestType, bool succeeded, uint32_t latencyMicros);
+
+  void registerTask(TaskHandle_t task);
+  void recordTelemetry(uint16_t deviceId, const struct telemetry_struct* telemetry);
+  void buildTelemetry(struct telemetry_struct* telemetry);
+
+  void dump(Print* out);
+};
@@ -0,0 +1,129 @@
+#include "Profiler.h"
+
+#if defined(ENABLE_PROFILER)
+#include "Metrics.h"
+
+#define PROFILER_PHASE_NAME(id, name, task) name,
+static const char* const phaseNames[] = { PROFILER_PHASES(PROFILER_PHASE_NAME) };
+#undef PROFILER_PHASE_NAME
+
+#define PROFILER_PHASE_TASK(id, name, task) task,
+static const profilerTask_enum phaseTasks[] = { PROFILER_PHASES(PROFILER_PHASE_TASK) };
+#undef PROFILER_PHASE_TASK
+
+struct iteration_struct {
+  uint32_t number;
+  unsigned long millis;
+  uint32_t freeHeap;
+  uint32_t phaseCycles[PROFILER_PHASE_COUNT];
+};
+
+static MetricsHistogram phaseHistograms[PROFILER_PHASE_COUNT];
+
+// Each task only touches its own iteration state, so it needs no locking. The
+// report may read a worst iteration while it is being replaced.
+static struct iteration_struct currentIterations[PROFILER_TASK_COUNT];
+static struct iteration_struct worstIterations[PROFILER_TASK_COUNT][PROFILER_WORST_ITERATIONS];
+static uint32_t iterationCounts[PROFILER_TASK_COUNT];
+static uint32_t iterationStartCycles[PROFILER_TASK_COUNT];
+
+// The first phase listed for a task covers its whole iteration
+static profilerPhase_enum iterationPhase(profilerTask_enum task) {
+  uint phase = 0;
+  while (phaseTasks[phase] != task) {
+    phase++;
+  }
+
+  return (profilerPhase_enum) phase;
+}
+
+namespace Profiler {
+  void beginIteration(profilerTask_enum task) {
+    memset(currentIterations[task].phaseCycles, 0, sizeof(currentIterations[task].phaseCycles));
+    iterationStartCycles[task] = ESP.getCycleCount();
+  }
+
+  void endIteration(profilerTask_enum task) {
+    profilerPhase_enum phase = iterationPhase(task);
+    struct iteration_struct* currentIteration = &currentIterations[task];
+    struct iteration_struct* taskWorstIterations = worstIterations[task];
+
+    record(phase, ESP.getCycleCount() - iterationStartCycles[task]);
+
+    currentIteration->number = iterationCounts[task]++;
+    currentIteration->millis = millis();
+
+    // Replace the cheapest of the retained worst iterations
+    uint cheapest = 0;
+    for (uint i = 1; i < PROFILER_WORST_ITERATIONS; i++) {
+      if (taskWorstIterations[i].phaseCycles[phase] < taskWorstIterations[cheapest].phaseCycles[phase]) {
+        cheapest = i;
+      }
+    }
+    if (currentIteration->phaseCycles[phase] > taskWorstIterations[cheapest].phaseCycles[phase]) {
+      currentIteration->freeHeap = ESP.getFreeHeap();
+      taskWorstIterations[cheapest] = *currentIteration;
+    }
+  }
+
+  void record(profilerPhase_enum phase, uint32_t cycles) {
+    currentIterations[phaseTasks[phase]].phaseCycles[phase] += cycles;
+    phaseHistograms[phase].record(cycles);
+  }
+
+  void report(Print* out) {
+    uint32_t cyclesPerMicro = ESP.getCpuFreqMHz();
+
+    out->printf("--- profile (cycles @ %u MHz) ---\n", cyclesPerMicro);
+    for (uint i = 0; i < PROFILER_PHASE_COUNT; i++) {
+      MetricsHistogram* histogram = &phaseHistograms[i];
+      if (histogram->count() == 0) {
+        continue;
+      }
+
+      out->printf("%-20s count=%u p50=%u p90=%u p99=%u p99.9=%u max=%u (max %u us)\n",
+                  phaseNames[i],
+                  histogram->count(),
+                  histogram->percentile(50),
+                  histogram->percentile(90),
+                  histogram->percentile(99),
+                  histogram->percentile(999, 1000),
+                  histogram->max(),
+                  histogram->max() / cyclesPerMicro);
+    }
+
+    for (uint task = 0; task < PROFILER_TASK_COUNT; task++) {
+      profilerPhase_enum taskPhase = iterationPhase((profilerTask_enum) task);
+      for (uint i = 0; i < PROFILER_WORST_ITERATIONS; i++) {
+        struct iteration_struct* iteration = &worstIterations[task][i];
+        if (iteration->phaseCycles[taskPhase] == 0) {
+          continue;
+        }
+
+        out->printf("worst %s iteration %u of %u at %lu ms, %u us, free heap %u:",
+                    phaseNames[taskPhase],
+                    iteration->number,
+                    iterationCounts[task],
+                    iteration->millis,
+                    iteration->phaseCycles[taskPhase] / cyclesPerMicro,
+                    iteration->freeHeap);
+        for (uint phase = taskPhase + 1; phase < PROFILER_PHASE_COUNT; phase++) {
+          if ((phaseTasks[phase] == task) &&
+              (iteration->phaseCycles[phase] > 0)) {
+            out->printf(" %s=%u us", phaseNames[phase], iteration->phaseCycles[phase] / cyclesPerMicro);
+          }
+        }
+        out->println();
+      }
+    }
+  }
+
+  void reset() {
+    for (uint i = 0; i < PROFILER_PHASE_COUNT; i++) {
+      phaseHistograms[i].reset();
+    }
+    memset(worstIterations, 0, sizeof(worstIterations));
+    memset(iterationCounts, 0, sizeof(iterationCounts));
+  }
+}
+#endif
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <Arduino.h>
+#include "lora-cgm-sender.ino.globals.h"
+
+// Cycle-counter instrumentation for the task loops. Everything compiles away
+// unless ENABLE_PROFILER is defined in the globals header.
+//
+// Every phase belongs to one task, whose iteration is the first phase listed
+// for it. A phase must only be recorded from its own task.
+#define PROFILER_TASKS(X) \
+  X(PROFILE_TASK_LOOP) \
+  X(PROFILE_TASK_RADIO) \
+  X(PROFILE_TASK_DISPLAY)
+
+#define PROFILER_PHASES(X) \
+  X(PROFILE_LOOP, "loop", PROFILE_TASK_LOOP) \
+  X(PROFILE_LOOP_STORAGE, "loop.storage", PROFILE_TASK_LOOP) \
+  X(PROFILE_LOOP_COMMANDS, "loop.commands", PROFILE_TASK_LOOP) \
+  X(PROFILE_RADIO, "radio", PROFILE_TASK_RADIO) \
+  X(PROFILE_SYNC_QUEUE, "sync.queue", PROFILE_TASK_RADIO) \
+  X(PROFILE_SYNC_TELEMETRY, "sync.telemetry", PROFILE_TASK_RADIO) \
+  X(PROFILE_SYNC_SEND, "sync.send", PROFILE_TASK_RADIO) \
+  X(PROFILE_SYNC_RECEIVE, "sync.receive", PROFILE_TASK_RADIO) \
+  X(PROFILE_DISPLAY, "display", PROFILE_TASK_DISPLAY) \
+  X(PROFILE_DISPLAY_CLOCK, "display.clock", PROFILE_TASK_DISPLAY) \
+  X(PROFILE_DISPLAY_CGM, "display.cgm", PROFILE_TASK_DISPLAY) \
+  X(PROFILE_DISPLAY_PROPANE, "display.propane", PROFILE_TASK_DISPLAY) \
+  X(PROFILE_DISPLAY_TEMPERATURE, "display.temperature", PROFILE_TASK_DISPLAY) \
+  X(PROFILE_DISPLAY_CGM_TREND, "display.cgm_trend", PROFILE_TASK_DISPLAY) \
+  X(PROFILE_DISPLAY_CGM_GRAPH, "display.cgm_graph", PROFILE_TASK_DISPLAY)
+
+#define PROFILER_TASK_ENUM(id) id,
+enum profilerTask_enum : uint8_t { PROFILER_TASKS(PROFILER_TASK_ENUM) PROFILER_TASK_COUNT };
+#undef PROFILER_TASK_ENUM
+
+#define PROFILER_PHASE_ENUM(id, name, task) id,
+enum profilerPhase_enum : uint8_t { PROFILER_PHASES(PROFILER_PHASE_ENUM) PROFILER_PHASE_COUNT };
+#undef PROFILER_PHASE_ENUM
+
+#define PROFILER_WORST_ITERATIONS 4
+
+#if defined(ENABLE_PROFILER)
+namespace Profiler {
+  void beginIteration(profilerTask_enum task);
+  void endIteration(profilerTask_enum task);
+  void record(profilerPhase_enum phase, uint32_t cycles);
+  void report(Print* out);
+  void reset();
+};
+
+class ProfilerScope {
+  private:
+    profilerPhase_enum _phase;
+    uint32_t _startCycles;
+
+  public:
+    ProfilerScope(profilerPhase_enum phase) {
+      _phase = phase;
+      _startCycles = ESP.getCycleCount();
+    };
+    ~ProfilerScope() {
+      Profiler::record(_phase, ESP.getCycleCount() - _startCycles);
+    };
+};
+
+#define PROFILER_CONCAT_INNER(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(phase) ProfilerScope PROFILER_CONCAT(profilerScope, __LINE__)(phase)
+#define PROFILE_BEGIN_ITERATION(task) Profiler::beginIteration(task)
+#define PROFILE_END_ITERATION(task) Profiler::endIteration(task)
+#else
+#define PROFILE_SCOPE(phase) do { } while (0)
+#define PROFILE_BEGIN_ITERATION(task) do { } while (0)
+#define PROFILE_END_ITERATION(task) do { } while (0)
+#endif
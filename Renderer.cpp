@@ -0,0 +1,284 @@
+#include "Display.h"
+#include "Metrics.h"
+#include "Events.h"
+#include "Log.h"
+
+#if defined(DISPLAY_TYPE_TFT)
+Renderer::Renderer(TFT_eSPI* tft, bool offscreen)
+#if defined(RENDERER_DMA)
+    : _dmaTimer(EVENT_DISPLAY_TIMER)
+#endif
+{
+  _tft = tft;
+  _offscreen = offscreen;
+  _sprite = NULL;
+  _x = 0;
+  _y = 0;
+  _w = 0;
+  _h = 0;
+  memset(&_frame, 0, sizeof(_frame));
+#if defined(RENDERER_DMA)
+  _dma = false;
+  _firstJob = 0;
+  _jobCount = 0;
+  _bands[0] = NULL;
+  _bands[1] = NULL;
+  _band = 0;
+  _bandLines = 0;
+  _writing = false;
+#endif
+
+  // Once, before the heap is shared with the network
+  memset(_sprites, 0, sizeof(_sprites));
+  if (_offscreen) {
+    return;  // Already a framebuffer
+  }
+  uint8_t colorDepth = (((uint32_t) RENDERER_SPRITE_WIDTH * RENDERER_SPRITE_HEIGHT * 2) <= RENDERER_16_BIT_BYTES) ? 16 : 8;
+  for (uint i = 0; i < RENDERER_SPRITES; i++) {
+    _sprites[i] = new TFT_eSprite(_tft);
+    _sprites[i]->setColorDepth(colorDepth);
+    if (_sprites[i]->createSprite(RENDERER_SPRITE_WIDTH, RENDERER_SPRITE_HEIGHT) == NULL) {
+      LOG_WARN(LOG_RENDERER_NO_SPRITES, (uint32_t) RENDERER_SPRITES, (uint32_t) RENDERER_SPRITE_WIDTH, (uint32_t) RENDERER_SPRITE_HEIGHT);
+      _deleteSprites();
+      break;
+    }
+  }
+}
+
+Renderer::~Renderer() {
+  flush();
+  _deleteSprites();
+#if defined(RENDERER_DMA)
+  free(_bands[0]);
+  free(_bands[1]);
+#endif
+}
+
+void Renderer::_deleteSprites() {
+  for (uint i = 0; i < RENDERER_SPRITES; i++) {
+    if (_sprites[i] != NULL) {
+      _sprites[i]->deleteSprite();
+      delete _sprites[i];
+      _sprites[i] = NULL;
+    }
+  }
+}
+
+bool Renderer::setDma(bool dma) {
+#if defined(RENDERER_DMA)
+  flush();
+  if (dma &&
+      (_bands[0] == NULL)) {
+    // The DMA engine only reaches internal RAM
+    _bands[0] = (uint16_t*) heap_caps_malloc(RENDERER_BAND_PIXELS * sizeof(uint16_t), MALLOC_CAP_DMA);
+    _bands[1] = (uint16_t*) heap_caps_malloc(RENDERER_BAND_PIXELS * sizeof(uint16_t), MALLOC_CAP_DMA);
+    if ((_bands[0] == NULL) ||
+        (_bands[1] == NULL)) {
+      free(_bands[0]);
+      free(_bands[1]);
+      _bands[0] = NULL;
+      _bands[1] = NULL;
+      dma = false;
+    }
+  }
+  _dma = dma;
+  return _dma;
+#else
+  return false;
+#endif
+}
+
+TFT_eSPI* Renderer::begin(int32_t x, int32_t y, int32_t w, int32_t h) {
+  _x = x;
+  _y = y;
+  _w = w;
+  _h = h;
+  _frame.pixels += w * h;
+
+  if ((_sprites[0] != NULL) &&
+      (w <= RENDERER_SPRITE_WIDTH) &&
+      (h <= RENDERER_SPRITE_HEIGHT)) {
+#if defined(RENDERER_DMA)
+    if (_dma &&
+        (_jobCount == RENDERER_JOBS)) {
+      unsigned long startMicros = micros();
+      while (_jobCount == RENDERER_JOBS) {
+        _tft->dmaWait();
+        service();
+      }
+      _frame.blockedMicros += micros() - startMicros;
+    }
+    _sprite = _sprites[(_firstJob + _jobCount) % RENDERER_JOBS];  // The next job's, free once the jobs before it went out
+#else
+    _sprite = _sprites[0];
+#endif
+    _sprite->setViewport(0, 0, w, h);
+    _sprite->fillRect(0, 0, w, h, TFT_BLACK);
+    return _sprite;
+  }
+
+  direct(0);
+  _frame.windows++;
+  _tft->setViewport(x, y, w, h);
+  _tft->fillRect(0, 0, w, h, TFT_BLACK);
+  return _tft;
+}
+
+void Renderer::end() {
+  if (_sprite == NULL) {
+    _tft->resetViewport();
+    return;
+  }
+
+  _sprite->resetViewport();
+#if defined(RENDERER_DMA)
+  if (_dma) {
+    struct rendererJob_struct* job = &_jobs[(_firstJob + _jobCount) % RENDERER_JOBS];
+    job->sprite = _sprite;
+    job->x = _x;
+    job->y = _y;
+    job->w = _w;
+    job->h = _h;
+    job->line = 0;
+    _jobCount++;
+    _sprite = NULL;
+    service();
+    return;
+  }
+#endif
+
+  unsigned long startMicros = micros();
+  _sprite->pushSprite(_x, _y, 0, 0, _w, _h);
+  _frame.windows++;
+  _frame.blockedMicros += micros() - startMicros;
+  _sprite = NULL;
+}
+
+#if defined(RENDERER_DMA)
+// Copies the next lines of the oldest job into the free band buffer, in the
+// byte order the panel takes. Runs while the other buffer is on the bus.
+void Renderer::_prepareBand() {
+  if ((_bandLines > 0) ||
+      (_jobCount == 0)) {
+    return;
+  }
+
+  struct rendererJob_struct* job = &_jobs[_firstJob];
+  int32_t lines = min(job->h - job->line, (int32_t) (RENDERER_BAND_PIXELS / job->w));
+  for (int32_t line = 0; line < lines; line++) {
+    // The job's rectangle is the top left corner of a sprite RENDERER_SPRITE_WIDTH wide
+    uint32_t offset = (job->line + line) * RENDERER_SPRITE_WIDTH;
+    uint16_t* band = _bands[_band] + (line * job->w);
+    if (job->sprite->getColorDepth() == 16) {
+      // Sprites already keep their pixels byte swapped for the panel
+      memcpy(band, (uint16_t*) job->sprite->getPointer() + offset, job->w * sizeof(uint16_t));
+    } else {
+      const uint8_t* source = (const uint8_t*) job->sprite->getPointer() + offset;
+      for (int32_t i = 0; i < job->w; i++) {
+        uint8_t color8 = source[i];  // RRRGGGBB
+        uint16_t color = ((color8 & 0xE0) << 8) | ((color8 & 0xC0) << 5) |
+                         ((color8 & 0x1C) << 6) | ((color8 & 0x1C) << 3) |
+                         ((color8 & 0x03) << 3) | ((color8 & 0x03) << 1) | ((color8 & 0x03) >> 1);
+        band[i] = (color >> 8) | (color << 8);
+      }
+    }
+  }
+
+  _bandX = job->x;
+  _bandY = job->y + job->line;
+  _bandW = job->w;
+  _bandLines = lines;
+  job->line += lines;
+  if (job->line >= job->h) {
+    _firstJob = (_firstJob + 1) % RENDERER_JOBS;
+    _jobCount--;
+  }
+}
+
+void Renderer::_releaseBus() {
+  if (_writing) {
+    unsigned long startMicros = micros();
+    _tft->dmaWait();
+    _tft->endWrite();
+    _frame.blockedMicros += micros() - startMicros;
+    _writing = false;
+  }
+}
+#endif
+
+bool Renderer::service() {
+#if defined(RENDERER_DMA)
+  _prepareBand();
+  if (_bandLines == 0) {
+    if (_writing &&
+        !_tft->dmaBusy()) {
+      _releaseBus();
+    }
+    return _writing;
+  }
+
+  if (_writing &&
+      _tft->dmaBusy()) {
+    _dmaTimer.start(1);
+    return true;
+  }
+
+  if (!_writing) {
+    _tft->startWrite();
+    _writing = true;
+  }
+  _tft->pushImageDMA(_bandX, _bandY, _bandW, _bandLines, _bands[_band]);
+  _frame.windows++;
+  uint32_t transferMicros = ((uint64_t) _bandW * _bandLines * 16 * 1000000) / RENDERER_SPI_FREQUENCY;
+  _band ^= 1;
+  _bandLines = 0;
+  _prepareBand();
+  _dmaTimer.start((transferMicros / 1000) + 1);
+  return true;
+#else
+  return false;
+#endif
+}
+
+void Renderer::flush() {
+#if defined(RENDERER_DMA)
+  unsigned long startMicros = micros();
+  while ((_jobCount > 0) ||
+         (_bandLines > 0)) {
+    _tft->dmaWait();
+    service();
+  }
+  _frame.blockedMicros += micros() - startMicros;
+  _releaseBus();
+  _dmaTimer.stop();
+#endif
+}
+
+void Renderer::direct(uint32_t pixels) {
+#if defined(RENDERER_DMA)
+  _releaseBus();
+#endif
+  _frame.pixels += pixels;
+  if (pixels > 0) {
+    _frame.windows++;
+  }
+}
+
+void Renderer::fill(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color) {
+  direct(w * h);
+  _tft->fillRect(x, y, w, h, color);
+}
+
+struct rendererFrame_struct Renderer::endFrame() {
+  struct rendererFrame_struct frame = _frame;
+  memset(&_frame, 0, sizeof(_frame));
+  if (frame.pixels > 0) {
+    Metrics::record(METRIC_DISPLAY_FRAME_PIXELS, frame.pixels);
+    Metrics::increment(METRIC_DISPLAY_PIXELS, frame.pixels);
+    Metrics::increment(METRIC_DISPLAY_WINDOWS, frame.windows);
+    Metrics::record(METRIC_DISPLAY_BLOCKED_TIME, frame.blockedMicros);
+  }
+
+  return frame;
+}
+#endif
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <Arduino.h>
+#include <TFT_eSPI.h>
+#include "TimerWheel.h"
+
+// Off-screen composition for the TFT widgets. begin() hands out a sprite with
+// a viewport the size of a dirty rectangle, its own coordinates starting at
+// 0, 0, and end() pushes that rectangle to the panel in one transfer, so a
+// widget never shows half drawn. The sprites are allocated once, as large as
+// the largest box of the LAYOUT, and reused by every widget, so drawing never
+// touches the heap. They keep full colour when they fit RENDERER_16_BIT_BYTES
+// and use 8 bits per pixel otherwise. Without memory for them, or for a
+// rectangle larger than a layout box, the widget draws straight into a
+// viewport on the panel, as it did before. An off-screen target, such as the
+// framebuffer of a snapshot, is drawn into the same way: its sprite pushes
+// would only reach the panel, as TFT_eSPI::pushImage() is not virtual.
+//
+// With DMA, end() only queues the sprite. Its lines go out in bands through
+// two buffers: while one band is on the bus the next is copied into the other.
+// Each band arms a timer for its transfer time, and the EVENT_DISPLAY_TIMER it
+// raises brings the display task back to start the next, so the task sleeps
+// instead of waiting on SPI. Drawing straight to the panel waits for the band
+// in flight first.
+#define RENDERER_16_BIT_BYTES 32768
+#define RENDERER_BAND_PIXELS 2048  // Per band buffer, at least a line of the widest panel
+#define RENDERER_JOBS 3  // Queued sprites, begin() waits for the oldest when all are queued
+#define RENDERER_SPI_FREQUENCY 27000000  // SPI_FREQUENCY of the TFT_eSPI setup
+
+#if defined(DISPLAY_TYPE_ST7735_128_160)
+#define RENDERER_DMA  // TFT_eSPI has no DMA for the ILI9488, which takes 18-bit colour over SPI
+#endif
+
+#if defined(RENDERER_DMA)
+#define RENDERER_SPRITES RENDERER_JOBS  // One per queued job
+#else
+#define RENDERER_SPRITES 1
+#endif
+#define RENDERER_SPRITE_WIDTH layoutSpriteWidth(LAYOUT)
+#define RENDERER_SPRITE_HEIGHT layoutSpriteHeight(LAYOUT)
+
+// What a frame cost on the bus. Every window is one SPI transaction setting the
+// address window before its pixels.
+struct rendererFrame_struct {
+  uint32_t pixels;
+  uint32_t windows;
+  uint32_t blockedMicros;  // Waiting on SPI
+};
+
+class Renderer {
+  private:
+    TFT_eSPI* _tft;
+    bool _offscreen;  // _tft is a TFT_eSprite
+    TFT_eSprite* _sprites[RENDERER_SPRITES];  // NULL without memory for them
+    TFT_eSprite* _sprite;  // Being composed, NULL while drawing into a viewport
+    int32_t _x;
+    int32_t _y;
+    int32_t _w;
+    int32_t _h;
+    struct rendererFrame_struct _frame;
+
+    void _deleteSprites();
+
+#if defined(RENDERER_DMA)
+    struct rendererJob_struct {
+      TFT_eSprite* sprite;
+      int32_t x;
+      int32_t y;
+      int32_t w;
+      int32_t h;
+      int32_t line;  // Next one to copy into a band
+    };
+
+    bool _dma;
+    struct rendererJob_struct _jobs[RENDERER_JOBS];
+    uint _firstJob;
+    uint _jobCount;
+    uint16_t* _bands[2];
+    uint _band;  // The free one
+    int32_t _bandX;  // Of the band copied into _bands[_band], _bandLines 0 if none
+    int32_t _bandY;
+    int32_t _bandW;
+    int32_t _bandLines;
+    bool _writing;  // Holding the bus with startWrite()
+    DeadlineTimer _dmaTimer;
+
+    void _prepareBand();
+    void _releaseBus();
+#endif
+
+  public:
+    Renderer(TFT_eSPI* tft, bool offscreen = false);
+    ~Renderer();
+
+    // The target sprite, NULL when drawing to the panel
+    TFT_eSprite* offscreen() { return (_offscreen ? (TFT_eSprite*) _tft : NULL); }
+    // Only after the panel's init()
+    bool setDma(bool dma);
+
+    TFT_eSPI* begin(int32_t x, int32_t y, int32_t w, int32_t h);
+    void end();
+
+    // Starts the next band once the last one went out. Returns true while transfers are pending.
+    bool service();
+    // Waits until everything queued is on the panel
+    void flush();
+
+    // A single colour rectangle, which the panel fills from one window without a sprite
+    void fill(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color);
+    // Called before drawing straight to the panel elsewhere, with the pixels that will be drawn in one window
+    void direct(uint32_t pixels);
+    // Counts what was drawn straight to the panel after direct(0), when it was not known before
+    void pushed(uint32_t pixels, uint32_t windows) { _frame.pixels += pixels; _frame.windows += windows; }
+    uint32_t framePixels() { return _frame.pixels; }
+    // Records and returns what was pushed since the last call
+    struct rendererFrame_struct endFrame();
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+// Sequence lock around a small value. Writers are serialized by a spinlock and
+// bump the sequence to an odd number while they copy, readers copy without any
+// lock and retry if the sequence was odd or changed underneath them.
+//
+// The sequence also serves as a version number of the snapshot. T must be
+// trivially copyable.
+template <typename T>
+class Seqlock {
+  private:
+    std::atomic<uint32_t> _sequence;
+    T _value;
+    portMUX_TYPE _writerMux = portMUX_INITIALIZER_UNLOCKED;
+
+    void _store(const T& value) {
+      uint32_t sequence = _sequence.load(std::memory_order_relaxed);
+      _sequence.store(sequence + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      memcpy((void*) &_value, (const void*) &value, sizeof(T));
+      _sequence.store(sequence + 2, std::memory_order_release);
+    };
+
+  public:
+    Seqlock() : _sequence(0) {
+      memset((void*) &_value, 0, sizeof(T));
+    };
+
+    Seqlock(const T& value) : _sequence(0) {
+      memcpy((void*) &_value, (const void*) &value, sizeof(T));
+    };
+
+    // Returns the version of the snapshot
+    uint32_t read(T* value) const {
+      while (true) {
+        uint32_t sequence = _sequence.load(std::memory_order_acquire);
+        if (sequence & 1) {
+          continue;  // The writer holds a spinlock with interrupts off, so this is short
+        }
+
+        memcpy((void*) value, (const void*) &_value, sizeof(T));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (_sequence.load(std::memory_order_relaxed) == sequence) {
+          return sequence >> 1;
+        }
+      }
+    };
+
+    T read() const {
+      T value;
+      read(&value);
+
+      return value;
+    };
+
+    void write(const T& value) {
+      portENTER_CRITICAL(&_writerMux);
+      _store(value);
+      portEXIT_CRITICAL(&_writerMux);
+    };
+
+    // Writes value only if accept(current, value) is true, checked under the writer
+    // lock so that no other writer gets in between. accept runs with interrupts off,
+    // so it has to be a comparison or two.
+    template <typename Predicate>
+    bool writeIf(const T& value, Predicate accept) {
+      portENTER_CRITICAL(&_writerMux);
+      bool accepted = accept(_value, value);
+      if (accepted) {
+        _store(value);
+      }
+      portEXIT_CRITICAL(&_writerMux);
+      return accepted;
+    };
+
+    uint32_t version() const {
+      return _sequence.load(std::memory_order_acquire) >> 1;
+    };
+};
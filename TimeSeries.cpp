@@ -0,0 +1,373 @@
+#include <SPIFFS.h>
+#include "TimeSeries.h"
+#include "Metrics.h"
+
+#define TIME_SERIES_GAP 300  // Seconds between points that report() calls a gap
+
+// Fletcher-16 over the segment with the checksum zeroed
+static uint16_t segmentChecksum(const struct timeSeriesSegment_struct* segment) {
+  struct timeSeriesSegment_struct copy = *segment;
+  copy.checksum = 0;
+
+  const byte* bytes = (const byte*) &copy;
+  uint16_t sum1 = 0;
+  uint16_t sum2 = 0;
+  for (uint i = 0; i < sizeof(copy); i++) {
+    sum1 = (sum1 + bytes[i]) % 255;
+    sum2 = (sum2 + sum1) % 255;
+  }
+
+  return (sum2 << 8) | sum1;
+}
+
+TimeSeriesIterator::TimeSeriesIterator() {
+  _series = NULL;
+  _sequence = 1;
+  _endSequence = 0;
+  _record = 0;
+  _loaded = false;
+  _from = 0;
+  _to = 0;
+}
+
+bool TimeSeriesIterator::next(struct timeSeriesPoint_struct* point) {
+  while (_sequence <= _endSequence) {
+    if (!_loaded) {
+      if (!_series->_loadSegment(_sequence, &_segment)) {
+        _sequence++;  // Lost or deleted
+        continue;
+      }
+
+      // Skip to the first record in range
+      uint low = 0;
+      uint high = _segment.count;
+      while (low < high) {
+        uint middle = (low + high) / 2;
+        if ((time_t) (_segment.baseTime + _segment.records[middle].offset) < _from) {
+          low = middle + 1;
+        } else {
+          high = middle;
+        }
+      }
+      _record = low;
+      _loaded = true;
+    }
+
+    if (_record >= _segment.count) {
+      _loaded = false;
+      _sequence++;
+      continue;
+    }
+
+    time_t time = _segment.baseTime + _segment.records[_record].offset;
+    if (time >= _to) {
+      _sequence = _endSequence + 1;
+      return false;
+    }
+
+    point->time = time;
+    point->value = Channels::decode(_series->_channel, _segment.records[_record].value);
+    _record++;
+    return true;
+  }
+
+  return false;
+}
+
+TimeSeries::TimeSeries(channel_enum channel) {
+  _channel = channel;
+  _firstSequence = 0;
+  _lastTime = 0;
+  _flash = false;
+  _flashMutex = NULL;
+  _openSegment(0);
+  _ramSequence = 0;
+  _flushedSequence = 0;
+}
+
+void TimeSeries::_fileName(uint32_t fileNumber, char* name) {
+  sprintf(name, "/h%u.%lu", channelInfo[_channel].wireId, (unsigned long) fileNumber);
+}
+
+// Only called with _mux held, or before any other task can see the series
+void TimeSeries::_openSegment(uint32_t sequence) {
+  _currentSequence = sequence;
+  struct timeSeriesSegment_struct* segment = &_segments[sequence % TIME_SERIES_RAM_SEGMENTS];
+  segment->sequence = sequence;
+  segment->baseTime = 0;
+  segment->count = 0;
+  segment->checksum = 0;
+}
+
+void TimeSeries::setup() {
+  _flashMutex = xSemaphoreCreateMutex();
+
+  File root = SPIFFS.open("/");
+  if (!root) {
+    Serial.println("TimeSeries could not open SPIFFS, history stays in RAM");
+    return;
+  }
+
+  uint wireId = channelInfo[_channel].wireId;
+  uint32_t firstFile = UINT32_MAX;
+  uint32_t lastFile = 0;
+  size_t lastFileSize = 0;
+  for (File file = root.openNextFile(); file; file = root.openNextFile()) {
+    const char* name = file.name();
+    if (*name == '/') {
+      name++;
+    }
+
+    uint fileWireId;
+    unsigned long fileNumber;
+    if ((sscanf(name, "h%u.%lu", &fileWireId, &fileNumber) != 2) ||
+        (fileWireId != wireId)) {
+      continue;
+    }
+
+    firstFile = min(firstFile, (uint32_t) fileNumber);
+    if (fileNumber >= lastFile) {
+      lastFile = fileNumber;
+      lastFileSize = file.size();
+    }
+  }
+  _flash = true;
+
+  if (firstFile == UINT32_MAX) {
+    return;  // Nothing recorded yet
+  }
+
+  // A torn last segment means the power went out during a write, so the log continues in a new file
+  uint32_t slots = lastFileSize / sizeof(struct timeSeriesSegment_struct);
+  uint32_t next;
+  if (((lastFileSize % sizeof(struct timeSeriesSegment_struct)) != 0) ||
+      (slots >= TIME_SERIES_SEGMENTS_PER_FILE)) {
+    next = (lastFile + 1) * TIME_SERIES_SEGMENTS_PER_FILE;
+  } else {
+    next = (lastFile * TIME_SERIES_SEGMENTS_PER_FILE) + slots;
+  }
+
+  _firstSequence = firstFile * TIME_SERIES_SEGMENTS_PER_FILE;
+  _openSegment(next);
+  _ramSequence = next;
+  _flushedSequence = next;
+
+  // New samples have to come after the last recorded one
+  struct timeSeriesSegment_struct segment;
+  for (uint32_t sequence = next; sequence-- > _firstSequence; ) {
+    if (_loadSegment(sequence, &segment)) {
+      _lastTime = segment.baseTime + segment.records[segment.count - 1].offset;
+      break;
+    }
+    if ((next - sequence) >= TIME_SERIES_SEGMENTS_PER_FILE) {
+      break;
+    }
+  }
+}
+
+void TimeSeries::loop() {
+  if (!_flash) {
+    return;
+  }
+
+  while (true) {
+    struct timeSeriesSegment_struct segment;
+
+    portENTER_CRITICAL(&_mux);
+    bool closed = (_flushedSequence < _currentSequence);
+    if (closed) {
+      memcpy(&segment, &_segments[_flushedSequence % TIME_SERIES_RAM_SEGMENTS], sizeof(segment));
+    }
+    portEXIT_CRITICAL(&_mux);
+
+    if (!closed ||
+        !_writeSegment(&segment)) {
+      return;  // A failed write is tried again on the next loop
+    }
+
+    portENTER_CRITICAL(&_mux);
+    if (_flushedSequence == segment.sequence) {
+      _flushedSequence++;
+    }
+    portEXIT_CRITICAL(&_mux);
+  }
+}
+
+bool TimeSeries::_writeSegment(struct timeSeriesSegment_struct* segment) {
+  uint32_t fileNumber = segment->sequence / TIME_SERIES_SEGMENTS_PER_FILE;
+  uint32_t slot = segment->sequence % TIME_SERIES_SEGMENTS_PER_FILE;
+  segment->checksum = segmentChecksum(segment);
+
+  char name[24];
+  bool written = false;
+  xSemaphoreTake(_flashMutex, portMAX_DELAY);
+
+  // Only whole files are deleted, and only once a new one is started
+  uint32_t firstFile = _firstSequence / TIME_SERIES_SEGMENTS_PER_FILE;
+  while ((fileNumber - firstFile) >= TIME_SERIES_FILES) {
+    _fileName(firstFile, name);
+    SPIFFS.remove(name);
+    firstFile++;
+    _firstSequence = firstFile * TIME_SERIES_SEGMENTS_PER_FILE;
+  }
+
+  _fileName(fileNumber, name);
+  File file = SPIFFS.open(name, FILE_APPEND);
+  if (file) {
+    // Segments that were lost before reaching flash leave empty slots, which fail the checksum
+    size_t offset = slot * sizeof(struct timeSeriesSegment_struct);
+    static const byte zeros[sizeof(struct timeSeriesSegment_struct)] = {};
+    while (file.size() < offset) {
+      if (file.write(zeros, min(sizeof(zeros), offset - file.size())) == 0) {
+        break;
+      }
+    }
+
+    if (file.size() == offset) {
+      written = (file.write((const byte*) segment, sizeof(*segment)) == sizeof(*segment));
+    }
+    file.close();
+  }
+
+  xSemaphoreGive(_flashMutex);
+
+  if (written) {
+    Metrics::increment(METRIC_HISTORY_FLASH_WRITES);
+  } else {
+    Serial.print("TimeSeries could not write ");
+    Serial.println(name);
+  }
+
+  return written;
+}
+
+bool TimeSeries::_loadSegment(uint32_t sequence, struct timeSeriesSegment_struct* segment) {
+  portENTER_CRITICAL(&_mux);
+  bool inRam = ((sequence >= _ramSequence) && (sequence <= _currentSequence));
+  if (inRam) {
+    memcpy(segment, &_segments[sequence % TIME_SERIES_RAM_SEGMENTS], sizeof(*segment));
+  }
+  portEXIT_CRITICAL(&_mux);
+
+  if (inRam) {
+    return (segment->count > 0);
+  }
+
+  if (!_flash ||
+      (sequence < _firstSequence)) {
+    return false;
+  }
+
+  char name[24];
+  _fileName(sequence / TIME_SERIES_SEGMENTS_PER_FILE, name);
+  bool loaded = false;
+  xSemaphoreTake(_flashMutex, portMAX_DELAY);
+  if (SPIFFS.exists(name)) {
+    File file = SPIFFS.open(name, FILE_READ);
+    if (file &&
+        file.seek((sequence % TIME_SERIES_SEGMENTS_PER_FILE) * sizeof(*segment))) {
+      loaded = (file.read((byte*) segment, sizeof(*segment)) == sizeof(*segment));
+    }
+    file.close();
+  }
+  xSemaphoreGive(_flashMutex);
+
+  return (loaded &&
+          (segment->sequence == sequence) &&
+          (segment->count > 0) &&
+          (segment->count <= TIME_SERIES_SEGMENT_RECORDS) &&
+          (segment->checksum == segmentChecksum(segment)));
+}
+
+bool TimeSeries::append(time_t time, float value) {
+  if (isnan(value) ||
+      (time < 86400 * 365)) {  // The clock is not set yet
+    return false;
+  }
+
+  struct timeSeriesRecord_struct record;
+  Channels::encode(_channel, value, record.value);
+
+  portENTER_CRITICAL(&_mux);
+  if (time < (_lastTime + TIME_SERIES_MIN_INTERVAL)) {
+    portEXIT_CRITICAL(&_mux);
+    return false;
+  }
+
+  struct timeSeriesSegment_struct* segment = &_segments[_currentSequence % TIME_SERIES_RAM_SEGMENTS];
+  if ((segment->count == TIME_SERIES_SEGMENT_RECORDS) ||
+      ((segment->count > 0) && ((time - segment->baseTime) > UINT16_MAX))) {
+    _openSegment(_currentSequence + 1);
+    if ((_currentSequence - _ramSequence) >= TIME_SERIES_RAM_SEGMENTS) {
+      _ramSequence = _currentSequence - TIME_SERIES_RAM_SEGMENTS + 1;
+    }
+    if (_flushedSequence < _ramSequence) {
+      _flushedSequence = _ramSequence;  // Flash fell behind, the overwritten segments are lost
+    }
+    segment = &_segments[_currentSequence % TIME_SERIES_RAM_SEGMENTS];
+  }
+
+  if (segment->count == 0) {
+    segment->baseTime = time;
+  }
+  record.offset = time - segment->baseTime;
+  segment->records[segment->count++] = record;
+  _lastTime = time;
+  portEXIT_CRITICAL(&_mux);
+
+  return true;
+}
+
+void TimeSeries::query(time_t from, time_t to, TimeSeriesIterator* iterator) {
+  portENTER_CRITICAL(&_mux);
+  uint32_t low = _firstSequence;
+  uint32_t high = _currentSequence;
+  portEXIT_CRITICAL(&_mux);
+
+  iterator->_series = this;
+  iterator->_endSequence = high;
+  iterator->_loaded = false;
+  iterator->_from = from;
+  iterator->_to = to;
+
+  // The last segment that starts at or before from. A segment that cannot be
+  // loaded counts as later, which at worst starts the iteration too early.
+  struct timeSeriesSegment_struct segment;
+  while (low < high) {
+    uint32_t middle = low + ((high - low + 1) / 2);
+    if (_loadSegment(middle, &segment) &&
+        ((time_t) segment.baseTime <= from)) {
+      low = middle;
+    } else {
+      high = middle - 1;
+    }
+  }
+  iterator->_sequence = low;
+}
+
+void TimeSeries::report(Print* out, time_t from, time_t to) {
+  TimeSeriesIterator iterator;
+  struct timeSeriesPoint_struct point;
+  time_t previous = 0;
+  uint count = 0;
+
+  out->print("time,");
+  out->println(channelInfo[_channel].name);
+  query(from, to, &iterator);
+  while (iterator.next(&point)) {
+    if ((previous != 0) &&
+        ((point.time - previous) > TIME_SERIES_GAP)) {
+      out->print("# gap of ");
+      out->print((long) ((point.time - previous) / 60));
+      out->println(" min");
+    }
+    out->print((long) point.time);
+    out->print(",");
+    out->println(point.value);
+    previous = point.time;
+    count++;
+  }
+  out->print("# ");
+  out->print(count);
+  out->println(" points");
+}
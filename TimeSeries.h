@@ -0,0 +1,97 @@
+#pragma once
+
+#include <Arduino.h>
+#include "Channels.h"
+
+// History of one channel's samples, stored as segments of up to
+// TIME_SERIES_SEGMENT_RECORDS (time offset, encoded value) records behind a
+// small header, about 5 bytes per reading. The newest segments sit in a RAM
+// ring. Every closed segment is appended to a log of day files on SPIFFS, and
+// the oldest file is deleted once there are TIME_SERIES_FILES of them. Nothing
+// on flash is ever rewritten, and a reboot loses at most the open segment.
+//
+// Segment sequence numbers map to a fixed file and slot, and base times only
+// grow with the sequence, so a time-range query is a binary search over the
+// segments and then over the records of the first one.
+#define TIME_SERIES_SEGMENT_RECORDS 15
+#define TIME_SERIES_RAM_SEGMENTS 8
+#define TIME_SERIES_SEGMENTS_PER_FILE 96  // A day of 1-minute readings
+#define TIME_SERIES_FILES 28  // Four weeks, about 200 KB of SPIFFS
+#define TIME_SERIES_MIN_INTERVAL 30  // Seconds, so that a repeated sample is recorded once
+
+struct timeSeriesRecord_struct {
+  uint16_t offset;  // Seconds since the segment's base time
+  byte value[CHANNEL_MAX_ENCODED_SIZE];  // Channels::encode()
+};
+
+struct timeSeriesSegment_struct {
+  uint32_t sequence;
+  uint32_t baseTime;  // UTC seconds of the first record
+  uint16_t count;
+  uint16_t checksum;  // Only set on flash
+  struct timeSeriesRecord_struct records[TIME_SERIES_SEGMENT_RECORDS];
+};
+
+struct timeSeriesPoint_struct {
+  time_t time;  // UTC seconds when the source took the sample
+  float value;
+};
+
+class TimeSeries;
+
+class TimeSeriesIterator {
+  friend class TimeSeries;
+
+  private:
+    TimeSeries* _series;
+    struct timeSeriesSegment_struct _segment;
+    uint32_t _sequence;  // Of _segment
+    uint32_t _endSequence;
+    uint _record;
+    bool _loaded;
+    time_t _from;
+    time_t _to;
+
+  public:
+    TimeSeriesIterator();
+
+    // Oldest first. Returns false once the range is exhausted.
+    bool next(struct timeSeriesPoint_struct* point);
+};
+
+class TimeSeries {
+  friend class TimeSeriesIterator;
+
+  private:
+    channel_enum _channel;
+    struct timeSeriesSegment_struct _segments[TIME_SERIES_RAM_SEGMENTS];  // Indexed by sequence
+    uint32_t _firstSequence;  // Oldest segment that can still be on flash
+    uint32_t _ramSequence;  // Oldest segment in RAM
+    uint32_t _currentSequence;  // Segment being filled
+    uint32_t _flushedSequence;  // Next segment to write to flash
+    time_t _lastTime;
+    bool _flash;  // False until setup() found SPIFFS
+    portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+    SemaphoreHandle_t _flashMutex;
+
+    void _fileName(uint32_t fileNumber, char* name);
+    bool _loadSegment(uint32_t sequence, struct timeSeriesSegment_struct* segment);
+    bool _writeSegment(struct timeSeriesSegment_struct* segment);
+    void _openSegment(uint32_t sequence);
+
+  public:
+    TimeSeries(channel_enum channel);
+
+    // Picks up the log left on flash. SPIFFS must be mounted, without it the series stays in RAM.
+    void setup();
+    // Writes closed segments to flash. Called from the loop task, never from the radio task.
+    void loop();
+
+    // Records a sample. Unknown values and samples less than TIME_SERIES_MIN_INTERVAL after
+    // the last one are ignored. Safe from any task, it only touches RAM.
+    bool append(time_t time, float value);
+    // Points with from <= time < to
+    void query(time_t from, time_t to, TimeSeriesIterator* iterator);
+    // Prints the points as CSV and marks the gaps
+    void report(Print* out, time_t from, time_t to);
+};
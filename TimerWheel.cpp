@@ -0,0 +1,244 @@
+#include "TimerWheel.h"
+#include "Events.h"
+
+// Level L holds the timers whose deadline is less than 64 level-L slots
+// (64^L ms each) ahead of wheelNow. Slots are processed in time order: a
+// level-0 slot fires its timers, a higher slot is cascaded into the levels
+// below. The occupancy bitmaps find the earliest slot with one count-trailing-
+// zeros per level.
+struct timerWheel_struct {
+  static DeadlineTimer* slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+  static uint64_t occupied[TIMER_WHEEL_LEVELS];
+  static uint64_t wheelNow;  // Every slot that starts before this was processed
+
+  static void insert(DeadlineTimer* timer) {
+    uint64_t deadline = max(timer->_deadline, wheelNow);
+    uint level = 0;
+    while ((level < (TIMER_WHEEL_LEVELS - 1)) &&
+           (((deadline >> (TIMER_WHEEL_SLOT_BITS * level)) - (wheelNow >> (TIMER_WHEEL_SLOT_BITS * level))) >= TIMER_WHEEL_SLOTS)) {
+      level++;
+    }
+
+    // Beyond the top level, the timer waits in the last slot and is placed again when that slot cascades
+    uint shift = TIMER_WHEEL_SLOT_BITS * level;
+    uint64_t slotNumber = min(deadline >> shift, (wheelNow >> shift) + (TIMER_WHEEL_SLOTS - 1));
+    uint slot = slotNumber & (TIMER_WHEEL_SLOTS - 1);
+
+    timer->_level = level;
+    timer->_slot = slot;
+    timer->_previous = NULL;
+    timer->_next = slots[level][slot];
+    if (timer->_next != NULL) {
+      timer->_next->_previous = timer;
+    }
+    slots[level][slot] = timer;
+    occupied[level] |= ((uint64_t) 1 << slot);
+    timer->_queued = true;
+  }
+
+  static void remove(DeadlineTimer* timer) {
+    if (timer->_previous != NULL) {
+      timer->_previous->_next = timer->_next;
+    } else {
+      slots[timer->_level][timer->_slot] = timer->_next;
+    }
+    if (timer->_next != NULL) {
+      timer->_next->_previous = timer->_previous;
+    }
+    if (slots[timer->_level][timer->_slot] == NULL) {
+      occupied[timer->_level] &= ~((uint64_t) 1 << timer->_slot);
+    }
+    timer->_queued = false;
+  }
+
+  // Start time of the earliest occupied slot, UINT64_MAX if the wheel is empty
+  static uint64_t earliestSlot(uint* earliestLevel, uint* earliestSlotIndex) {
+    uint64_t earliest = UINT64_MAX;
+
+    for (uint level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+      if (occupied[level] == 0) {
+        continue;
+      }
+
+      uint shift = TIMER_WHEEL_SLOT_BITS * level;
+      uint current = (wheelNow >> shift) & (TIMER_WHEEL_SLOTS - 1);
+      uint64_t rotated = (current == 0 ? occupied[level] : (occupied[level] >> current) | (occupied[level] << (TIMER_WHEEL_SLOTS - current)));
+      uint distance = __builtin_ctzll(rotated);
+      uint64_t start = ((wheelNow >> shift) + distance) << shift;
+      if (start < earliest) {
+        earliest = start;
+        *earliestLevel = level;
+        *earliestSlotIndex = (current + distance) & (TIMER_WHEEL_SLOTS - 1);
+      }
+    }
+
+    return earliest;
+  }
+
+  // Processes every slot that starts at or before now and returns the events of the timers that fired
+  static uint32_t advance(uint64_t now) {
+    uint32_t events = 0;
+
+    while (true) {
+      uint level;
+      uint slot;
+      uint64_t start = earliestSlot(&level, &slot);
+      if (start > now) {
+        break;
+      }
+
+      wheelNow = max(wheelNow, start);
+      DeadlineTimer* timer = slots[level][slot];
+      slots[level][slot] = NULL;
+      occupied[level] &= ~((uint64_t) 1 << slot);
+      while (timer != NULL) {
+        DeadlineTimer* next = timer->_next;
+        timer->_queued = false;
+        if (timer->_deadline <= now) {
+          events |= timer->_events;
+        } else {
+          insert(timer);
+        }
+        timer = next;
+      }
+    }
+    wheelNow = max(wheelNow, now);
+
+    return events;
+  }
+};
+
+DeadlineTimer* timerWheel_struct::slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+uint64_t timerWheel_struct::occupied[TIMER_WHEEL_LEVELS];
+uint64_t timerWheel_struct::wheelNow = 0;
+
+static portMUX_TYPE wheelMux = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t wheelAlarm = NULL;
+static SemaphoreHandle_t alarmMutex = NULL;
+static uint64_t alarmAt = UINT64_MAX;
+
+// Moves the alarm to the earliest slot. Only called from tasks, never with wheelMux held.
+static void rearm() {
+  if (wheelAlarm == NULL) {
+    return;
+  }
+
+  xSemaphoreTake(alarmMutex, portMAX_DELAY);
+  uint level;
+  uint slot;
+  portENTER_CRITICAL(&wheelMux);
+  uint64_t next = timerWheel_struct::earliestSlot(&level, &slot);
+  portEXIT_CRITICAL(&wheelMux);
+
+  if (next != alarmAt) {
+    esp_timer_stop(wheelAlarm);
+    if (next != UINT64_MAX) {
+      uint64_t now = Clock::nowMillis();
+      esp_timer_start_once(wheelAlarm, (next > now ? (next - now) * 1000 : 1));
+    }
+    alarmAt = next;
+  }
+  xSemaphoreGive(alarmMutex);
+}
+
+static void onAlarm(void* argument) {
+  portENTER_CRITICAL(&wheelMux);
+  uint32_t events = timerWheel_struct::advance(Clock::nowMillis());
+  portEXIT_CRITICAL(&wheelMux);
+
+  xSemaphoreTake(alarmMutex, portMAX_DELAY);
+  alarmAt = UINT64_MAX;  // Fired, so the next one has to be set
+  xSemaphoreGive(alarmMutex);
+
+  if (events != 0) {
+    Events::notify(events);
+  }
+  rearm();
+}
+
+DeadlineTimer::DeadlineTimer(uint32_t events) {
+  _next = NULL;
+  _previous = NULL;
+  _deadline = 0;
+  _events = events;
+  _level = 0;
+  _slot = 0;
+  _armed = false;
+  _queued = false;
+}
+
+DeadlineTimer::~DeadlineTimer() {
+  stop();
+}
+
+void DeadlineTimer::start(uint64_t delayMillis) {
+  startAt(Clock::nowMillis() + delayMillis);
+}
+
+void DeadlineTimer::startAt(uint64_t deadline) {
+  uint32_t events = 0;
+
+  portENTER_CRITICAL(&wheelMux);
+  if (_queued) {
+    timerWheel_struct::remove(this);
+  }
+  _deadline = deadline;
+  _armed = true;
+  if (_events != 0) {
+    // Catch the wheel up first, so that the new timer lands in a low level
+    events = timerWheel_struct::advance(Clock::nowMillis());
+    timerWheel_struct::insert(this);
+  }
+  portEXIT_CRITICAL(&wheelMux);
+
+  if (events != 0) {
+    Events::notify(events);
+  }
+  if (_events != 0) {
+    rearm();
+  }
+}
+
+void DeadlineTimer::stop() {
+  portENTER_CRITICAL(&wheelMux);
+  if (_queued) {
+    timerWheel_struct::remove(this);
+  }
+  _armed = false;
+  portEXIT_CRITICAL(&wheelMux);
+  // The alarm is left alone, an early wake-up costs less than moving it
+}
+
+namespace TimerWheel {
+  void setup() {
+    alarmMutex = xSemaphoreCreateMutex();
+
+    esp_timer_create_args_t alarmArgs = {};
+    alarmArgs.callback = onAlarm;
+    alarmArgs.name = "timer_wheel";
+    esp_err_t result = esp_timer_create(&alarmArgs, &wheelAlarm);
+    if (result != ESP_OK) {
+      Serial.print("esp_timer_create() returned ");
+      Serial.println(result);
+      wheelAlarm = NULL;
+      return;
+    }
+
+    rearm();
+  }
+
+  uint64_t untilNext() {
+    uint level;
+    uint slot;
+    portENTER_CRITICAL(&wheelMux);
+    uint64_t next = timerWheel_struct::earliestSlot(&level, &slot);
+    portEXIT_CRITICAL(&wheelMux);
+
+    if (next == UINT64_MAX) {
+      return UINT64_MAX;
+    }
+
+    uint64_t now = Clock::nowMillis();
+    return (next > now ? next - now : 0);
+  }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+// 64-bit monotonic clock in milliseconds since boot. Unlike millis() it does
+// not wrap after 49.7 days.
+namespace Clock {
+  inline uint64_t nowMillis() {
+    return (uint64_t) esp_timer_get_time() / 1000;
+  };
+};
+
+// Every deadline in the firmware is a DeadlineTimer. Timers that were given
+// events sit in one hierarchical timer wheel (64 slots per level, 1 ms at the
+// bottom), which keeps a single esp_timer alarm set to its earliest slot. When
+// a timer's deadline passes, the alarm raises its events, so the owning task
+// can block in Events::wait() instead of computing its own next deadline.
+// Timers without events are only polled with isExpired().
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_LEVELS 6  // 64^6 ms is a little over two years
+
+class DeadlineTimer {
+  friend struct timerWheel_struct;
+
+  private:
+    DeadlineTimer* _next;  // Slot list, owned by the wheel
+    DeadlineTimer* _previous;
+    uint64_t _deadline;  // Clock::nowMillis()
+    uint32_t _events;
+    uint8_t _level;
+    uint8_t _slot;
+    bool _armed;
+    bool _queued;  // In the wheel, i.e. armed, with events and not fired yet
+
+  public:
+    DeadlineTimer(uint32_t events = 0);
+    ~DeadlineTimer();
+
+    // (Re)arms the timer, replacing any earlier deadline
+    void start(uint64_t delayMillis);
+    void startAt(uint64_t deadline);
+    void stop();
+
+    bool isArmed() const { return _armed; };
+    // True from the deadline until the timer is started again or stopped
+    bool isExpired() const { return _armed && (Clock::nowMillis() >= _deadline); };
+    uint64_t deadline() const { return _deadline; };
+};
+
+namespace TimerWheel {
+  // Creates the alarm. Timers can be started before, they are scheduled here.
+  void setup();
+  // Milliseconds until the earliest queued deadline, UINT64_MAX if there is
+  // none. Constant time. Far deadlines are rounded down to their slot, so the
+  // answer can be early but never late.
+  uint64_t untilNext();
+};
@@ -0,0 +1,241 @@
+#include <SPIFFS.h>
+#include "Timezone.h"
+
+#define TIMEZONE_FILE_VERSION 1
+#define TIMEZONE_LAST_WEEK 5  // Of a rule, the last such weekday of the month
+
+// A DST change as a calendar rule, in the local time in effect before it
+struct timezoneRule_struct {
+  uint8_t month;  // 1 to 12
+  uint8_t weekday;  // 0 is Sunday
+  uint8_t week;  // 1 to 4, or TIMEZONE_LAST_WEEK
+  int32_t secondOfDay;
+};
+
+struct timezoneFile_struct {
+  uint32_t version;
+  struct timezoneInfo_struct info;
+  struct timezoneTable_struct table;
+};
+
+// Days since 1970-01-01 of a proleptic Gregorian date
+static int32_t daysFromCivil(int32_t year, int32_t month, int32_t day) {
+  year -= (month <= 2);
+  int32_t era = ((year >= 0) ? year : year - 399) / 400;
+  int32_t yearOfEra = year - (era * 400);
+  int32_t dayOfYear = ((153 * (month + ((month > 2) ? -3 : 9))) + 2) / 5 + day - 1;
+  int32_t dayOfEra = (yearOfEra * 365) + (yearOfEra / 4) - (yearOfEra / 100) + dayOfYear;
+  return (era * 146097) + dayOfEra - 719468;
+}
+
+static int weekdayOf(int32_t days) {
+  return (((days % 7) + 11) % 7);  // 1970-01-01 was a Thursday
+}
+
+static int32_t daysInMonth(int32_t year, int32_t month) {
+  return (month == 12 ? 31 : daysFromCivil(year, month + 1, 1) - daysFromCivil(year, month, 1));
+}
+
+static struct timezoneRule_struct ruleOf(time_t local, int32_t* year) {
+  struct tm timeinfo;
+  gmtime_r(&local, &timeinfo);
+  *year = timeinfo.tm_year + 1900;
+
+  struct timezoneRule_struct rule;
+  rule.month = timeinfo.tm_mon + 1;
+  rule.weekday = timeinfo.tm_wday;
+  if ((timeinfo.tm_mday + 7) > daysInMonth(*year, rule.month)) {
+    rule.week = TIMEZONE_LAST_WEEK;  // Taken as "last", the usual rule, even when it is also the fourth
+  } else {
+    rule.week = ((timeinfo.tm_mday - 1) / 7) + 1;
+  }
+  rule.secondOfDay = (timeinfo.tm_hour * 3600) + (timeinfo.tm_min * 60) + timeinfo.tm_sec;
+  return rule;
+}
+
+// UTC of the rule in a year, given the offset in effect before it
+static time_t ruleAt(const struct timezoneRule_struct* rule, int32_t year, int32_t offsetBefore) {
+  int32_t first = daysFromCivil(year, rule->month, 1);
+  int32_t day;
+  if (rule->week == TIMEZONE_LAST_WEEK) {
+    int32_t last = daysInMonth(year, rule->month);
+    day = last - ((weekdayOf(first + last - 1) - rule->weekday + 7) % 7);
+  } else {
+    day = 1 + ((rule->weekday - weekdayOf(first) + 7) % 7) + (7 * (rule->week - 1));
+  }
+  return ((time_t) (first + day - 1) * 86400) + rule->secondOfDay - offsetBefore;
+}
+
+static void addTransition(struct timezoneTable_struct* table, time_t at, int32_t offset) {
+  if ((table->count == TIMEZONE_TRANSITIONS) ||
+      (at < 0) ||
+      (at > UINT32_MAX)) {
+    return;
+  }
+
+  // Insertion sort, there are only a few
+  uint i = table->count++;
+  for (; (i > 0) && (table->at[i - 1] > at); i--) {
+    table->at[i] = table->at[i - 1];
+    table->offset[i] = table->offset[i - 1];
+  }
+  table->at[i] = at;
+  table->offset[i] = offset / 60;
+}
+
+namespace Timezone {
+  void build(const struct timezoneInfo_struct* info, struct timezoneTable_struct* table) {
+    int32_t standard = info->standardTimezoneOffset;
+    int32_t daylight = info->daylightTimezoneOffset;
+    memset(table, 0, sizeof(*table));
+    table->initialOffset = standard / 60;
+    if ((info->dstBegin == 0) ||
+        (info->dstEnd == 0) ||
+        (standard == daylight)) {
+      return;  // No DST
+    }
+
+    int32_t beginYear;
+    int32_t endYear;
+    struct timezoneRule_struct begin = ruleOf(info->dstBegin + standard, &beginYear);
+    struct timezoneRule_struct end = ruleOf(info->dstEnd + daylight, &endYear);
+    if ((ruleAt(&begin, beginYear, standard) == info->dstBegin) &&
+        (ruleAt(&end, endYear, daylight) == info->dstEnd)) {
+      // From the year before, as a feed fetched late in the year may already list the next DST period
+      for (int32_t year = min(beginYear, endYear) - 1; table->count < TIMEZONE_TRANSITIONS; year++) {
+        addTransition(table, ruleAt(&begin, year, standard), daylight);
+        addTransition(table, ruleAt(&end, year, daylight), standard);
+      }
+    } else {
+      // Not a weekday rule, so only the feed's own transitions are known
+      addTransition(table, info->dstBegin, daylight);
+      addTransition(table, info->dstEnd, standard);
+    }
+
+    // Before the first transition, the other offset applies
+    table->initialOffset = ((table->offset[0] == (daylight / 60)) ? standard : daylight) / 60;
+  }
+
+  int32_t offset(const struct timezoneTable_struct* table, time_t utc, int* hint) {
+    int i = *hint;
+    if ((i < 0) ||
+        (i >= table->count) ||
+        (utc < table->at[i])) {
+      i = -1;  // Back in time, or a new table
+    }
+    while (((i + 1) < table->count) &&
+           (utc >= table->at[i + 1])) {
+      i++;
+    }
+    *hint = i;
+
+    return 60 * ((i < 0) ? table->initialOffset : table->offset[i]);
+  }
+
+  bool load(struct timezoneInfo_struct* info, struct timezoneTable_struct* table) {
+    struct timezoneFile_struct contents;
+    bool loaded = false;
+    if (SPIFFS.exists(TIMEZONE_FILE)) {
+      File file = SPIFFS.open(TIMEZONE_FILE, FILE_READ);
+      if (file) {
+        loaded = (file.read((byte*) &contents, sizeof(contents)) == sizeof(contents));
+        file.close();
+      }
+    }
+
+    if (!loaded ||
+        (contents.version != TIMEZONE_FILE_VERSION) ||
+        (contents.table.count > TIMEZONE_TRANSITIONS)) {
+      return false;
+    }
+    memcpy(info, &contents.info, sizeof(*info));
+    memcpy(table, &contents.table, sizeof(*table));
+    return true;
+  }
+
+  bool save(const struct timezoneInfo_struct* info, const struct timezoneTable_struct* table) {
+    struct timezoneFile_struct contents;
+    contents.version = TIMEZONE_FILE_VERSION;
+    memcpy(&contents.info, info, sizeof(*info));
+    memcpy(&contents.table, table, sizeof(*table));
+
+    File file = SPIFFS.open(TIMEZONE_FILE, FILE_WRITE);
+    if (!file) {
+      return false;
+    }
+    bool written = (file.write((const byte*) &contents, sizeof(contents)) == sizeof(contents));
+    file.close();
+    return written;
+  }
+};
+
+TimezoneParser::TimezoneParser(const char* timezone, struct timezoneInfo_struct* info) {
+  _timezone = timezone;
+  _info = info;
+  _length = 0;
+  _overflow = false;
+  _matches = 0;
+}
+
+size_t TimezoneParser::write(uint8_t c) {
+  if (c == '\n') {
+    if (!_overflow) {
+      _line[_length] = '\0';
+      _parseLine();
+    }
+    _length = 0;
+    _overflow = false;
+  } else if (_length < (sizeof(_line) - 1)) {
+    _line[_length++] = c;
+  } else {
+    _overflow = true;
+  }
+  return 1;
+}
+
+size_t TimezoneParser::write(const uint8_t* buffer, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    write(buffer[i]);
+  }
+  return size;
+}
+
+uint TimezoneParser::finish() {
+  if (_length > 0) {
+    write('\n');
+  }
+  return _matches;
+}
+
+void TimezoneParser::_parseLine() {
+  const int MAX_TOKENS = 5;
+  char* tokens[MAX_TOKENS];
+  int tokenCount = 0;
+  char* savePtr;
+
+  if ((_line[0] == '#') ||
+      (_line[0] == '\0')) {
+    return;
+  }
+  for (char* token = strtok_r(_line, ",\r", &savePtr);
+       (token != NULL) && (tokenCount < MAX_TOKENS);
+       token = strtok_r(NULL, ",\r", &savePtr)) {
+    tokens[tokenCount++] = token;
+  }
+  if ((tokenCount < 3) ||
+      (strcmp(tokens[1], _timezone) != 0)) {
+    return;
+  }
+
+  int type = atoi(tokens[0]);
+  if (type == 1) {
+    _info->standardTimezoneOffset = atoi(tokens[2]);
+    _matches++;
+  } else if ((type == 2) &&
+             (tokenCount == 5)) {
+    _info->dstBegin = atoll(tokens[2]);
+    _info->dstEnd = atoll(tokens[3]);
+    _info->daylightTimezoneOffset = atoi(tokens[4]);
+    _matches++;
+  }
+}
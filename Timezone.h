@@ -0,0 +1,73 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Local time from a table of UTC transitions, so a node keeps the right offset
+// through DST changes for years without another fetch.
+//
+// The timezone-info feed, and the time message a collector sends over LoRa,
+// only hold this year's DST begin and end. build() turns them back into the
+// rule they follow, such as "second Sunday of March at 02:00 local", and
+// projects TIMEZONE_YEARS years of transitions from it, starting the year before.
+#define TIMEZONE_YEARS 10
+#define TIMEZONE_TRANSITIONS (2 * TIMEZONE_YEARS)
+#define TIMEZONE_FILE "/timezone.bin"
+#define TIMEZONE_LINE_LENGTH 96  // Longest feed line kept, longer ones are skipped
+
+struct timezoneInfo_struct {
+  time_t dstBegin;
+  time_t dstEnd;
+  int32_t standardTimezoneOffset;
+  int32_t daylightTimezoneOffset;
+};
+
+struct timezoneTable_struct {
+  int16_t initialOffset;  // Minutes east of UTC before the first transition
+  uint16_t count;
+  uint32_t at[TIMEZONE_TRANSITIONS];  // UTC seconds, ascending
+  int16_t offset[TIMEZONE_TRANSITIONS];  // Minutes east of UTC from at[i] on
+};
+
+namespace Timezone {
+  void build(const struct timezoneInfo_struct* info, struct timezoneTable_struct* table);
+  // Seconds east of UTC at utc. hint is the index of the last transition found,
+  // which a caller moving forward in time keeps, so a lookup is a comparison or
+  // two unless a transition was crossed.
+  int32_t offset(const struct timezoneTable_struct* table, time_t utc, int* hint);
+
+  // On SPIFFS, so that a node boots with the last timezone it knew
+  bool load(struct timezoneInfo_struct* info, struct timezoneTable_struct* table);
+  bool save(const struct timezoneInfo_struct* info, const struct timezoneTable_struct* table);
+};
+
+// Parses the timezone-info CSV as it arrives, a line at a time, into the
+// fields of info for one timezone. Fields of lines that are not in the feed
+// keep their values.
+//
+//   1,<timezone>,<standard offset>
+//   2,<timezone>,<dst begin>,<dst end>,<daylight offset>
+class TimezoneParser : public Stream {
+  private:
+    const char* _timezone;
+    struct timezoneInfo_struct* _info;
+    char _line[TIMEZONE_LINE_LENGTH];
+    uint _length;
+    bool _overflow;
+    uint _matches;
+
+    void _parseLine();
+
+  public:
+    TimezoneParser(const char* timezone, struct timezoneInfo_struct* info);
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    // The last line may not end with a newline. Returns the lines found for the timezone.
+    uint finish();
+
+    // Nothing to read back, the parser only consumes
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    void flush() override {}
+};
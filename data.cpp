@@ -1,41 +1,80 @@
 #include "lora-cgm-sender.ino.globals.h"
 #include "data.h"
+#include "TimeSeries.h"
+#include "Log.h"
 
-ushort scrubMgPerDl(ushort mgPerDl) {
-  if ((mgPerDl < 0) ||
-      (mgPerDl > 400)) {
-    return UNKNOWN_MG_PER_DL;
+data_struct::data_struct() {
+  struct channelValue_struct unknown = { NAN, 0 };
+  for (uint i = 0; i < CHANNEL_COUNT; i++) {
+    channels[i].write(unknown);
+    history[i] = NULL;
   }
-
-  return mgPerDl;
 }
 
-byte scrubPropaneLevel(byte propaneLevel) {
-  if ((propaneLevel < 0) ||
-      (propaneLevel > 100)) {
-    return UNKNOWN_MG_PER_DL;
-  }
+void data_struct::setTimezone(const struct timezoneInfo_struct* info) {
+  struct timezoneInfo_struct previous;
+  timezoneInfo.read(&previous);
+  struct timezoneTable_struct table;
+  Timezone::build(info, &table);
+  timezoneInfo.write(*info);
+  timezoneTable.write(table);
 
-  return propaneLevel;
+  if (memcmp(&previous, info, sizeof(previous)) != 0) {
+    LOG_INFO(LOG_TIMEZONE_UPDATED, table.count, info->standardTimezoneOffset);
+    if (!Timezone::save(info, &table)) {
+      LOG_WARN(LOG_TIMEZONE_NOT_SAVED);
+    }
+  }
 }
 
-float scrubTemperature(float temperature) {
-  if (temperature <= UNKNOWN_TEMPERATURE) {
-    return UNKNOWN_TEMPERATURE;
+bool data_struct::update(channel_enum channel, float value, uint32_t ageSeconds) {
+  struct channelValue_struct previous;
+  struct channelValue_struct channelValue = {
+    Channels::scrub(channel, value),
+    dataSeconds() - (int32_t) min(ageSeconds, (uint32_t) INT32_MAX)
+  };
+
+  // The collector and the radio both update a channel, so the age is compared with the writer lock held
+  bool written = channels[channel].writeIf(channelValue, [&previous](const struct channelValue_struct& current,
+                                                                     const struct channelValue_struct& next) {
+    previous = current;
+    return (isnan(current.value) ||
+            (next.sampledAt >= current.sampledAt));
+  });
+  if (!written) {
+    return false;  // Another node repeated an older sample
   }
 
-  if (temperature > 199.0) {
-    return 199.0;
+  if (history[channel] != NULL) {
+    history[channel]->append(time(nullptr) - (time_t) min(ageSeconds, (uint32_t) INT32_MAX), channelValue.value);
   }
-  
-  return temperature;
-}
 
-extern byte scrubHumidity(byte humidity) {
-  if ((humidity < 0) ||
-      (humidity > 100)) {
-    return UNKNOWN_HUMIDITY;
+  bool changed = changes.publish(channel, channelValue.value);
+  if (!changed &&
+      (channelStale(channel, &previous) != channelStale(channel, &channelValue))) {
+    changes.publish(DATA_CHANNEL_BITS(CHANNEL_BIT(channel)));  // Same value, but it has to be drawn and sent again
   }
 
-  return humidity;
+  return changed;
+}
+
+struct channelValue_struct data_struct::read(channel_enum channel) const {
+  return channels[channel].read();
+}
+
+float data_struct::value(channel_enum channel) const {
+  return channels[channel].read().value;
+}
+
+int32_t dataSeconds() {
+  return (int32_t) (esp_timer_get_time() / 1000000);
+}
+
+uint32_t channelAge(const struct channelValue_struct* channelValue) {
+  return (uint32_t) (dataSeconds() - channelValue->sampledAt);
+}
+
+bool channelStale(channel_enum channel, const struct channelValue_struct* channelValue) {
+  return (!isnan(channelValue->value) &&
+          (channelAge(channelValue) > channelInfo[channel].maxAge));
 }
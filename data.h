@@ -1,24 +1,46 @@
 #pragma once
 
 #include <Arduino.h>
+#include <atomic>
+#include "Seqlock.h"
+#include "Channels.h"
+#include "DataChanges.h"
+#include "Alerts.h"
+#include "Timezone.h"
+
+// The shared data is the timezone plus one value per channel (see Channels.h).
+// Each sits behind its own seqlock, so readers get consistent snapshots (no
+// half-written 64-bit times). Writers publish the fields they changed through
+// changes after storing them, which tells the subscribers what to read again.
+struct channelValue_struct {
+  float value;  // NAN when unknown
+  int32_t sampledAt;  // dataSeconds() when the source took the sample, negative if before boot
+};
+
+class TimeSeries;
 
 struct data_struct {
-  time_t time;
-  time_t dstBegin;
-  time_t dstEnd;
-  int32_t standardTimezoneOffset;
-  int32_t daylightTimezoneOffset;
-  bool forceDisplayTimeUpdate;
-  bool forceLoRaTimeUpdate;
-  ushort mgPerDl;
-  byte propaneLevel;
-  float indoorTemperature;
-  byte indoorHumidity;
-  float outdoorTemperature;
-  byte outdoorHumidity;
+  Seqlock<struct timezoneInfo_struct> timezoneInfo;
+  Seqlock<struct timezoneTable_struct> timezoneTable;  // Built from timezoneInfo
+  Seqlock<struct channelValue_struct> channels[CHANNEL_COUNT];  // Indexed by channel_enum
+  Seqlock<struct alert_struct> alert;  // The latest alert, ALERT_NONE once it cleared
+  DataChanges changes;
+  TimeSeries* history[CHANNEL_COUNT];  // Optional, every accepted sample of the channel is appended
+
+  data_struct();
+
+  // Stores the timezone and its transition table, and saves them when they changed
+  void setTimezone(const struct timezoneInfo_struct* info);
+
+  // Scrubs, stores and publishes a new value that the source sampled ageSeconds ago.
+  // Samples older than the stored one are dropped. Returns true if the value passed the deadband.
+  bool update(channel_enum channel, float value, uint32_t ageSeconds = 0);
+  struct channelValue_struct read(channel_enum channel) const;
+  float value(channel_enum channel) const;
 };
 
-extern ushort scrubMgPerDl(ushort mgPerDl);
-extern byte scrubPropaneLevel(byte propaneLevel);
-extern float scrubTemperature(float temperature);
-extern byte scrubHumidity(byte humidity);
+// Monotonic seconds since boot, the clock of channelValue_struct::sampledAt
+extern int32_t dataSeconds();
+extern uint32_t channelAge(const struct channelValue_struct* channelValue);
+// A known value whose age is past the channel's max age
+extern bool channelStale(channel_enum channel, const struct channelValue_struct* channelValue);
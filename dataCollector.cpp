@@ -2,40 +2,65 @@
 #include <WiFiClientSecure.h>
 #include "esp_sntp.h"
 #include <ArduinoJson.h>
-#include <ExpirationTimer.h>
 #include "credentials.h"
 #include "DataCollector.h"
 #include "data.h"
+#include "HttpsPool.h"
+#include "Log.h"
+#include "Metrics.h"
+#include "TimerWheel.h"
+#include "CgmTrend.h"
+#include "LatencyTrace.h"
+#if defined(SIMULATE_API_RESPONSES)
+#include "recordedPayloads.h"
+#endif
 
 #define PROPANE_TIMEOUT (3600 * 6)
 #define TEMPERATURE_TIMEOUT 300
 #define SETTIME_TIMEOUT (3600 * 24)
 // #define SETTIME_TIMEOUT 60
 #define TIMEZONE "America/Los_Angeles"
+#if defined(SIMULATE_API_RESPONSES)
+#define HTTPS_POLL_INTERVAL 5000
+#define SIMULATED_API_DELAY 300  // Typical request time against the real APIs
+#else
+#define HTTPS_POLL_INTERVAL 60000
+#endif
 
-extern volatile struct data_struct data;
+extern struct data_struct data;
 
 String token;
 long tokenExpires = 0;
 String cgmRegion = "";
-bool callApi(const char* endpoint, const char* requestType, void** doc) {
+bool callApi(const char* endpoint, const char* requestType, void** doc);
+
+// HTTPClient::begin() clears the request headers, so they are added after it
+static void addHeaders(HTTPClient* https, const char* requestType) {
+  if (strcmp(requestType, "propane") == 0) {
+    String authorization = "Basic " + String(PROPANE_CREDENTIALS_BASE64);
+    https->addHeader("Authorization", authorization);
+  } else if (memcmp(requestType, "cgm", 3) == 0) {
+    https->addHeader("Content-Type", "application/json");
+    https->addHeader("product", "llu.android");
+    https->addHeader("version", "4.9.0");
+    https->addHeader("user-agent", "curl/8.4.0");
+    https->addHeader("accept", "*/*");
+    if (memcmp(&requestType[3], "Login", 5) != 0) {
+      String authorization = "Bearer " + token;
+      https->addHeader("Authorization", authorization);
+    }
+  }
+}
+
+bool performApiCall(const char* endpoint, const char* requestType, void** doc) {
   char url[255];
   bool doPost = false;
   char postData[128];
 
-  WiFiClientSecure client;
-  HTTPClient https;
-  client.setInsecure();
-
   strncpy(url, endpoint, sizeof(url));
-  if (strcmp(requestType, "propane") == 0) {
-    String authorization = "Basic " + String(PROPANE_CREDENTIALS_BASE64);
-    https.addHeader("Authorization", authorization);
-  } else if (strcmp(requestType, "temperature") == 0) {
+  if (strcmp(requestType, "temperature") == 0) {
     strncat(url, OPEN_WEATHER_MAP_API_KEY, sizeof(url));
   } else if (memcmp(requestType, "cgm", 3) == 0) {
-    bool performLogin = (memcmp(&requestType[3], "Login", 5) == 0);
-
     strcpy(url, "https://api");
     if (cgmRegion.length() > 0) {
       strncat(url, "-", sizeof(url));
@@ -46,73 +71,75 @@ bool callApi(const char* endpoint, const char* requestType, void** doc) {
     // Serial.print("url = ");
     // Serial.println(url);
 
-    // Serial.println("[HTTPS] begin...");
-    https.addHeader("Content-Type", "application/json");
-    https.addHeader("product", "llu.android");
-    https.addHeader("version", "4.9.0");
-    https.addHeader("user-agent", "curl/8.4.0");
-    https.addHeader("accept", "*/*");
-    if (performLogin) {
+    if (memcmp(&requestType[3], "Login", 5) == 0) {
       sprintf(postData, "{\"email\":\"%s\",\"password\":\"%s\"}", CGM_USERNAME, CGM_PASSWORD);
       doPost = true;
-    } else {
-      String authorization = "Bearer " + token;
-      https.addHeader("Authorization", authorization);
     }
   }
 
-  // Serial.println(url);
-  if (!https.begin(client, url)) {  // HTTPS
-    Serial.println("[HTTPS] Unable to connect");
-    https.end();
-    return false;
-  }
-
+  HTTPClient* https;
   int httpCode;
-  if (doPost) {
-    // Serial.println("[HTTPS] POST...");
-    httpCode = https.POST(postData);
-  } else {
-    // Serial.println("[HTTPS] GET...");
-    httpCode = https.GET();
+  for (int attempt = 0; ; attempt++) {
+    // Serial.println(url);
+    https = HttpsPool::begin(url);
+    if (https == NULL) {
+      LOG_ERROR(LOG_HTTPS_CONNECT_FAILED, requestType);
+      return false;
+    }
+    addHeaders(https, requestType);
+
+    bool reused = https->connected();
+    if (doPost) {
+      // Serial.println("[HTTPS] POST...");
+      httpCode = https->POST(postData);
+    } else {
+      // Serial.println("[HTTPS] GET...");
+      httpCode = https->GET();
+    }
+    if ((httpCode > 0) ||
+        !reused ||
+        (attempt > 0)) {
+      break;
+    }
+
+    // The server closed the kept connection while it was idle, so once more on a new one
+    Metrics::increment(METRIC_HTTPS_RETRIES);
+    HttpsPool::end(https, true);
   }
 
   // httpCode will be negative on error
   if (httpCode <= 0) {
-    Serial.printf("[HTTPS] request failed, error: %s\n", https.errorToString(httpCode).c_str());
-    Serial.println();
-    https.end();
+    LOG_ERROR(LOG_HTTPS_REQUEST_FAILED, requestType, httpCode);
+    HttpsPool::end(https, true);
     return false;
   }
 
   if ((httpCode != HTTP_CODE_OK) &&
       (httpCode != HTTP_CODE_MOVED_PERMANENTLY)) {
-    Serial.printf("[HTTPS] response code: %d\n", httpCode);
-    Serial.println("[HTTPS] request not processed due to response code");
-    https.end();
+    LOG_ERROR(LOG_HTTPS_RESPONSE_CODE, requestType, httpCode);
+    HttpsPool::end(https, true);  // The body was not read, so the connection can't carry another request
     return false;
   }
 
-   if ((httpCode != HTTP_CODE_OK) &&
-       (httpCode != HTTP_CODE_MOVED_PERMANENTLY)) {
-    Serial.printf("[HTTPS] response code: %d\n", httpCode);
-    Serial.println();
-    Serial.println("[HTTPS] request not processed due to response code");
-    https.end();
-    return false;
+  if (strcmp(requestType, "timezoneInfo") == 0) {
+    // Parsed as it arrives, so the whole CSV is never held in memory
+    TimezoneParser* parser = (TimezoneParser*) doc;
+    int written = https->writeToStream(parser);
+    HttpsPool::end(https, (written < 0));
+    if (written < 0) {
+      LOG_ERROR(LOG_HTTPS_REQUEST_FAILED, requestType, written);
+      return false;
+    }
+    return (parser->finish() > 0);
   }
 
-  String payload = https.getString();
+  String payload = https->getString();
   // Serial.println(payload);  // Print the response body
-  if (strcmp(requestType, "timezoneInfo") == 0) {
-    int length = payload.length() + 1;
-    *doc = malloc(length);
-    strcpy((char*) *doc, payload.c_str());
-  } else {
-    deserializeJson(*((JsonDocument*) doc), payload);
-  }
+  unsigned long parseStartMicros = micros();
+  deserializeJson(*((JsonDocument*) doc), payload);
+  Metrics::record(METRIC_JSON_PARSE_TIME, micros() - parseStartMicros);
 
-  https.end();
+  HttpsPool::end(https);
 
   if (memcmp(requestType, "cgm", 3) == 0) {
     String region = (const char*) (*((JsonDocument*) doc))["data"]["region"];
@@ -129,6 +156,103 @@ bool callApi(const char* endpoint, const char* requestType, void** doc) {
   return true;
 }
 
+#if defined(SIMULATE_API_RESPONSES)
+// Answers from the recorded payloads instead of the network, with the CGM reading
+// taking a small random step every time so that each poll produces a new value
+static ushort simulatedMgPerDl = 120;
+bool simulateApiCall(const char* requestType, void** doc) {
+  vTaskDelay(SIMULATED_API_DELAY);
+
+  if (strcmp(requestType, "timezoneInfo") == 0) {
+    TimezoneParser* parser = (TimezoneParser*) doc;
+    parser->write((const uint8_t*) RECORDED_TIMEZONE_INFO, strlen(RECORDED_TIMEZONE_INFO));
+    return (parser->finish() > 0);
+  }
+
+  JsonDocument* jsonDocument = (JsonDocument*) doc;
+  if (strcmp(requestType, "cgmLogin") == 0) {
+    (*jsonDocument)["data"]["authTicket"]["token"] = "simulated";
+    (*jsonDocument)["data"]["authTicket"]["expires"] = (long) time(nullptr) + 3600;
+  } else if (strcmp(requestType, "cgmNologin") == 0) {
+    int step = random(1, 6);
+    if (((simulatedMgPerDl + step) > 350) ||
+        (((simulatedMgPerDl - step) >= 40) && (random(0, 2) == 0))) {
+      step = -step;
+    }
+    simulatedMgPerDl += step;
+
+    deserializeJson(*jsonDocument, RECORDED_LLU_CONNECTIONS);
+    (*jsonDocument)["data"][0]["glucoseMeasurement"]["ValueInMgPerDl"] = simulatedMgPerDl;
+
+    // A fresh reading, with its own timestamp so that the trend takes it
+    char factoryTimestamp[32];
+    time_t now = time(nullptr);
+    struct tm timeinfo;
+    gmtime_r(&now, &timeinfo);
+    strftime(factoryTimestamp, sizeof(factoryTimestamp), "%m/%d/%Y %I:%M:%S %p", &timeinfo);
+    (*jsonDocument)["data"][0]["glucoseMeasurement"]["FactoryTimestamp"] = factoryTimestamp;
+  } else if (strcmp(requestType, "propane") == 0) {
+    deserializeJson(*jsonDocument, RECORDED_OTODATA_DEVICES);
+  } else if (strcmp(requestType, "temperature") == 0) {
+    deserializeJson(*jsonDocument, RECORDED_OPEN_WEATHER_MAP);
+    (*jsonDocument)["dt"] = (long) time(nullptr);
+  } else {
+    return false;
+  }
+
+  return true;
+}
+#endif
+
+bool callApi(const char* endpoint, const char* requestType, void** doc) {
+  unsigned long startMicros = micros();
+#if defined(SIMULATE_API_RESPONSES)
+  bool succeeded = simulateApiCall(requestType, doc);
+#else
+  bool succeeded = performApiCall(endpoint, requestType, doc);
+#endif
+  Metrics::recordHttpsCall(requestType, succeeded, micros() - startMicros);
+
+  return succeeded;
+}
+
+// LibreLinkUp's FactoryTimestamp is UTC in "M/D/YYYY h:mm:ss AM" form. Returns 0 if it can't be parsed.
+time_t parseFactoryTimestamp(const char* timestamp) {
+  int month, day, year, hour, minute, second;
+  char meridiem[3];
+  if ((timestamp == NULL) ||
+      (sscanf(timestamp, "%d/%d/%d %d:%d:%d %2s", &month, &day, &year, &hour, &minute, &second, meridiem) != 7)) {
+    return 0;
+  }
+
+  hour %= 12;
+  if (meridiem[0] == 'P') {
+    hour += 12;
+  }
+
+  // Days since 1970-01-01 in the proleptic Gregorian calendar, with years starting in March
+  year -= (month <= 2 ? 1 : 0);
+  int era = (year >= 0 ? year : year - 399) / 400;
+  int yearOfEra = year - (era * 400);
+  int dayOfYear = (((153 * (month > 2 ? month - 3 : month + 9)) + 2) / 5) + day - 1;
+  int dayOfEra = (yearOfEra * 365) + (yearOfEra / 4) - (yearOfEra / 100) + dayOfYear;
+  int64_t days = ((int64_t) era * 146097) + dayOfEra - 719468;
+
+  return (time_t) ((days * 86400) + (hour * 3600) + (minute * 60) + second);
+}
+
+// Seconds since a sample taken at the given UTC time, 0 if either time is unknown
+uint32_t sampleAge(time_t sampledAt) {
+  time_t now = time(nullptr);
+  if ((sampledAt <= 0) ||
+      (now < 86400 * 365) ||  // Give NTP one year to sync
+      (sampledAt > now)) {
+    return 0;
+  }
+
+  return (uint32_t) min((int64_t) (now - sampledAt), (int64_t) UINT32_MAX);
+}
+
 void printLocalTime() {
   struct tm timeinfo;
   if (!getLocalTime(&timeinfo)) {
@@ -139,20 +263,21 @@ void printLocalTime() {
 }
 
 void timeSyncCallback(struct timeval *tv) {
-  data.forceDisplayTimeUpdate = true;
-  data.forceLoRaTimeUpdate = true;  // The time may have adjusted
+  data.changes.publish(DATA_BIT(DATA_CLOCK) | DATA_BIT(DATA_NETWORK_TIME));  // The time may have adjusted
   Serial.println("Got time adjustment from NTP!");
   printLocalTime();
 }
 
-long httpsTaskHighWaterMark = LONG_MAX;
-ExpirationTimer propaneExpirationTimer = ExpirationTimer();
-ExpirationTimer temperatureExpirationTimer = ExpirationTimer();
-ExpirationTimer settimeTimer = ExpirationTimer();
+CgmTrend cgmTrend;  // Fed here because only the collector sees every reading
+
+// Polled once per HTTPS_POLL_INTERVAL, so they need no events
+DeadlineTimer propaneExpirationTimer;
+DeadlineTimer temperatureExpirationTimer;
+DeadlineTimer settimeTimer;
 void vHttpsTask(void* pvParameters) {
-  propaneExpirationTimer.forceExpired();
-  temperatureExpirationTimer.forceExpired();
-  settimeTimer.forceExpired();
+  propaneExpirationTimer.start(0);
+  temperatureExpirationTimer.start(0);
+  settimeTimer.start(0);
 
   sntp_setoperatingmode(SNTP_OPMODE_POLL);
   sntp_setservername(0, "pool.ntp.org");
@@ -163,87 +288,15 @@ void vHttpsTask(void* pvParameters) {
     try {
       JsonDocument doc;
 
-      if (settimeTimer.isExpired(SETTIME_TIMEOUT * 1000)) {
-        char* payload;
-        if (callApi("https://buiten.com/timezone-info", "timezoneInfo", (void**) &payload)) {
-          char* originalPayload = payload;
-
-          const int MAX_TOKENS = 5;
-          char* payloadSavePtr;
-          char* line = strtok_r(payload, "\n", &payloadSavePtr);
-          while (line) {
-            // Serial.println(line);
-            if (*line == '#') {
-              line = strtok_r(NULL, "\n", &payloadSavePtr);
-              // Serial.println("Skipping timezone info line because it's a comment");
-              continue;
-            }
-
-            char* tokens[MAX_TOKENS];
-            int tokenCount = 0;
-            char* tokenSavePtr;
-            char* token = strtok_r(line, ",", &tokenSavePtr);
-            while (token &&
-                   (tokenCount < MAX_TOKENS)) {
-              tokens[tokenCount++] = token;
-              token = strtok_r(NULL, ",", &tokenSavePtr);
-            }
-
-            // Serial.print("tokenCount = ");
-            // Serial.println(tokenCount);
-
-            if (tokenCount < 2) {
-              Serial.println("Skipping timezone info line because there are not enough tokens");
-              line = strtok_r(NULL, "\n", &payloadSavePtr);
-              continue;
-            }
-
-            if (strcmp(tokens[1], TIMEZONE) != 0) {
-              // Serial.println("Skipping timezone info line because there is a timezone mismatch");
-              line = strtok_r(NULL, "\n", &payloadSavePtr);
-              continue;
-            }
-
-            if ((tokenCount == 3) &&
-                (strcmp(tokens[0], "1") == 0)) {
-              try {
-                data.standardTimezoneOffset = atoi(tokens[2]);
-              } catch (...) {
-                Serial.println("Error parsing timezone info tokens");
-              }
-            } else if ((tokenCount == 5) &&
-                       (strcmp(tokens[0], "2") == 0)) {
-              try {
-                data.dstBegin = atoll(tokens[2]);
-                data.dstEnd = atoll(tokens[3]);
-                data.daylightTimezoneOffset = atoi(tokens[4]);
-
-                // Serial.println("---");
-                // Serial.println(tokens[2]);
-                // Serial.println(data.dstBegin);
-                // Serial.println(tokens[3]);
-                // Serial.println(data.dstEnd);
-                // Serial.println(data.standardTimezoneOffset);
-                // Serial.println(data.daylightTimezoneOffset);
-                // Serial.println(time(nullptr));
-              } catch (...) {
-                Serial.println("Error parsing timezone info tokens");
-              }
-            } else {
-              Serial.print("Unknown timezone info type ");
-              Serial.print(tokens[0]);
-              Serial.print(" with token count ");
-              Serial.println(tokenCount);
-            }
-
-            line = strtok_r(NULL, "\n", &payloadSavePtr);
-          }
-
-          data.forceDisplayTimeUpdate = true;
-          data.forceLoRaTimeUpdate = true;  // The DST settings may have adjusted
-          free((void*) originalPayload);
+      if (settimeTimer.isExpired()) {
+        struct timezoneInfo_struct timezoneInfo;
+        data.timezoneInfo.read(&timezoneInfo);
+        TimezoneParser parser(TIMEZONE, &timezoneInfo);
+        if (callApi("https://buiten.com/timezone-info", "timezoneInfo", (void**) &parser)) {
+          data.setTimezone(&timezoneInfo);
+          data.changes.publish(DATA_BIT(DATA_CLOCK) | DATA_BIT(DATA_NETWORK_TIME));  // The DST settings may have adjusted
 
-          settimeTimer.reset();
+          settimeTimer.start(SETTIME_TIMEOUT * 1000);
         }
       }
 
@@ -260,15 +313,30 @@ void vHttpsTask(void* pvParameters) {
       }
 
       if (time(nullptr) < tokenExpires) {
+        LatencyTrace::apiStarted();
         if (callApi("/llu/connections", "cgmNologin", (void**) &doc)) {
           JsonObject connection = doc["data"][0];
-          data.mgPerDl = scrubMgPerDl((short) connection["glucoseMeasurement"]["ValueInMgPerDl"]);
-          // data.mgPerDl = 255;
+          float mgPerDl = connection["glucoseMeasurement"]["ValueInMgPerDl"];
+          time_t sampledAt = parseFactoryTimestamp((const char*) connection["glucoseMeasurement"]["FactoryTimestamp"]);
+          uint32_t age = sampleAge(sampledAt);
+          LatencyTrace::apiDone();
+          if (data.update(CHANNEL_MG_PER_DL, mgPerDl, age)) {
+            LatencyTrace::published();
+          }
+          if (sampledAt > 0) {
+            // Keyed on the sensor's own time, so a reading the API repeats is rejected even before NTP
+            cgmTrend.add(sampledAt, mgPerDl);
+          }
+          data.update(CHANNEL_CGM_RATE, cgmTrend.rate(), age);
+          Alerts::evaluate(&data);
           const char* timestamp = (const char*) connection["glucoseMeasurement"]["Timestamp"];
           Serial.print("Glucose level = ");
-          Serial.print(data.mgPerDl);
+          Serial.print(mgPerDl);
           Serial.print(" mg/dL at ");
-          Serial.println(timestamp);
+          Serial.print(timestamp);
+          Serial.print(", ");
+          Serial.print(age);
+          Serial.println(" s old");
         }
       } else {
         Serial.println("Auth token is outdated!");
@@ -276,38 +344,38 @@ void vHttpsTask(void* pvParameters) {
         Serial.println("If not then the login credentials are bad");
       }
 
-      if (propaneExpirationTimer.isExpired(PROPANE_TIMEOUT * 1000)) {
+      if (propaneExpirationTimer.isExpired()) {
         if (callApi("https://ws.otodatanetwork.com/neevoapp/v1/DataService.svc/GetAllDisplayPropaneDevices", "propane", (void**) &doc)) {
-          data.propaneLevel = scrubPropaneLevel((byte) doc[0]["Level"]);
+          float propaneLevel = doc[0]["Level"];
+          data.update(CHANNEL_PROPANE_LEVEL, propaneLevel);
           Serial.print("Propane level = ");
-          Serial.print(data.propaneLevel);
+          Serial.print(propaneLevel);
           Serial.println("%");
         }
 
-        propaneExpirationTimer.reset();
+        propaneExpirationTimer.start(PROPANE_TIMEOUT * 1000);
       }
 
-      if (temperatureExpirationTimer.isExpired(TEMPERATURE_TIMEOUT * 1000)) {
+      if (temperatureExpirationTimer.isExpired()) {
         if (callApi("https://api.openweathermap.org/data/2.5/weather?lat=47.3874978&lon=-122.1391124&appid=", "temperature", (void**) &doc)) {
-          data.outdoorTemperature = scrubTemperature((((float) doc["main"]["temp"] - 273.15) * (9.0 / 5.0)) + 32);
-          data.outdoorHumidity = scrubHumidity((byte) doc["main"]["humidity"]);
+          float outdoorTemperature = (((float) doc["main"]["temp"] - 273.15) * (9.0 / 5.0)) + 32;
+          float outdoorHumidity = doc["main"]["humidity"];
+          uint32_t age = sampleAge((time_t) doc["dt"]);
+          data.update(CHANNEL_OUTDOOR_TEMPERATURE, outdoorTemperature, age);
+          data.update(CHANNEL_OUTDOOR_HUMIDITY, outdoorHumidity, age);
           Serial.print("Outdoor temperature = ");
-          Serial.println(data.outdoorTemperature);
+          Serial.println(outdoorTemperature);
           Serial.print("Outdoor humidity = ");
-          Serial.print(data.outdoorHumidity);
+          Serial.print(outdoorHumidity);
           Serial.println("%");
         }
 
-        temperatureExpirationTimer.reset();
-      }
-
-      if (uxTaskGetStackHighWaterMark(NULL) < httpsTaskHighWaterMark) {
-        Serial.printf("httpsTaskHighWaterMark has changed from %d to %d\n", (httpsTaskHighWaterMark == LONG_MAX ? -1 : httpsTaskHighWaterMark), uxTaskGetStackHighWaterMark(NULL));
-        httpsTaskHighWaterMark = uxTaskGetStackHighWaterMark(NULL);
+        temperatureExpirationTimer.start(TEMPERATURE_TIMEOUT * 1000);
       }
     } catch (...) {
     }
 
-    vTaskDelay(60000);
+    HttpsPool::closeIdle();  // Hands the TLS buffers of hosts polled rarely back to the heap
+    vTaskDelay(HTTPS_POLL_INTERVAL);
   }
 }
@@ -1,3 +1,6 @@
 #pragma once
 
+#include <Arduino.h>
+#include "data.h"
+
 void vHttpsTask(void* pvParameters);
@@ -4,27 +4,26 @@
 #include <Time.h>
 #include "semver.h"
 struct semver_struct version = {0x01, 0x00, 0x00};
-#include <ExpirationTimer.h>
 #include <PersistentStorage.h>
+#include "Log.h"
+#include "Metrics.h"
+#include "Profiler.h"
+#include "Benchmarks.h"
+#include "DisplaySnapshot.h"
+#include "LatencyTrace.h"
+#include "Events.h"
+#include "TimerWheel.h"
 
 #include "lora-cgm-sender.ino.globals.h"
 
 #include "data.h"
-volatile struct data_struct data = {
-  -1,  // time
-  0,  // DST begin
-  0,  // DST end
-  0,  // standard time offset
-  0,  // daylight time offset
-  false,  // forceDisplayTimeUpdate
-  false,  // forceLoRaTimeUpdate
-  UNKNOWN_MG_PER_DL,  // CGM reading
-  UNKNOWN_PROPANE_LEVEL,  // propane level
-  UNKNOWN_TEMPERATURE,  // indoor temperature
-  UNKNOWN_HUMIDITY,  // indoor humidity
-  UNKNOWN_TEMPERATURE,  // outdoor temperature
-  UNKNOWN_HUMIDITY  // outdoor humidity
-};
+struct data_struct data;  // Every channel starts out unknown
+
+#if defined(ENABLE_CGM_HISTORY)
+#include "TimeSeries.h"
+TimeSeries cgmHistory(CHANNEL_MG_PER_DL);
+#define CGM_HISTORY_REPORT_PERIOD (24 * 3600)  // Seconds dumped by the 'h' command
+#endif
 
 #if defined(ENABLE_DISPLAY)
 #include "Display.h"
@@ -46,15 +45,149 @@ LoRaSync* loRaSync;
 SPIClass spi2(FSPI);
 #endif
 
+// The radio gets a core of its own at the highest priority, while rendering and
+// the TLS connections share the core that also runs the Wi-Fi stack
+#define RADIO_TASK_STACK_SIZE 8192
+#define RADIO_TASK_PRIORITY 10
+#define RADIO_TASK_CORE 1
+#define DISPLAY_TASK_STACK_SIZE 8192
+#define DISPLAY_TASK_PRIORITY 6
+#define DISPLAY_TASK_CORE 0
+#define HTTPS_TASK_STACK_SIZE 16384
+#define HTTPS_TASK_PRIORITY 5
+#define HTTPS_TASK_CORE 0
+
+#define COMMAND_POLL_INTERVAL 100
+
 uint setupState = 0x00;
 
+#if defined(DATA_COLLECTOR)
+bool wifiConnected = false;
+void wifiGotIp(WiFiEvent_t event, WiFiEventInfo_t info) {
+  if (wifiConnected) {
+    Metrics::increment(METRIC_WIFI_RECONNECTS);
+  }
+  wifiConnected = true;
+}
+#endif
+
+#if defined(ENABLE_SYNC)
+void vRadioTask(void* pvParameters) {
+  Events::subscribe(EVENT_LORA_IRQ | EVENT_LORA_QUEUED | EVENT_DATA_CHANGED | EVENT_RADIO_TIMER);
+  loRaSync->sendBootSync();
+
+  while (true) {
+    PROFILE_BEGIN_ITERATION(PROFILE_TASK_RADIO);
+    Events::take(EVENT_LORA_QUEUED | EVENT_DATA_CHANGED | EVENT_RADIO_TIMER);  // Everything below looks at the latest state
+    loRaSync->loop();
+    PROFILE_END_ITERATION(PROFILE_TASK_RADIO);
+
+    Events::wait(loRaSync->nextDeadline());
+  }
+}
+#endif
+
+#if defined(ENABLE_DISPLAY)
+void vDisplayTask(void* pvParameters) {
+  Events::subscribe(EVENT_DATA_CHANGED | EVENT_DISPLAY_TIMER);
+
+  while (true) {
+    PROFILE_BEGIN_ITERATION(PROFILE_TASK_DISPLAY);
+    Events::take(EVENT_DATA_CHANGED | EVENT_DISPLAY_TIMER);
+    display->loop();
+    PROFILE_END_ITERATION(PROFILE_TASK_DISPLAY);
+
+    Events::wait(display->nextDeadline());
+  }
+}
+#endif
+
+void createTask(TaskFunction_t taskFunction, const char* name, uint32_t stackSize, UBaseType_t priority, BaseType_t core) {
+  TaskHandle_t xHandle = NULL;
+  BaseType_t xReturned = xTaskCreatePinnedToCore(
+    taskFunction,
+    name,
+    stackSize,
+    NULL,
+    priority,
+    &xHandle,
+    core);
+
+  if (xReturned != pdPASS) {
+    Serial.print(name);
+    Serial.println("Task could not be created");
+    return;
+  }
+  Metrics::registerTask(xHandle);
+}
+
+// Logs every value that passed its deadband and every alert
+void logDataChanges() {
+  uint32_t changes = data.changes.consume(DATA_SUBSCRIBER_LOG);
+  if (changes & DATA_BIT(DATA_ALERT)) {
+    struct alert_struct alert = data.alert.read();
+    LOG_INFO(LOG_ALERT, alert.alertId, Alerts::name(alert.level), alert.mgPerDl);
+  }
+
+  uint32_t channels = DATA_CHANNELS(changes);
+  for (; channels != 0; channels &= channels - 1) {
+    channel_enum channel = (channel_enum) __builtin_ctz(channels);
+    LOG_INFO(LOG_DATA_CHANGED, channelInfo[channel].name, data.changes.published(channel));
+  }
+}
+
+// Single character commands typed into the serial monitor
+void processSerialCommands() {
+  while (Serial.available() > 0) {
+    switch (Serial.read()) {
+      case 'm':
+        Metrics::dump(&Serial);
+        break;
+
+#if defined(ENABLE_PROFILER)
+      case 'p':
+        Profiler::report(&Serial);
+        break;
+
+      case 'P':
+        Profiler::reset();
+        break;
+#endif
+
+#if defined(ENABLE_BENCHMARKS)
+      case 'b':
+        Benchmarks::run(&Serial);
+        break;
+#endif
+
+#if defined(ENABLE_DISPLAY_SNAPSHOT)
+      case 'd':
+        DisplaySnapshot::capture(&Serial);
+        break;
+#endif
+
+#if defined(ENABLE_LATENCY_TRACE)
+      case 'l':
+        LatencyTrace::report(&Serial);
+        break;
+#endif
+
+#if defined(ENABLE_CGM_HISTORY)
+      case 'h':
+        cgmHistory.report(&Serial, time(nullptr) - CGM_HISTORY_REPORT_PERIOD, time(nullptr) + 1);
+        break;
+#endif
+    }
+  }
+}
+
 void setup() {
 #if defined(ENABLE_DISPLAY)
   display = new Display(&data);
   display->setup();
 #endif
 
-  Serial.setTxBufferSize(16384);
+  Serial.setTxBufferSize(1024);  // The hot paths log through the Log task instead of blocking on Serial
   Serial.begin(9600);
   unsigned long baseMillis = millis();
   while (!Serial &&
@@ -67,6 +200,11 @@ void setup() {
   Serial.println();
   Serial.println("Starting...");
 
+  Log::setup();
+  Metrics::registerTask(xTaskGetCurrentTaskHandle());
+  Events::setup();
+  TimerWheel::setup();
+
 #if defined(ENABLE_SYNC)
   // spi2.begin(SCK, MISO, MOSI, SS);
   spi2.begin(5, 6, 7, 8); // ESP32-S3-Zero
@@ -74,16 +212,35 @@ void setup() {
   loRaSync->setup();
 #endif
 
-#if defined(DATA_COLLECTOR)
-  if (!PersistentStorage::setup(4096)) {
+  bool storageMounted = PersistentStorage::setup(4096);
+  if (!storageMounted) {
     Serial.println("!PersistentStorage setup failed!");
   }
 
+  // The clock shows local time from boot, before the network or another node answers
+  struct timezoneInfo_struct timezoneInfo;
+  struct timezoneTable_struct timezoneTable;
+  if (storageMounted &&
+      Timezone::load(&timezoneInfo, &timezoneTable)) {
+    data.timezoneInfo.write(timezoneInfo);
+    data.timezoneTable.write(timezoneTable);
+    data.changes.publish(DATA_BIT(DATA_CLOCK));
+  }
+
+#if defined(ENABLE_CGM_HISTORY)
+  if (storageMounted) {
+    cgmHistory.setup();
+  }
+  data.history[CHANNEL_MG_PER_DL] = &cgmHistory;
+#endif
+
+#if defined(DATA_COLLECTOR)
   struct wifiCredentials_struct wifiCredentials = {WIFI_SSID, WIFI_PASSPHRASE};
   PersistentStorage::registerPartition("wifi-creds", sizeof(wifiCredentials_struct));
   PersistentStorage::writePartition("wifi-creds", 0, (byte*) &wifiCredentials, sizeof(wifiCredentials_struct));
   PersistentStorage::readPartition("wifi-creds", 0, (byte*) &wifiCredentials, sizeof(wifiCredentials_struct));
 
+  WiFi.onEvent(wifiGotIp, ARDUINO_EVENT_WIFI_STA_GOT_IP);
   WiFi.begin(wifiCredentials.ssid, wifiCredentials.passphrase);
 #endif
 
@@ -92,7 +249,15 @@ void setup() {
 
 unsigned long baseMillis = millis();
 void loop() {
-  PersistentStorage::loop();
+  PROFILE_BEGIN_ITERATION(PROFILE_TASK_LOOP);
+
+  {
+    PROFILE_SCOPE(PROFILE_LOOP_STORAGE);
+    PersistentStorage::loop();
+#if defined(ENABLE_CGM_HISTORY)
+    cgmHistory.loop();
+#endif
+  }
 
   switch (setupState) {
     // Initialize the time
@@ -121,7 +286,7 @@ void loop() {
 
       break;
 
-    // Initialize the HTTPS thread
+    // Start the tasks
     case 0x02:
       {
 #if defined(DATA_COLLECTOR)
@@ -136,47 +301,39 @@ void loop() {
 #endif
 
 #if defined(DATA_COLLECTOR)
-        BaseType_t xReturned;
-        TaskHandle_t xHandle = NULL;
-
-        #define STACK_SIZE 16384  // 16KB
-        xReturned = xTaskCreate(
-          vHttpsTask,         /* Function that implements the task. */
-          "HTTPS",           /* Text name for the task. */
-          STACK_SIZE,        /* Stack size in words, not bytes. */
-          NULL,              /* Parameter passed into the task. */
-          5, // tskIDLE_PRIORITY,  /* Priority at which the task is created. */
-          &xHandle);         /* Used to pass out the created task's handle. */
-
-        if (xReturned != pdPASS) {
-          Serial.println("HttpsTask could not be created");
-        }
+        createTask(vHttpsTask, "HTTPS", HTTPS_TASK_STACK_SIZE, HTTPS_TASK_PRIORITY, HTTPS_TASK_CORE);
 #endif
 
 #if defined(ENABLE_SYNC)
-      loRaSync->sendBootSync();
+        createTask(vRadioTask, "Radio", RADIO_TASK_STACK_SIZE, RADIO_TASK_PRIORITY, RADIO_TASK_CORE);
+#endif
+
+#if defined(ENABLE_DISPLAY)
+        // The display belongs to its task from here on
+        createTask(vDisplayTask, "Display", DISPLAY_TASK_STACK_SIZE, DISPLAY_TASK_PRIORITY, DISPLAY_TASK_CORE);
 #endif
         setupState = 0xFF;
       }
 
       break;
 
-    // Normal running
+    // Normal running, the radio, display and HTTPS tasks do the work
     case 0xFF:
-      if (time(nullptr) > 86400 * 365) {  // Give NTP one year to sync
-        data.time = time(nullptr);
-      }
+      break;
+  }
 
-#if defined(ENABLE_SYNC)
-      loRaSync->loop();
-#endif
+  {
+    PROFILE_SCOPE(PROFILE_LOOP_COMMANDS);
+    processSerialCommands();
+  }
 
-#if defined(ENABLE_DISPLAY)
-      display->loop();
-#endif
+  logDataChanges();
 
-      break;
-  }
+  PROFILE_END_ITERATION(PROFILE_TASK_LOOP);
 
-  taskYIELD();
+  if (setupState == 0xFF) {
+    vTaskDelay(pdMS_TO_TICKS(COMMAND_POLL_INTERVAL));
+  } else {
+    taskYIELD();
+  }
 }
@@ -1,9 +1,23 @@
 #pragma once
 
-#define UNKNOWN_MG_PER_DL ((uint16_t) 0xFFFF)
-#define UNKNOWN_PROPANE_LEVEL 0xFF
-#define UNKNOWN_TEMPERATURE -100.0
-#define UNKNOWN_HUMIDITY 0xFF
+#define LOG_LEVEL LOG_LEVEL_INFO
+#define ENABLE_EVENT_LOOP  // Sleep between radio interrupts, data changes and timer deadlines instead of spinning
+// #define ENABLE_PROFILER  // Cycle-count histograms for the task loops, reported with the 'p' serial command
+// #define ENABLE_BENCHMARKS  // Microbenchmarks for the hot code paths, run with the 'b' serial command
+// #define ENABLE_DISPLAY_SNAPSHOT  // Layout render stats and a PPM of the framebuffer, printed with the 'd' serial command
+// #define ENABLE_LATENCY_TRACE  // CGM reading to rendered pixels latency per stage, reported with the 'l' serial command
+#define ENABLE_CGM_HISTORY  // Keep weeks of CGM readings in RAM and on SPIFFS, dumped with the 'h' serial command
+// #define SIMULATE_API_RESPONSES  // Answer API calls from recorded payloads every 5 seconds instead of using the network
+
+// Glucose thresholds in mg/dL. Below CGM_URGENT_LOW or above CGM_URGENT_HIGH is
+// drawn red and alerted, between them and CGM_LOW / CGM_HIGH drawn yellow. A
+// reading projected to cross an urgent threshold within CGM_ALERT_MINUTES is
+// alerted as if it already had.
+#define CGM_URGENT_LOW 70
+#define CGM_LOW 80
+#define CGM_HIGH 150
+#define CGM_URGENT_HIGH 250
+#define CGM_ALERT_MINUTES 20
 
 #define DATA_COLLECTOR
 #define ENABLE_DISPLAY
@@ -0,0 +1,33 @@
+#pragma once
+
+// Recorded API responses (identifiers and tokens replaced) used by the benchmarks and
+// by the simulated API mode
+
+const char RECORDED_LLU_CONNECTIONS[] PROGMEM = R"json({"status":0,"data":[{"id":"4b8e7c2a-0d1f-11ee-9a4b-0242ac110002","patientId":"4b8e7c2a-0d1f-11ee-9a4b-0242ac110002","country":"US","status":2,"firstName":"Jane","lastName":"Doe","targetLow":70,"targetHigh":180,"uom":1,"sensor":{"deviceId":"","sn":"0M0000ABCD","a":1760800000,"w":60,"pt":4,"s":false,"lj":false},"alarmRules":{"c":true,"h":{"on":true,"th":250,"thmm":13.9,"d":1440,"f":0.1},"f":{"th":55,"thmm":3,"d":30,"tl":10,"tlmm":0.6},"l":{"on":true,"th":70,"thmm":3.9,"d":1440,"tl":10,"tlmm":0.6},"nd":{"i":20,"r":5,"l":6},"p":5,"r":5,"std":{}},"glucoseMeasurement":{"FactoryTimestamp":"10/19/2026 3:14:00 PM","Timestamp":"10/19/2026 8:14:00 AM","type":1,"ValueInMgPerDl":112,"TrendArrow":3,"TrendMessage":null,"MeasurementColor":1,"GlucoseUnits":1,"Value":112,"isHigh":false,"isLow":false},"glucoseItem":{"FactoryTimestamp":"10/19/2026 3:14:00 PM","Timestamp":"10/19/2026 8:14:00 AM","type":1,"ValueInMgPerDl":112,"TrendArrow":3,"TrendMessage":null,"MeasurementColor":1,"GlucoseUnits":1,"Value":112,"isHigh":false,"isLow":false},"glucoseAlarm":null,"patientDevice":{"did":"6c1f2e4a-0d1f-11ee-9a4b-0242ac110002","dtid":40068,"v":"3.5.2","ll":70,"hl":250,"u":1760000000,"fixedLowAlarmValues":{"mgdl":55,"mmoll":3},"alarms":false,"fixedLowThreshold":0},"created":1700000000}],"ticket":{"token":"eyJhbGciOiJIUzI1NiIsInR5cCI6IkpXVCJ9.e30.benchmark","expires":1776400000,"duration":15552000000}})json";
+
+const char RECORDED_OTODATA_DEVICES[] PROGMEM = R"json([{"SerialNumber":"1234567","Level":64.0,"TankCapacity":500.0,"FuelType":"Propane","LastReadingDate":"2026-10-19T14:00:00","LastCommunicationDate":"2026-10-19T14:02:11","BatteryLevel":"Good","CustomTankName":"House","UnitOfMeasure":"Gallons","DeviceType":"Nee-Vo","IsOwner":true,"Alerts":[],"ConsumptionHistory":[{"Date":"2026-10-18","Level":65.0},{"Date":"2026-10-17","Level":66.0},{"Date":"2026-10-16","Level":66.0},{"Date":"2026-10-15","Level":67.0}]}])json";
+
+const char RECORDED_OPEN_WEATHER_MAP[] PROGMEM = R"json({"coord":{"lon":-122.1391,"lat":47.3875},"weather":[{"id":500,"main":"Rain","description":"light rain","icon":"10d"}],"base":"stations","main":{"temp":284.52,"feels_like":283.91,"temp_min":283.15,"temp_max":285.93,"pressure":1017,"humidity":86,"sea_level":1017,"grnd_level":1003},"visibility":10000,"wind":{"speed":3.6,"deg":190,"gust":6.2},"rain":{"1h":0.31},"clouds":{"all":100},"dt":1760886000,"sys":{"type":2,"id":2041694,"country":"US","sunrise":1760884200,"sunset":1760922600},"timezone":-25200,"id":5800112,"name":"Kent","cod":200})json";
+
+const char RECORDED_TIMEZONE_INFO[] PROGMEM =
+  "# type,timezone,standard offset\n"
+  "# type,timezone,dst begin,dst end,daylight offset\n"
+  "1,America/New_York,-18000\n"
+  "2,America/New_York,1773558000,1793516400,-14400\n"
+  "1,America/Chicago,-21600\n"
+  "2,America/Chicago,1773561600,1793520000,-18000\n"
+  "1,America/Denver,-25200\n"
+  "2,America/Denver,1773565200,1793523600,-21600\n"
+  "1,America/Phoenix,-25200\n"
+  "1,America/Los_Angeles,-28800\n"
+  "2,America/Los_Angeles,1773568800,1793527200,-25200\n"
+  "1,America/Anchorage,-32400\n"
+  "2,America/Anchorage,1773572400,1793530800,-28800\n"
+  "1,Pacific/Honolulu,-36000\n"
+  "1,Europe/London,0\n"
+  "2,Europe/London,1774746000,1792890000,3600\n"
+  "1,Europe/Berlin,3600\n"
+  "2,Europe/Berlin,1774746000,1792890000,7200\n"
+  "1,Asia/Tokyo,32400\n"
+  "1,Australia/Sydney,36000\n"
+  "2,Australia/Sydney,1759593600,1775318400,39600\n";
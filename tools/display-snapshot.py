@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+"""Captures a display snapshot and compares it with a golden image.
+
+The firmware, built with ENABLE_DISPLAY_SNAPSHOT, answers the 'd' serial
+command by rendering its layout from fixed readings into an off-screen
+framebuffer. It prints one JSON line per step with the pixels and address
+windows pushed, the pixels that really changed and the overdraw, followed by
+the final frame as a binary PPM.
+
+The source is a serial port (needs pyserial) or a file holding a capture.
+The frame and the stats are written to <out>/<layout>.ppm and .json. With
+--golden, the frame is compared with <golden>/<layout>.ppm, outside the clock,
+the graph and any --ignore rectangles, and every step's pixels and windows with
+<golden>/<layout>.json. The exit status is 1 when the image differs or a step
+pushes more than before.
+
+    tools/display-snapshot.py /dev/ttyACM0 --golden tools/golden
+    tools/display-snapshot.py /dev/ttyACM0 --out tools/golden  # Accept a new golden
+"""
+
+import argparse
+import json
+import os
+import re
+import sys
+import time
+
+# Areas that differ between captures, x, y, w, h. The clock shows the time of
+# the capture, and the graph puts each reading in the column of its uptime.
+UNSTABLE_AREAS = {
+    "st7735_128_160": [(12, 69, 138, 48)],
+    "ili9488_480_320": [(174, 176, 288, 96), (176, 278, 288, 34)],
+}
+
+PPM_HEADER = re.compile(rb"P6\n# lora-cgm (\S+)\n(\d+) (\d+)\n255\n")
+
+
+def read_serial(port, timeout):
+    try:
+        import serial
+    except ImportError:
+        sys.exit("pyserial is needed to read a serial port (pip install pyserial)")
+
+    capture = b""
+    with serial.Serial(port, 115200, timeout=1) as connection:
+        connection.reset_input_buffer()
+        connection.write(b"d")
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            capture += connection.read(65536)
+            match = PPM_HEADER.search(capture)
+            if (match is not None) and (len(capture) >= match.end() + int(match.group(2)) * int(match.group(3)) * 3):
+                return capture
+            if b'"snapshot":"skipped"' in capture:
+                return capture
+    sys.exit("%s: no complete snapshot within %d seconds" % (port, timeout))
+
+
+def parse(capture):
+    steps = []
+    for line in capture.split(b"\n"):
+        line = line.strip()
+        if line.startswith(b'{"snapshot"'):
+            step = json.loads(line)
+            if step["snapshot"] == "skipped":
+                sys.exit("skipped: %s" % step["reason"])
+            steps.append(step)
+
+    match = PPM_HEADER.search(capture)
+    if match is None:
+        sys.exit("no PPM in the capture")
+    layout = match.group(1).decode()
+    width, height = int(match.group(2)), int(match.group(3))
+    pixels = capture[match.end():match.end() + width * height * 3]
+    if len(pixels) != width * height * 3:
+        sys.exit("truncated PPM, %d of %d bytes" % (len(pixels), width * height * 3))
+    return layout, width, height, pixels, steps
+
+
+def read_ppm(path):
+    data = open(path, "rb").read()
+    match = PPM_HEADER.match(data)
+    if match is None:
+        sys.exit("%s: not a snapshot PPM" % path)
+    return int(match.group(2)), int(match.group(3)), data[match.end():]
+
+
+def compare_image(golden_path, width, height, pixels, ignored):
+    golden_width, golden_height, golden = read_ppm(golden_path)
+    if (golden_width, golden_height) != (width, height):
+        print("image: %dx%d, golden is %dx%d" % (width, height, golden_width, golden_height))
+        return False
+
+    differing = 0
+    box = None
+    for y in range(height):
+        for x in range(width):
+            if any((ix <= x < ix + iw) and (iy <= y < iy + ih) for ix, iy, iw, ih in ignored):
+                continue
+            offset = (y * width + x) * 3
+            if pixels[offset:offset + 3] != golden[offset:offset + 3]:
+                differing += 1
+                box = (x, y, x, y) if box is None else (min(box[0], x), min(box[1], y), max(box[2], x), max(box[3], y))
+    if differing > 0:
+        print("image: %d pixels differ, within %d,%d - %d,%d" % ((differing,) + box))
+        return False
+    print("image: matches")
+    return True
+
+
+def compare_steps(golden_path, steps):
+    golden = {step["snapshot"]: step for step in json.load(open(golden_path))}
+    passed = True
+    for step in steps:
+        before = golden.get(step["snapshot"])
+        if before is None:
+            print("%-20s new" % step["snapshot"])
+            continue
+        grew = [key for key in ("pixels", "windows") if step[key] > before[key]]
+        print("%-20s pixels %7d (%+d)  windows %5d (%+d)  overdraw %7d%s"
+              % (step["snapshot"], step["pixels"], step["pixels"] - before["pixels"],
+                 step["windows"], step["windows"] - before["windows"], step["overdraw"],
+                 "  MORE " + ", ".join(grew).upper() if grew else ""))
+        passed = passed and not grew
+    return passed
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("source", help="serial port, or a file holding a capture")
+    parser.add_argument("--out", default=".", help="directory for <layout>.ppm and .json")
+    parser.add_argument("--golden", help="directory holding the golden <layout>.ppm and .json")
+    parser.add_argument("--ignore", action="append", default=[], metavar="X,Y,W,H",
+                        help="rectangle left out of the image comparison, besides the clock and graph")
+    parser.add_argument("--timeout", type=int, default=60, help="seconds to wait for a serial snapshot")
+    args = parser.parse_args()
+
+    if os.path.isfile(args.source):
+        capture = open(args.source, "rb").read()
+    else:
+        capture = read_serial(args.source, args.timeout)
+    layout, width, height, pixels, steps = parse(capture)
+
+    os.makedirs(args.out, exist_ok=True)
+    with open(os.path.join(args.out, layout + ".ppm"), "wb") as ppm:
+        ppm.write(b"P6\n# lora-cgm %s\n%d %d\n255\n" % (layout.encode(), width, height))
+        ppm.write(pixels)
+    with open(os.path.join(args.out, layout + ".json"), "w") as stats:
+        json.dump(steps, stats, indent=2)
+
+    if args.golden is None:
+        for step in steps:
+            print(json.dumps(step))
+        return
+
+    ignored = [tuple(int(value) for value in rectangle.split(",")) for rectangle in args.ignore]
+    ignored += UNSTABLE_AREAS.get(layout, [])
+    passed = compare_steps(os.path.join(args.golden, layout + ".json"), steps)
+    passed = compare_image(os.path.join(args.golden, layout + ".ppm"), width, height, pixels, ignored) and passed
+    sys.exit(0 if passed else 1)
+
+
+if __name__ == "__main__":
+    main()
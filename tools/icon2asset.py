@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+"""Converts an icon into a palette + run-length encoded asset header for Icons.h.
+
+The source is either an image (PNG etc., needs Pillow), composited onto black,
+or a header holding a raw uint16_t RGB565 array like the ones the firmware used
+to include. Colours are written byte swapped, the order pushImage() sends
+without setSwapBytes().
+
+Each byte of the output is one run: the palette index in the top indexBits
+bits and the run length minus one in the rest. Runs never cross a row, so the
+decoder can produce one line at a time and skip the background.
+
+    tools/icon2asset.py propane.png PROPANE_TANK > propane-tank.h
+    tools/icon2asset.py old-thermometer.h THERMOMETER > thermometer.h
+"""
+
+import argparse
+import os
+import re
+import sys
+
+MAX_PALETTE = 16
+MAX_WIDTH = 128  # ICON_MAX_WIDTH, the decoder's line buffer
+
+
+def read_image(path):
+    try:
+        from PIL import Image
+    except ImportError:
+        sys.exit("Pillow is needed for image sources (pip install Pillow)")
+
+    image = Image.open(path).convert("RGBA")
+    background = Image.new("RGBA", image.size, (0, 0, 0, 255))
+    image = Image.alpha_composite(background, image).convert("RGB")
+    pixels = []
+    for r, g, b in image.getdata():
+        color = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3)
+        pixels.append(((color & 0xFF) << 8) | (color >> 8))
+    return image.width, image.height, pixels
+
+
+def read_header(path, size):
+    text = open(path).read()
+    body = text[text.index("{") + 1:text.rindex("}")]
+    body = re.sub(r"//[^\n]*", "", body)
+    pixels = [int(value, 16) for value in re.findall(r"0x[0-9A-Fa-f]+", body)]
+
+    if size is None:
+        match = re.search(r"(\d+)x(\d+)px", text)
+        if match is None:
+            sys.exit("%s: pass --size, the header has no WxHpx comment" % path)
+        size = "%sx%s" % match.groups()
+    width, height = (int(value) for value in size.split("x"))
+    if len(pixels) != width * height:
+        sys.exit("%s: %d pixels for %dx%d" % (path, len(pixels), width, height))
+    return width, height, pixels
+
+
+def encode(width, height, pixels):
+    if width > MAX_WIDTH:
+        sys.exit("%d pixels wide, at most %d fit the decoder's line buffer" % (width, MAX_WIDTH))
+
+    # The top left pixel is the background, which the decoder can skip
+    palette = []
+    for color in [pixels[0]] + pixels:
+        if color not in palette:
+            palette.append(color)
+    if len(palette) > MAX_PALETTE:
+        sys.exit("%d colours, at most %d fit the palette" % (len(palette), MAX_PALETTE))
+
+    index_bits = max(1, (len(palette) - 1).bit_length())
+    max_run = 1 << (8 - index_bits)
+    runs = []
+    for row in range(height):
+        line = pixels[row * width:(row + 1) * width]
+        start = 0
+        while start < width:
+            index = palette.index(line[start])
+            length = 1
+            while (start + length < width) and (line[start + length] == line[start]) and (length < max_run):
+                length += 1
+            runs.append((index << (8 - index_bits)) | (length - 1))
+            start += length
+    return palette, index_bits, runs
+
+
+def emit(name, source, width, height, palette, index_bits, runs, out):
+    raw = width * height * 2
+    encoded = len(palette) * 2 + len(runs)
+    out.write("// Generated by tools/icon2asset.py from %s, do not edit\n" % os.path.basename(source))
+    out.write("// %dx%d, %d colours, %d bytes instead of %d raw\n" % (width, height, len(palette), encoded, raw))
+    out.write("#pragma once\n\n")
+    out.write("#include \"Icons.h\"\n\n")
+    out.write("static const uint16_t %s_PALETTE[] PROGMEM = {\n  %s\n};\n\n"
+              % (name, ", ".join("0x%04X" % color for color in palette)))
+    out.write("static const uint8_t %s_RUNS[] PROGMEM = {\n" % name)
+    for i in range(0, len(runs), 16):
+        out.write("  " + ", ".join("0x%02X" % run for run in runs[i:i + 16]) + ",\n")
+    out.write("};\n\n")
+    out.write("static const struct iconAsset_struct %s = { %d, %d, %d, %s_PALETTE, %s_RUNS };\n"
+              % (name, width, height, index_bits, name, name))
+    out.write("static_assert(%d <= ICON_MAX_WIDTH, \"%s is wider than the icon line buffer\");\n" % (width, name))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("source", help="image, or header with a raw RGB565 array")
+    parser.add_argument("name", help="C name of the asset, e.g. PROPANE_TANK")
+    parser.add_argument("--size", help="WxH of a header source without a WxHpx comment")
+    args = parser.parse_args()
+
+    if args.source.endswith(".h"):
+        width, height, pixels = read_header(args.source, args.size)
+    else:
+        width, height, pixels = read_image(args.source)
+    palette, index_bits, runs = encode(width, height, pixels)
+    emit(args.name, args.source, width, height, palette, index_bits, runs, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()